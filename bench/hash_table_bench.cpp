@@ -0,0 +1,248 @@
+#include "flat_hash_table.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * Compares the flat hash tables used by the hash engine with the standard node-based ones.
+ * Every table is filled with random keys (insert), probed with as many keys of which a half is
+ * present (lookup), iterated over (iterate) and used to count keys which repeat twice on
+ * average (count). Small sizes are repeated until every measurement covers enough keys; the
+ * best time per key is printed as one JSON object per line.
+ */
+
+namespace {
+
+static constexpr uint64_t DEFAULT_SEED     = 20200101;
+static constexpr size_t   DEFAULT_REPEATS  = 3;
+static constexpr size_t   KEYS_PER_MEASURE = 10000000;
+
+struct Options
+{
+  std::vector<size_t> sizes{1000, 100000, 10000000};
+  size_t              repeats{DEFAULT_REPEATS};
+  uint64_t            seed{DEFAULT_SEED};
+};
+
+void printUsage()
+{
+  std::cout << "Usage: scalc_hash_bench [--sizes 1000,100000,10000000] [--repeat N] [--seed N]\n"
+               "Sizes up to 100000000 are supported.\n";
+}
+
+Options parseOptions(int argc, char **argv)
+{
+  Options options;
+  for (int i{1}; i < argc; ++i)
+  {
+    const std::string option(argv[i]);
+    if (option == "--help" || i + 1 >= argc)
+    {
+      printUsage();
+      std::exit(option == "--help" ? 0 : -1);
+    }
+    const std::string value(argv[++i]);
+    if (option == "--sizes")
+    {
+      options.sizes.clear();
+      std::stringstream stream(value);
+      std::string       size;
+      while (std::getline(stream, size, ','))
+      {
+        options.sizes.push_back(std::stoull(size));
+      }
+    }
+    else if (option == "--repeat")
+    {
+      options.repeats = std::max<size_t>(1, std::stoul(value));
+    }
+    else if (option == "--seed")
+    {
+      options.seed = std::stoull(value);
+    }
+    else
+    {
+      printUsage();
+      std::exit(-1);
+    }
+  }
+  return options;
+}
+
+/// Operations of the benchmark over a standard set and map.
+struct StdTables
+{
+  static constexpr const char *NAME = "std";
+
+  std::unordered_set<DataType>         set;
+  std::unordered_map<DataType, size_t> counts;
+
+  void insert(DataType key)
+  {
+    set.insert(key);
+  }
+  bool contains(DataType key) const
+  {
+    return set.count(key) > 0;
+  }
+  DataType sum() const
+  {
+    DataType total = 0;
+    for (auto key : set)
+    {
+      total += key;
+    }
+    return total;
+  }
+  void increment(DataType key)
+  {
+    ++counts[key];
+  }
+};
+
+/// Operations of the benchmark over the flat set and count map.
+struct FlatTables
+{
+  static constexpr const char *NAME = "flat";
+
+  FlatHashSet  set;
+  FlatCountMap counts;
+
+  void insert(DataType key)
+  {
+    set.insert(key);
+  }
+  bool contains(DataType key) const
+  {
+    return set.contains(key);
+  }
+  DataType sum() const
+  {
+    DataType total = 0;
+    set.forEach([&](DataType key) { total += key; });
+    return total;
+  }
+  void increment(DataType key)
+  {
+    counts.increment(key);
+  }
+};
+
+struct Timings
+{
+  double insert{1e300};
+  double lookup{1e300};
+  double iterate{1e300};
+  double count{1e300};
+};
+
+template <typename Body>
+double nanosecondsPerKey(size_t keys, Body body)
+{
+  const auto start = std::chrono::steady_clock::now();
+  body();
+  const auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / double(keys);
+}
+
+/**
+ * @brief Runs all the operations over fresh tables, the checksum keeps the compiler from
+ * dropping the loops.
+ */
+template <typename Tables>
+Timings measure(std::vector<DataType> const &keys, std::vector<DataType> const &probes,
+                std::vector<DataType> const &repeated, size_t repeats, DataType &checksum)
+{
+  const size_t rounds = std::max<size_t>(1, KEYS_PER_MEASURE / keys.size());
+  Timings      best;
+  for (size_t r{0}; r < repeats; ++r)
+  {
+    std::vector<Tables> tables(rounds);
+    best.insert = std::min(best.insert, nanosecondsPerKey(rounds * keys.size(), [&] {
+      for (auto &table : tables)
+      {
+        for (auto key : keys)
+        {
+          table.insert(key);
+        }
+      }
+    }));
+    best.lookup = std::min(best.lookup, nanosecondsPerKey(rounds * probes.size(), [&] {
+      for (auto const &table : tables)
+      {
+        for (auto key : probes)
+        {
+          checksum += table.contains(key) ? 1 : 0;
+        }
+      }
+    }));
+    best.iterate = std::min(best.iterate, nanosecondsPerKey(rounds * keys.size(), [&] {
+      for (auto const &table : tables)
+      {
+        checksum += table.sum();
+      }
+    }));
+    best.count = std::min(best.count, nanosecondsPerKey(rounds * repeated.size(), [&] {
+      for (auto &table : tables)
+      {
+        for (auto key : repeated)
+        {
+          table.increment(key);
+        }
+      }
+    }));
+  }
+  return best;
+}
+
+template <typename Tables>
+void report(size_t size, Timings const &timings)
+{
+  std::printf("{\"table\":\"%s\",\"size\":%zu,\"insert_ns\":%.2f,\"lookup_ns\":%.2f,"
+              "\"iterate_ns\":%.2f,\"count_ns\":%.2f}\n",
+              Tables::NAME, size, timings.insert, timings.lookup, timings.iterate, timings.count);
+  std::fflush(stdout);
+}
+
+}  // namespace
+
+int main(int argc, char **argv)
+{
+  const Options options  = parseOptions(argc, argv);
+  DataType      checksum = 0;
+  for (auto size : options.sizes)
+  {
+    std::mt19937_64                         random(options.seed ^ size);
+    std::uniform_int_distribution<DataType> uniform(0, DataType(size) * 10);
+
+    std::vector<DataType> keys(size);
+    for (auto &key : keys)
+    {
+      key = uniform(random);
+    }
+    // A half of the probes are keys of the table, the other half are most likely missing.
+    std::vector<DataType> probes(size);
+    for (size_t i{0}; i < size; ++i)
+    {
+      probes[i] = i % 2 == 0 ? keys[random() % size] : uniform(random);
+    }
+    std::vector<DataType> repeated(keys);
+    repeated.insert(repeated.end(), keys.begin(), keys.end());
+    std::shuffle(repeated.begin(), repeated.end(), random);
+
+    report<StdTables>(size, measure<StdTables>(keys, probes, repeated, options.repeats, checksum));
+    report<FlatTables>(size,
+                       measure<FlatTables>(keys, probes, repeated, options.repeats, checksum));
+  }
+  // On stderr, so the output stays one JSON object per line.
+  std::fprintf(stderr, "checksum %lld\n", static_cast<long long>(checksum));
+  return 0;
+}
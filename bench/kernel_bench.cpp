@@ -0,0 +1,211 @@
+#include "arena.hpp"
+#include "engine.hpp"
+#include "sorted_engine.hpp"
+#include "sorted_kernels.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * Measures the operations of the sorted engine at every level of the sorted-set kernels the CPU
+ * supports: the intersection, union and difference of two random sets, and the counting
+ * operations over three. Every result is checked against the hash engine, sorted, so the
+ * program exits with 1 on any mismatch. The best time per input value and the speedup over the
+ * scalar kernels are printed as one JSON object per line.
+ */
+
+namespace {
+
+static constexpr uint64_t DEFAULT_SEED       = 20200101;
+static constexpr size_t   DEFAULT_REPEATS    = 3;
+static constexpr size_t   VALUES_PER_MEASURE = 10000000;
+
+struct Options
+{
+  std::vector<size_t> sizes{1000, 100000, 10000000};
+  size_t              repeats{DEFAULT_REPEATS};
+  uint64_t            seed{DEFAULT_SEED};
+};
+
+void printUsage()
+{
+  std::cout << "Usage: scalc_kernel_bench [--sizes 1000,100000,10000000] [--repeat N] [--seed N]\n";
+}
+
+Options parseOptions(int argc, char **argv)
+{
+  Options options;
+  for (int i{1}; i < argc; ++i)
+  {
+    const std::string option(argv[i]);
+    if (option == "--help" || i + 1 >= argc)
+    {
+      printUsage();
+      std::exit(option == "--help" ? 0 : -1);
+    }
+    const std::string value(argv[++i]);
+    if (option == "--sizes")
+    {
+      options.sizes.clear();
+      std::stringstream stream(value);
+      std::string       size;
+      while (std::getline(stream, size, ','))
+      {
+        options.sizes.push_back(std::stoull(size));
+      }
+    }
+    else if (option == "--repeat")
+    {
+      options.repeats = std::max<size_t>(1, std::stoul(value));
+    }
+    else if (option == "--seed")
+    {
+      options.seed = std::stoull(value);
+    }
+    else
+    {
+      printUsage();
+      std::exit(-1);
+    }
+  }
+  return options;
+}
+
+struct Case
+{
+  const char *name;
+  size_t      inputs;
+  SetPtr (*run)(IEngine &engine, SetPtrEnsemble const &sets);
+};
+
+const Case CASES[] = {
+    {"intersection", 2,
+     [](IEngine &engine, SetPtrEnsemble const &sets) { return engine.sets_intersection(sets); }},
+    {"union", 2, [](IEngine &engine, SetPtrEnsemble const &sets) { return engine.sets_union(sets); }},
+    {"difference", 2,
+     [](IEngine &engine, SetPtrEnsemble const &sets) { return engine.sets_difference(sets); }},
+    {"greater_1", 3,
+     [](IEngine &engine, SetPtrEnsemble const &sets) {
+       return engine.keep_if_greater_than_n_matches(sets, 1);
+     }},
+    {"equal_2", 3,
+     [](IEngine &engine, SetPtrEnsemble const &sets) {
+       return engine.keep_if_precisely_n_matches(sets, 2);
+     }},
+    {"less_2", 3,
+     [](IEngine &engine, SetPtrEnsemble const &sets) {
+       return engine.keep_if_less_than_n_matches(sets, 2);
+     }},
+};
+
+/// A sorted set of unique values drawn from a domain twice its size, so the sets overlap by half.
+SetPtr randomSet(size_t size, std::mt19937_64 &random)
+{
+  std::uniform_int_distribution<DataType> uniform(0, DataType(size) * 2);
+  auto                                    set = std::make_shared<Set>();
+  set->reserve(size);
+  for (size_t i{0}; i < size; ++i)
+  {
+    set->push_back(uniform(random));
+  }
+  std::sort(set->begin(), set->end());
+  set->erase(std::unique(set->begin(), set->end()), set->end());
+  return set;
+}
+
+SetPtr expectedResult(Case const &test, SetPtrEnsemble const &sets)
+{
+  Arena       arena(true);
+  ArenaScope  scope(&arena);
+  Engine      oracle;
+  const auto  result = test.run(oracle, sets);
+  auto        sorted = std::make_shared<Set>(result->begin(), result->end());
+  std::sort(sorted->begin(), sorted->end());
+  return sorted;
+}
+
+/**
+ * @brief Runs the case until enough values went through, checking the first result.
+ * @return the best time per input value in nanoseconds, or a negative value on a mismatch
+ */
+double measure(Case const &test, SetPtrEnsemble const &sets, Set const &expected, size_t repeats)
+{
+  size_t input_size = 0;
+  for (const auto &set : sets)
+  {
+    input_size += set->size();
+  }
+  const size_t rounds = std::max<size_t>(1, VALUES_PER_MEASURE / std::max<size_t>(1, input_size));
+  double       best   = 1e300;
+  for (size_t r{0}; r < repeats; ++r)
+  {
+    SortedEngine engine;
+    Arena        arena(true);
+    ArenaScope   scope(&arena);
+    const auto   start = std::chrono::steady_clock::now();
+    for (size_t round{0}; round < rounds; ++round)
+    {
+      const auto result = test.run(engine, sets);
+      if (round == 0 && r == 0 &&
+          (result->size() != expected.size() ||
+           !std::equal(result->begin(), result->end(), expected.begin())))
+      {
+        return -1;
+      }
+    }
+    const auto end = std::chrono::steady_clock::now();
+    best           = std::min(best, std::chrono::duration<double, std::nano>(end - start).count() /
+                                        double(rounds * std::max<size_t>(1, input_size)));
+  }
+  return best;
+}
+
+}  // namespace
+
+int main(int argc, char **argv)
+{
+  const Options options    = parseOptions(argc, argv);
+  const auto    best_level = SortedKernels::supported();
+  bool          all_match  = true;
+  for (auto size : options.sizes)
+  {
+    std::mt19937_64 random(options.seed ^ size);
+    SetPtrEnsemble  sets;
+    for (size_t i{0}; i < 3; ++i)
+    {
+      sets.push_back(randomSet(size, random));
+    }
+    for (const auto &test : CASES)
+    {
+      const SetPtrEnsemble inputs(sets.begin(), sets.begin() + std::ptrdiff_t(test.inputs));
+      const auto           expected = expectedResult(test, inputs);
+      double               scalar   = 0;
+      for (int level{0}; level <= int(best_level); ++level)
+      {
+        SortedKernels::select(SortedKernels::Level(level));
+        const double nanoseconds = measure(test, inputs, *expected, options.repeats);
+        if (nanoseconds < 0)
+        {
+          std::cerr << "Mismatch: " << test.name << " of size " << size << " at level "
+                    << SortedKernels::name(SortedKernels::Level(level)) << '\n';
+          all_match = false;
+          continue;
+        }
+        scalar = level == 0 ? nanoseconds : scalar;
+        std::printf("{\"operation\":\"%s\",\"size\":%zu,\"kernels\":\"%s\",\"ns_per_value\":%.3f,"
+                    "\"speedup\":%.2f}\n",
+                    test.name, size, SortedKernels::name(SortedKernels::Level(level)),
+                    nanoseconds, scalar > 0 ? scalar / nanoseconds : 0.0);
+        std::fflush(stdout);
+      }
+    }
+  }
+  SortedKernels::select(best_level);
+  return all_match ? 0 : 1;
+}
@@ -0,0 +1,425 @@
+#include "engine.hpp"
+#include "ops.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * Benchmarks every set operation of every engine over reproducible synthetic datasets.
+ * Every case runs in a forked child process, so its peak RSS can be measured on its own (it
+ * includes the shared input sets); the results are printed as one JSON object per line.
+ */
+
+namespace {
+
+static constexpr uint64_t DEFAULT_SEED    = 20200101;
+static constexpr size_t   DEFAULT_INPUTS  = 3;
+static constexpr size_t   DEFAULT_REPEATS = 5;
+
+const std::vector<std::string> ENGINES{"hash", "sorted", "bitmap", "index"};
+const std::vector<std::string> DISTRIBUTIONS{"uniform", "dense", "skewed", "overlap",
+                                             "disjoint"};
+
+struct Options
+{
+  std::vector<size_t>      sizes{1000, 100000, 1000000};
+  std::vector<std::string> engines{ENGINES};
+  std::vector<std::string> distributions{DISTRIBUTIONS};
+  size_t                   inputs{DEFAULT_INPUTS};
+  size_t                   repeats{DEFAULT_REPEATS};
+  uint64_t                 seed{DEFAULT_SEED};
+  std::string              temp_dir{"/tmp"};
+  std::string              write_dir{};
+};
+
+struct Case
+{
+  OperationType type;
+  int           parameter;  // only for the parametrized operations
+};
+
+struct Measurement
+{
+  std::vector<double> milliseconds;
+  size_t              result_size{0};
+  long                peak_rss_kb{0};
+};
+
+std::vector<std::string> split(std::string const &list)
+{
+  std::vector<std::string> items;
+  std::stringstream        stream(list);
+  std::string              item;
+  while (std::getline(stream, item, ','))
+  {
+    items.push_back(item);
+  }
+  return items;
+}
+
+void printUsage()
+{
+  std::cout
+      << "Usage: scalc_bench [--sizes 1000,100000] [--engines hash,sorted,bitmap,index]\n"
+         "                   [--distributions uniform,dense,skewed,overlap,disjoint]\n"
+         "                   [--inputs N] [--repeat N] [--seed N] [--temp-dir DIR]\n"
+         "                   [--write-dir DIR]\n"
+         "Sizes up to 100000000 are supported, --write-dir saves the generated sets as text\n"
+         "files for running scalc over them.\n";
+}
+
+Options parseOptions(int argc, char **argv)
+{
+  Options options;
+  for (int i{1}; i < argc; ++i)
+  {
+    const std::string option(argv[i]);
+    if (option == "--help" || i + 1 >= argc)
+    {
+      printUsage();
+      std::exit(option == "--help" ? 0 : -1);
+    }
+    const std::string value(argv[++i]);
+    if (option == "--sizes")
+    {
+      options.sizes.clear();
+      for (auto const &size : split(value))
+      {
+        options.sizes.push_back(std::stoull(size));
+      }
+    }
+    else if (option == "--engines")
+    {
+      options.engines = split(value);
+    }
+    else if (option == "--distributions")
+    {
+      options.distributions = split(value);
+    }
+    else if (option == "--inputs")
+    {
+      options.inputs = std::stoul(value);
+    }
+    else if (option == "--repeat")
+    {
+      options.repeats = std::max<size_t>(1, std::stoul(value));
+    }
+    else if (option == "--seed")
+    {
+      options.seed = std::stoull(value);
+    }
+    else if (option == "--temp-dir")
+    {
+      options.temp_dir = value;
+    }
+    else if (option == "--write-dir")
+    {
+      options.write_dir = value;
+    }
+    else
+    {
+      printUsage();
+      std::exit(-1);
+    }
+  }
+  return options;
+}
+
+/**
+ * @brief Draws unique values until the set has the requested size, returns them sorted.
+ */
+template <typename Draw>
+Set drawUnique(size_t size, Draw draw)
+{
+  std::unordered_set<DataType> unique;
+  unique.reserve(size);
+  while (unique.size() < size)
+  {
+    unique.insert(draw());
+  }
+  Set set(unique.begin(), unique.end());
+  std::sort(set.begin(), set.end());
+  return set;
+}
+
+/**
+ * @brief Generates the input sets of a distribution, every set has the given size.
+ *  - uniform:  values spread uniformly over a domain 10 times wider than a set,
+ *  - dense:    contiguous ranges, every next one shifted by a quarter of the size,
+ *  - skewed:   log-uniform values, most of them crowd near zero like Zipf-distributed ids,
+ *  - overlap:  one uniform set with 10% of values replaced in every copy,
+ *  - disjoint: interleaved sets without any common value.
+ */
+SetPtrEnsemble generate(std::string const &distribution, size_t size, size_t inputs,
+                        uint64_t seed)
+{
+  std::mt19937_64 random(seed);
+  SetPtrEnsemble  sets;
+  const DataType  domain = DataType(size) * 10;
+
+  if (distribution == "overlap")
+  {
+    std::uniform_int_distribution<DataType> uniform(0, domain - 1);
+    const Set base = drawUnique(size, [&] { return uniform(random); });
+    for (size_t i{0}; i < inputs; ++i)
+    {
+      std::unordered_set<DataType> copy(base.begin(), base.end());
+      std::bernoulli_distribution  replace(0.1);
+      for (auto value : base)
+      {
+        if (replace(random))
+        {
+          copy.erase(value);
+        }
+      }
+      while (copy.size() < size)
+      {
+        copy.insert(uniform(random));
+      }
+      sets.push_back(std::make_shared<Set>(copy.begin(), copy.end()));
+      std::sort(sets.back()->begin(), sets.back()->end());
+    }
+    return sets;
+  }
+
+  for (size_t i{0}; i < inputs; ++i)
+  {
+    Set set;
+    if (distribution == "uniform")
+    {
+      std::uniform_int_distribution<DataType> uniform(0, domain - 1);
+      set = drawUnique(size, [&] { return uniform(random); });
+    }
+    else if (distribution == "dense")
+    {
+      set.resize(size);
+      for (size_t v{0}; v < size; ++v)
+      {
+        set[v] = DataType(i * size / 4 + v);
+      }
+    }
+    else if (distribution == "skewed")
+    {
+      std::uniform_real_distribution<double> exponent(0.0, std::log(double(domain)));
+      set = drawUnique(size, [&] { return DataType(std::exp(exponent(random))); });
+    }
+    else if (distribution == "disjoint")
+    {
+      set.resize(size);
+      for (size_t v{0}; v < size; ++v)
+      {
+        set[v] = DataType(v * inputs + i);
+      }
+    }
+    else
+    {
+      throw std::runtime_error("unknown distribution '" + distribution + "'");
+    }
+    sets.push_back(std::make_shared<Set>(std::move(set)));
+  }
+  return sets;
+}
+
+void writeSet(Set const &set, std::string const &filename)
+{
+  std::ofstream output(filename);
+  for (auto value : set)
+  {
+    output << value << '\n';
+  }
+  if (!output)
+  {
+    throw std::runtime_error("can not write '" + filename + "'");
+  }
+}
+
+std::vector<Case> allCases(size_t inputs)
+{
+  return {{OperationType::INTERSECTION, 0},
+          {OperationType::UNION, 0},
+          {OperationType::DIFFERENCE, 0},
+          {OperationType::KEEP_IF_PRECISELY_N_MATCHES, 2},
+          {OperationType::KEEP_IF_MORE_THAN_N_MATCHES, 1},
+          {OperationType::KEEP_IF_LESS_THAN_N_MATCHES, int(inputs)},
+          {OperationType::FILEREADER, 0}};
+}
+
+OpPtr buildCaseOperation(IEngine &engine, Case const &c, std::string const &filename)
+{
+  switch (c.type)
+  {
+  case OperationType::FILEREADER:
+    return buildOperation(engine, c.type, filename);
+  case OperationType::KEEP_IF_PRECISELY_N_MATCHES:
+  case OperationType::KEEP_IF_MORE_THAN_N_MATCHES:
+  case OperationType::KEEP_IF_LESS_THAN_N_MATCHES:
+    return buildOperation(engine, c.type, c.parameter);
+  default:
+    return buildOperation(engine, c.type);
+  }
+}
+
+/**
+ * @brief Runs the case in a child process and collects its timings through a pipe.
+ */
+Measurement measure(std::string const &engine_name, Case const &c, SetPtrEnsemble const &sets,
+                    std::string const &filename, size_t repeats)
+{
+  int channel[2];
+  if (::pipe(channel) != 0)
+  {
+    throw std::runtime_error("can not create a pipe");
+  }
+  const pid_t child = ::fork();
+  if (child < 0)
+  {
+    throw std::runtime_error("can not fork");
+  }
+  if (child == 0)
+  {
+    ::close(channel[0]);
+    std::vector<double> timings;
+    size_t              result_size = 0;
+    for (size_t r{0}; r < repeats; ++r)
+    {
+      // A new engine and operation every time, as they may cache the results or conversions.
+      auto engine = buildEngine(engine_name);
+      auto op     = buildCaseOperation(*engine, c, filename);
+      auto start = std::chrono::steady_clock::now();
+
+      auto result = op->execute(sets);
+      // The values are read by the output, so a result the engine keeps in another form is
+      // converted within the time.
+      engine->materialize(*result);
+
+      auto end    = std::chrono::steady_clock::now();
+      result_size = result->size();
+      timings.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    timings.push_back(double(result_size));
+    const ssize_t bytes = timings.size() * sizeof(double);
+    const bool    sent  = ::write(channel[1], timings.data(), size_t(bytes)) == bytes;
+    ::_exit(sent ? 0 : 1);
+  }
+
+  ::close(channel[1]);
+  std::vector<double> received(repeats + 1);
+  size_t              bytes_read = 0;
+  const size_t        expected   = received.size() * sizeof(double);
+  while (bytes_read < expected)
+  {
+    const ssize_t result = ::read(channel[0], reinterpret_cast<char *>(received.data()) + bytes_read,
+                                  expected - bytes_read);
+    if (result <= 0)
+    {
+      break;
+    }
+    bytes_read += size_t(result);
+  }
+  ::close(channel[0]);
+
+  int           status = 0;
+  struct rusage usage;
+  ::wait4(child, &status, 0, &usage);
+  if (bytes_read != expected || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+  {
+    throw std::runtime_error("benchmark case of " + engine_name + " " + OP_NAMES.at(c.type) +
+                             " failed");
+  }
+
+  Measurement measurement;
+  measurement.result_size = size_t(received.back());
+  received.pop_back();
+  measurement.milliseconds = received;
+  measurement.peak_rss_kb  = usage.ru_maxrss;
+  return measurement;
+}
+
+double percentile(std::vector<double> sorted, double fraction)
+{
+  const size_t rank = size_t(std::ceil(fraction * double(sorted.size())));
+  return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+void report(std::string const &engine, Case const &c, std::string const &distribution,
+            size_t size, size_t inputs, size_t input_elements, Measurement measurement)
+{
+  std::sort(measurement.milliseconds.begin(), measurement.milliseconds.end());
+  const double p50 = percentile(measurement.milliseconds, 0.5);
+  std::printf("{\"engine\":\"%s\",\"operation\":\"%s\",\"parameter\":%d,\"distribution\":\"%s\","
+              "\"size\":%zu,\"inputs\":%zu,\"input_elements\":%zu,\"result_size\":%zu,"
+              "\"repeats\":%zu,\"min_ms\":%.3f,\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,"
+              "\"max_ms\":%.3f,\"throughput_melem_s\":%.2f,\"peak_rss_kb\":%ld}\n",
+              engine.c_str(), OP_NAMES.at(c.type).c_str(), c.parameter, distribution.c_str(),
+              size, inputs, input_elements, measurement.result_size,
+              measurement.milliseconds.size(), measurement.milliseconds.front(), p50,
+              percentile(measurement.milliseconds, 0.9),
+              percentile(measurement.milliseconds, 0.99), measurement.milliseconds.back(),
+              p50 > 0 ? double(input_elements) / p50 / 1000.0 : 0.0, measurement.peak_rss_kb);
+  std::fflush(stdout);
+}
+
+}  // namespace
+
+int main(int argc, char **argv)
+{
+  const Options options = parseOptions(argc, argv);
+
+  try
+  {
+    for (auto const &distribution : options.distributions)
+    {
+      for (auto size : options.sizes)
+      {
+        const uint64_t seed = options.seed ^ (std::hash<std::string>()(distribution) + size);
+        const auto     sets = generate(distribution, size, options.inputs, seed);
+
+        const std::string prefix = distribution + "_" + std::to_string(size) + "_";
+        if (!options.write_dir.empty())
+        {
+          for (size_t i{0}; i < sets.size(); ++i)
+          {
+            writeSet(*sets[i], options.write_dir + "/" + prefix + std::to_string(i) + ".txt");
+          }
+        }
+        // The file reader case reads the first set back from a text file.
+        const std::string filename =
+            options.temp_dir + "/scalc_bench_" + std::to_string(::getpid()) + "_" + prefix + ".txt";
+        writeSet(*sets.front(), filename);
+
+        for (auto const &engine : options.engines)
+        {
+          for (auto const &c : allCases(options.inputs))
+          {
+            const size_t input_elements = c.type == OperationType::FILEREADER
+                                              ? sets.front()->size()
+                                              : size * options.inputs;
+            report(engine, c, distribution, size, options.inputs, input_elements,
+                   measure(engine, c, sets, filename, options.repeats));
+          }
+        }
+        std::remove(filename.c_str());
+      }
+    }
+  }
+  catch (std::exception &e)
+  {
+    std::cerr << "Error : " << e.what() << std::endl;
+    return -1;
+  }
+  return 0;
+}
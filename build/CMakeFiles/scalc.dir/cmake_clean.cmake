@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/scalc.dir/src/main.cpp.o"
+  "CMakeFiles/scalc.dir/src/main.cpp.o.d"
+  "scalc"
+  "scalc.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/scalc.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/scalc_bench.dir/bench/scalc_bench.cpp.o"
+  "CMakeFiles/scalc_bench.dir/bench/scalc_bench.cpp.o.d"
+  "scalc_bench"
+  "scalc_bench.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/scalc_bench.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
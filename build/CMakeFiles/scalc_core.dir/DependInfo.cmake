@@ -0,0 +1,45 @@
+
+# Consider dependencies only in project.
+set(CMAKE_DEPENDS_IN_PROJECT_ONLY OFF)
+
+# The set of languages for which implicit dependencies are needed:
+set(CMAKE_DEPENDS_LANGUAGES
+  )
+
+# The set of dependency files which are needed:
+set(CMAKE_DEPENDS_DEPENDENCY_FILES
+  "/root/repo/src/arena.cpp" "CMakeFiles/scalc_core.dir/src/arena.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/arena.cpp.o.d"
+  "/root/repo/src/bitmap_engine.cpp" "CMakeFiles/scalc_core.dir/src/bitmap_engine.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/bitmap_engine.cpp.o.d"
+  "/root/repo/src/engine.cpp" "CMakeFiles/scalc_core.dir/src/engine.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/engine.cpp.o.d"
+  "/root/repo/src/executor.cpp" "CMakeFiles/scalc_core.dir/src/executor.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/executor.cpp.o.d"
+  "/root/repo/src/expression.cpp" "CMakeFiles/scalc_core.dir/src/expression.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/expression.cpp.o.d"
+  "/root/repo/src/file_reader.cpp" "CMakeFiles/scalc_core.dir/src/file_reader.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/file_reader.cpp.o.d"
+  "/root/repo/src/fused_predicate.cpp" "CMakeFiles/scalc_core.dir/src/fused_predicate.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/fused_predicate.cpp.o.d"
+  "/root/repo/src/incremental_evaluator.cpp" "CMakeFiles/scalc_core.dir/src/incremental_evaluator.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/incremental_evaluator.cpp.o.d"
+  "/root/repo/src/index_engine.cpp" "CMakeFiles/scalc_core.dir/src/index_engine.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/index_engine.cpp.o.d"
+  "/root/repo/src/lexer.cpp" "CMakeFiles/scalc_core.dir/src/lexer.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/lexer.cpp.o.d"
+  "/root/repo/src/mapped_file.cpp" "CMakeFiles/scalc_core.dir/src/mapped_file.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/mapped_file.cpp.o.d"
+  "/root/repo/src/membership_index.cpp" "CMakeFiles/scalc_core.dir/src/membership_index.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/membership_index.cpp.o.d"
+  "/root/repo/src/node.cpp" "CMakeFiles/scalc_core.dir/src/node.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/node.cpp.o.d"
+  "/root/repo/src/ops.cpp" "CMakeFiles/scalc_core.dir/src/ops.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/ops.cpp.o.d"
+  "/root/repo/src/optimizer.cpp" "CMakeFiles/scalc_core.dir/src/optimizer.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/optimizer.cpp.o.d"
+  "/root/repo/src/output_writer.cpp" "CMakeFiles/scalc_core.dir/src/output_writer.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/output_writer.cpp.o.d"
+  "/root/repo/src/profiler.cpp" "CMakeFiles/scalc_core.dir/src/profiler.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/profiler.cpp.o.d"
+  "/root/repo/src/query.cpp" "CMakeFiles/scalc_core.dir/src/query.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/query.cpp.o.d"
+  "/root/repo/src/roaring_bitmap.cpp" "CMakeFiles/scalc_core.dir/src/roaring_bitmap.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/roaring_bitmap.cpp.o.d"
+  "/root/repo/src/server.cpp" "CMakeFiles/scalc_core.dir/src/server.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/server.cpp.o.d"
+  "/root/repo/src/set_cache.cpp" "CMakeFiles/scalc_core.dir/src/set_cache.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/set_cache.cpp.o.d"
+  "/root/repo/src/set_file.cpp" "CMakeFiles/scalc_core.dir/src/set_file.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/set_file.cpp.o.d"
+  "/root/repo/src/set_statistics.cpp" "CMakeFiles/scalc_core.dir/src/set_statistics.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/set_statistics.cpp.o.d"
+  "/root/repo/src/sorted_engine.cpp" "CMakeFiles/scalc_core.dir/src/sorted_engine.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/sorted_engine.cpp.o.d"
+  "/root/repo/src/sorted_kernels.cpp" "CMakeFiles/scalc_core.dir/src/sorted_kernels.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/sorted_kernels.cpp.o.d"
+  "/root/repo/src/thread_pool.cpp" "CMakeFiles/scalc_core.dir/src/thread_pool.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/thread_pool.cpp.o.d"
+  "/root/repo/src/value_stream.cpp" "CMakeFiles/scalc_core.dir/src/value_stream.cpp.o" "gcc" "CMakeFiles/scalc_core.dir/src/value_stream.cpp.o.d"
+  )
+
+# Targets to which this target links.
+set(CMAKE_TARGET_LINKED_INFO_FILES
+  )
+
+# Fortran module output directory.
+set(CMAKE_Fortran_TARGET_MODULE_DIR "")
@@ -0,0 +1,63 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/scalc_core.dir/src/arena.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/arena.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/bitmap_engine.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/bitmap_engine.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/engine.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/engine.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/executor.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/executor.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/expression.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/expression.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/file_reader.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/file_reader.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/fused_predicate.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/fused_predicate.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/incremental_evaluator.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/incremental_evaluator.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/index_engine.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/index_engine.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/lexer.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/lexer.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/mapped_file.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/mapped_file.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/membership_index.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/membership_index.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/node.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/node.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/ops.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/ops.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/optimizer.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/optimizer.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/output_writer.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/output_writer.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/profiler.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/profiler.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/query.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/query.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/roaring_bitmap.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/roaring_bitmap.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/server.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/server.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/set_cache.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/set_cache.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/set_file.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/set_file.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/set_statistics.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/set_statistics.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/sorted_engine.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/sorted_engine.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/sorted_kernels.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/sorted_kernels.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/thread_pool.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/thread_pool.cpp.o.d"
+  "CMakeFiles/scalc_core.dir/src/value_stream.cpp.o"
+  "CMakeFiles/scalc_core.dir/src/value_stream.cpp.o.d"
+  "libscalc_core.a"
+  "libscalc_core.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/scalc_core.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/scalc_hash_bench.dir/bench/hash_table_bench.cpp.o"
+  "CMakeFiles/scalc_hash_bench.dir/bench/hash_table_bench.cpp.o.d"
+  "scalc_hash_bench"
+  "scalc_hash_bench.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/scalc_hash_bench.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/scalc_kernel_bench.dir/bench/kernel_bench.cpp.o"
+  "CMakeFiles/scalc_kernel_bench.dir/bench/kernel_bench.cpp.o.d"
+  "scalc_kernel_bench"
+  "scalc_kernel_bench.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/scalc_kernel_bench.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/**
+ * A memory arena: a monotonic buffer carved out of large chunks, with free lists per size class
+ * so a released block is reused by the next allocation of a similar size. Blocks larger than
+ * LARGE_BLOCK_SIZE are passed through to the system allocator. All the chunks are released at
+ * once when the arena is destroyed, so an arena must outlive everything allocated from it.
+ *
+ * An arena created as shared may be used from several threads at once, the other arenas are
+ * meant for a single thread. A child arena adds its statistics to the parent when destroyed.
+ */
+class Arena
+{
+public:
+  struct Statistics
+  {
+    size_t allocations{0};         // blocks handed out by the arena
+    size_t reused{0};              // of them, taken from a free list
+    size_t system_allocations{0};  // chunks and large blocks requested from the system
+    size_t reserved_bytes{0};      // total size of the chunks
+  };
+
+  static constexpr size_t ALIGNMENT        = 16;
+  static constexpr size_t SMALL_BLOCK_SIZE = 256;      // up to this size classes are 16 bytes apart
+  static constexpr size_t LARGE_BLOCK_SIZE = 1 << 20;  // up to this size classes are powers of 2
+  static constexpr size_t FIRST_CHUNK_SIZE = 64 << 10;
+  static constexpr size_t MAX_CHUNK_SIZE   = 16 << 20;
+
+  explicit Arena(bool shared = false, Arena *parent = nullptr);
+  ~Arena();
+
+  Arena(Arena const &) = delete;
+  Arena &operator=(Arena const &) = delete;
+
+  void *allocate(size_t bytes);
+  void  deallocate(void *block, size_t bytes);
+
+  Statistics statistics() const;
+
+  // The bytes the calling thread was handed out by all the arenas since it started.
+  static size_t allocatedByThread();
+
+  // The arena of the evaluation running on the calling thread, nullptr if there is none.
+  static Arena *current();
+
+private:
+  friend class ArenaScope;
+
+  static constexpr size_t SIZE_CLASSES = 28;  // 16 small classes and 12 powers of 2
+
+  struct FreeBlock
+  {
+    FreeBlock *next;
+  };
+
+  static size_t classOf(size_t bytes);
+  static size_t classSize(size_t size_class);
+
+  std::unique_lock<std::mutex> lockIfShared() const;
+  void *                       carve(size_t bytes);
+
+  const bool          shared_;
+  Arena *const        parent_;
+  mutable std::mutex  mutex_;
+  std::vector<void *> chunks_;
+  char *              cursor_{nullptr};
+  char *              chunk_end_{nullptr};
+  size_t              next_chunk_size_{FIRST_CHUNK_SIZE};
+  FreeBlock *         free_lists_[SIZE_CLASSES] = {};
+  Statistics          statistics_;
+};
+
+/**
+ * Makes an arena current on the calling thread for the lifetime of the scope.
+ */
+class ArenaScope
+{
+public:
+  explicit ArenaScope(Arena *arena);
+  ~ArenaScope();
+
+  ArenaScope(ArenaScope const &) = delete;
+  ArenaScope &operator=(ArenaScope const &) = delete;
+
+private:
+  Arena *previous_;
+};
+
+/**
+ * A standard allocator drawing from an arena, or from the heap when constructed without one.
+ * A copy of a container always goes to the heap, so a result copied out of an evaluation stays
+ * valid after its arena is gone; moves and swaps carry the arena along with the storage.
+ */
+template <typename T>
+class ArenaAllocator
+{
+public:
+  using value_type                             = T;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap            = std::true_type;
+
+  template <typename U>
+  struct rebind
+  {
+    using other = ArenaAllocator<U>;
+  };
+
+  ArenaAllocator() noexcept = default;
+  explicit ArenaAllocator(Arena *arena) noexcept
+    : arena_(arena)
+  {}
+  template <typename U>
+  ArenaAllocator(ArenaAllocator<U> const &other) noexcept
+    : arena_(other.arena())
+  {}
+
+  T *allocate(size_t count)
+  {
+    const size_t bytes = count * sizeof(T);
+    return static_cast<T *>(arena_ != nullptr ? arena_->allocate(bytes) : ::operator new(bytes));
+  }
+
+  void deallocate(T *block, size_t count) noexcept
+  {
+    if (arena_ != nullptr)
+    {
+      arena_->deallocate(block, count * sizeof(T));
+    }
+    else
+    {
+      ::operator delete(block);
+    }
+  }
+
+  ArenaAllocator select_on_container_copy_construction() const
+  {
+    return ArenaAllocator();
+  }
+
+  Arena *arena() const
+  {
+    return arena_;
+  }
+
+private:
+  Arena *arena_{nullptr};
+};
+
+template <typename T, typename U>
+bool operator==(ArenaAllocator<T> const &lhs, ArenaAllocator<U> const &rhs)
+{
+  return lhs.arena() == rhs.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(ArenaAllocator<T> const &lhs, ArenaAllocator<U> const &rhs)
+{
+  return !(lhs == rhs);
+}
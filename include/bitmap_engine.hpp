@@ -0,0 +1,64 @@
+#pragma once
+
+#include "roaring_bitmap.hpp"
+#include "sorted_engine.hpp"
+
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * An engine which computes every operation over compressed bitmaps of its inputs. Occurrences
+ * are counted a whole 64-bit word at a time with bit-sliced counters, INT and SUM are plain
+ * AND and OR loops over the words, a fused tree is combined term by term.
+ *
+ * The files read and the results computed are passed between the nodes as bitmaps only: their
+ * sets stay empty until materialize() converts the bitmap into the sorted values, which happens
+ * for the outputs of the evaluation. The sets which came from elsewhere are converted into
+ * bitmaps once and keep their values. An intersection of sets of very different sizes probes
+ * the larger ones for the values of the smallest instead.
+ */
+class BitmapEngine : public SortedEngine
+{
+public:
+  SetPtr keep_if_less_than_n_matches(const SetPtrEnsemble &sets, int n) override;
+  SetPtr keep_if_precisely_n_matches(const SetPtrEnsemble &sets, int n) override;
+  SetPtr keep_if_greater_than_n_matches(const SetPtrEnsemble &sets, int n) override;
+
+  SetPtr sets_intersection(const SetPtrEnsemble &sets) override;
+  SetPtr sets_difference(const SetPtrEnsemble &sets) override;
+  SetPtr sets_union(const SetPtrEnsemble &sets) override;
+
+  SetPtr query_matches_if(const SetPtrEnsemble &sets, MatchCondition condition,
+                          Query const &query) override;
+  SetPtr keep_if_fused(const SetPtrEnsemble &sets, FusedPredicate const &predicate) override;
+
+  SetPtr read_file(const std::string filename) override;
+
+  void   materialize(Set &set) override;
+  size_t size_of(Set const &set) const override;
+  size_t memory_of(Set const &set) const override;
+
+private:
+  using BitmapPtr = std::shared_ptr<const RoaringBitmap>;
+
+  struct CachedBitmap
+  {
+    std::weak_ptr<Set> set;
+    BitmapPtr          bitmap;
+    bool               only;  // the set is empty, the values are in the bitmap only
+  };
+
+  std::vector<BitmapPtr> bitmaps_of(const SetPtrEnsemble &sets);
+  BitmapPtr              bitmap_of(SetPtr const &set);
+  // The entry of the set, with no bitmap if the set has none yet. The set may be materialized
+  // concurrently, so whether it holds its values is only told by the entry.
+  CachedBitmap cached(Set const &set) const;
+  // An empty set standing for the values of the bitmap.
+  SetPtr make_set_of(BitmapPtr bitmap);
+  void   remember(SetPtr const &set, BitmapPtr const &bitmap, bool only);
+  // The values of the smallest set which are in all the others.
+  SetPtr intersect_by_probing(const SetPtrEnsemble &sets);
+
+  mutable std::mutex                            cache_mutex_;
+  std::unordered_map<Set const *, CachedBitmap> cache_;
+};
@@ -1,8 +1,15 @@
 #pragma once
 
+#include "file_reader.hpp"
+#include "flat_hash_table.hpp"
 #include "ops.hpp"
+#include "set_statistics.hpp"
 #include "types.hpp"
 
+#include <atomic>
+
+class ThreadPool;
+
 class IEngine
 {
 public:
@@ -16,7 +23,32 @@ public:
   virtual SetPtr sets_difference(const SetPtrEnsemble &sets)   = 0;
   virtual SetPtr sets_union(const SetPtrEnsemble &sets)        = 0;
 
+  // Answers the query over the values a counting operation would keep, without building them
+  // into a set; stops reading the inputs as soon as the answer is known.
+  virtual SetPtr query_matches_if(const SetPtrEnsemble &sets, MatchCondition condition,
+                                  Query const &query) = 0;
+  // Keeps the values of the sets whose membership in them the predicate accepts, the sets being
+  // the leaves of the predicate in order.
+  virtual SetPtr keep_if_fused(const SetPtrEnsemble &sets, FusedPredicate const &predicate) = 0;
+
   virtual SetPtr read_file(const std::string filename) = 0;
+
+  // True if every Set produced by the engine is sorted in ascending order.
+  virtual bool   sorted_output() const = 0;
+  virtual size_t total_processed()     = 0;
+
+  // With a thread pool set, operations over large inputs are split into independent shards.
+  virtual void set_thread_pool(ThreadPool *pool) = 0;
+  // With a thread pool set, a file of at least two chunks of this size is parsed concurrently in
+  // newline-aligned chunks.
+  virtual void set_read_chunk_size(size_t bytes) = 0;
+
+  // An engine may pass its results between the nodes in a representation of its own and leave
+  // their sets empty until materialize() puts the values into them. Whoever reads the values of
+  // a set the engine produced materializes it first; its size and memory are told by the engine.
+  virtual void   materialize(Set &set);
+  virtual size_t size_of(Set const &set) const;
+  virtual size_t memory_of(Set const &set) const;
 };
 
 class Engine : public IEngine
@@ -30,20 +62,52 @@ public:
   SetPtr sets_difference(const SetPtrEnsemble &sets) override;
   SetPtr sets_union(const SetPtrEnsemble &sets) override;
 
+  SetPtr query_matches_if(const SetPtrEnsemble &sets, MatchCondition condition,
+                          Query const &query) override;
+  SetPtr keep_if_fused(const SetPtrEnsemble &sets, FusedPredicate const &predicate) override;
+
   SetPtr read_file(const std::string filename) override;
 
-  size_t total_processed();
+  bool   sorted_output() const override;
+  size_t total_processed() override;
+
+  void set_thread_pool(ThreadPool *pool) override;
+  void set_read_chunk_size(size_t bytes) override;
 
 private:
-  MatchMap count_matches(const SetPtrEnsemble &sets);
-  SetPtr   keep_matches_if(MatchMap &&matches, std::function<bool(size_t)> condition);
+  SetPtr   count_and_keep_if(const SetPtrEnsemble &sets, MatchCondition condition);
+  SetPtr   count_and_keep_if_partitioned(const SetPtrEnsemble &sets, MatchCondition condition,
+                                         size_t distinct_values, size_t expected_size);
+  MatchMap count_matches(const SetPtrEnsemble &sets, size_t distinct_values);
+  SetPtr   keep_matches_if(MatchMap &&matches, MatchCondition condition, SetPtr result,
+                           size_t expected_size);
+  // The statistics of the inputs; collected now for the sets which came from elsewhere.
+  std::vector<StatisticsPtr> statistics_of(const SetPtrEnsemble &sets);
 
-  size_t total_processed_{0};
+  std::atomic<size_t>     total_processed_{0};
+  ThreadPool *            thread_pool_{nullptr};
+  FileReader::ReadOptions read_options_;
+  StatisticsCache         statistics_;
 };
 
+/// A fabric to produce an engine by its command line name ("hash", "sorted", "bitmap" or
+/// "index").
+std::unique_ptr<IEngine> buildEngine(std::string const &name);
+
 namespace Helpers {
 
-void printVectorToCout(const std::vector<DataType> &vec);
+void printVectorToCout(Set const &vec);
+// An empty set with its storage in the arena, or on the heap if the arena is nullptr.
+SetPtr makeEvaluationSet(Arena *arena);
+// True if the set is an intermediate result of the running evaluation held by nobody but the
+// caller, so an operation may overwrite it. An ensemble passed to an operation by the graph
+// is the only owner of the inputs which have no other consumers.
+bool isReusable(SetPtr const &set);
+// An empty set for the result of an operation over the sets, which are not read any more: the
+// storage of the largest reusable input is taken over, otherwise a new set is made.
+SetPtr reuseInputOrMake(SetPtrEnsemble const &sets);
+// Replaces a set shared with other owners by a private copy, so it can be modified in place.
+void makeExclusive(SetPtr &set);
 void printVectorInLine(Set const &set);
 
 }  // namespace Helpers
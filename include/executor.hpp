@@ -0,0 +1,23 @@
+#pragma once
+
+#include "node.hpp"
+#include "thread_pool.hpp"
+
+/**
+ * Evaluates the graph under a node on a thread pool. Every node is scheduled as soon as all of
+ * its inputs are computed, so independent subtrees and file reads run concurrently; the result
+ * does not depend on the number of threads.
+ */
+class ParallelExecutor
+{
+public:
+  explicit ParallelExecutor(ThreadPool &pool);
+
+  SetPtr evaluate(std::shared_ptr<Node> const &root);
+  // Evaluates several roots of one graph together, every shared node once; the results are in
+  // the order of the roots.
+  std::vector<SetPtr> evaluate(std::vector<std::shared_ptr<Node>> const &roots);
+
+private:
+  ThreadPool &pool_;
+};
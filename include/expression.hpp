@@ -8,6 +8,8 @@
 #include <vector>
 
 class IEngine;
+class SetCache;
+class ThreadPool;
 
 class Expression
 {
@@ -17,13 +19,30 @@ public:
   explicit Expression(IEngine& engine);
   void buildFromUserInput(std::string const &input);
   void buildFromTokens(std::vector<Token> const &tokens);
+  // Builds several expressions into one graph with an output node per expression, so the files
+  // and the subexpressions they have in common are read and computed once for all of them.
+  void buildFromUserInputs(std::vector<std::string> const &inputs);
 
   template <OperationType op_type, typename... Params>
   Node::NodeWeakPtr addNode(std::string const &node_name, std::vector<std::string> const &inputs,
                             Params... params);
 
+  // Returns the result without copying it. The handle keeps the storage of the result alive;
+  // it is the only owner of the set unless the set is shared with a cache of files.
+  SetPtr evaluateShared(std::string const &node_name);
+  SetPtr evaluateShared();
+  // Returns a copy of the result.
   Set evaluate(std::string const &node_name);
   Set evaluate();
+  // Evaluates all the output nodes together, in the order of outputNodeNames(). The results
+  // share the storage of one evaluation, which lives on as long as any of them.
+  std::vector<SetPtr> evaluateAllShared();
+  // Evaluates the expression as a pipeline of k-way merges over file streams, taking memory
+  // proportional to the number of inputs rather than their size. The values come out sorted.
+  ValueStreamPtr stream(StreamOptions const &options);
+  // Evaluates the expression against the state kept in the directory by its previous
+  // evaluations, so only the changes of the files since then are computed. Sorted as well.
+  SetPtr evaluateIncremental(std::string const &state_dir);
 
   bool        insertNode(std::string const &node_name, NodePtrType node_ptr);
   NodePtrType getNode(std::string const &node_name);
@@ -31,6 +50,21 @@ public:
 
   std::string outputNodeName() const;
   void        setOutputNodeName(const std::string &outputNodeName);
+  // One per expression built, the same node for identical expressions.
+  std::vector<std::string> const &outputNodeNames() const;
+
+  // With a thread pool set, independent nodes are evaluated concurrently on it.
+  void setThreadPool(ThreadPool *pool);
+  // With a set cache given, files are read through it and shared with other expressions.
+  void setSetCache(SetCache *set_cache);
+
+  // The graph is rewritten by the Optimizer when compiled, unless disabled.
+  void setOptimization(bool enabled);
+  // With fusion enabled, every tree of nested counting operations is compiled into a single
+  // FUSED operation over its leaves, which evaluates the whole tree in one pass.
+  void setFusion(bool enabled);
+  // With an output given, the plans before and after the optimization are printed into it.
+  void setPlanOutput(std::ostream *output);
 
 protected:
   std::map<std::string, NodePtrType>                            nodes_;
@@ -38,12 +72,27 @@ protected:
 
 private:
   OpPtr buildOperationFromToken(Token const &token);
+  // Adds the nodes of one expression to the graph and returns the name of its output node.
+  std::string parseTokens(std::vector<Token> const &tokens);
+  std::vector<SetPtr> evaluateShared(std::vector<NodePtrType> const &roots);
 
   void compile();
   void linkNodesInGraph(std::string const &node_name, std::vector<std::string> const &inputs);
+  void eliminateCommonSubexpressions();
+  void pushDownQuery();
+  void fuseCountingOperations();
+  void countConsumers();
+  void resetCaches();
 
   IEngine& engine_;
-  std::string output_node_name_{};
+  ThreadPool *thread_pool_{nullptr};
+  SetCache *set_cache_{nullptr};
+  bool optimization_enabled_{true};
+  bool fusion_enabled_{false};
+  std::ostream *plan_output_{nullptr};
+  std::vector<std::string> output_node_names_{};
+  // Node names are numbered across all the expressions built into the graph.
+  size_t node_counter_{0};
   bool is_compiled_{false};
 
   Logger &log_{Logger::instance()};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+namespace FileReader {
+
+static constexpr size_t DEFAULT_CHUNK_BYTES = size_t(64) << 20;
+
+struct ReadOptions
+{
+  // Without a thread pool the file is parsed on the calling thread.
+  ThreadPool *pool{nullptr};
+  // A file of at least two chunks is split into newline-aligned chunks of about this size,
+  // parsed concurrently.
+  size_t chunk_bytes{DEFAULT_CHUNK_BYTES};
+};
+
+/**
+ * @brief Reads a file of newline separated decimal integers. The file is memory-mapped and
+ * parsed in place; blank lines and whitespace around the numbers are ignored.
+ * @param filename
+ * @param arena the values are allocated from, or nullptr for the heap.
+ * @return all the values in the order of the file, duplicates included.
+ * @throws std::runtime_error if the file can not be opened or contains a malformed line.
+ */
+Set readIntegers(std::string const &filename, Arena *arena = nullptr,
+                 ReadOptions const &options = ReadOptions());
+
+/**
+ * @brief Reads the file like readIntegers() but leaves the values of every chunk in a set of
+ * its own, so they can be processed further in parallel. The arena must be a shared one.
+ * @return the chunks in the order of the file, a single one for a small file or without a pool.
+ */
+std::vector<Set> readIntegerChunks(std::string const &filename, Arena *arena,
+                                   ReadOptions const &options);
+
+/**
+ * @brief Parses newline separated decimal integers from a memory buffer, appending them to output.
+ * @param source_name and first_line_number are used in the error messages only.
+ */
+void parseIntegers(const char *begin, const char *end, Set &output,
+                   std::string const &source_name, size_t first_line_number = 1);
+
+}  // namespace FileReader
@@ -0,0 +1,319 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace FlatHash {
+
+static constexpr size_t GROUP_SIZE = 16;
+static constexpr int8_t EMPTY      = -128;  // a full slot keeps 7 bits of the hash, 0..127
+
+/// Multiplicative hashing folded, so both the high and the low bits depend on the whole key.
+inline uint64_t mix(uint64_t key)
+{
+  const uint64_t hash = key * 0x9E3779B97F4A7C15ULL;
+  return hash ^ (hash >> 32);
+}
+
+/// Every table hashes with a seed of its own.
+inline uint64_t nextSeed()
+{
+  static std::atomic<uint64_t> tables{0};
+  return mix(++tables);
+}
+
+/// A bit for every control byte of the group equal to the given one.
+inline uint32_t matchGroup(const int8_t *group, int8_t control)
+{
+#ifdef __SSE2__
+  const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+  return uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(control))));
+#else
+  uint32_t mask = 0;
+  for (size_t i{0}; i < GROUP_SIZE; ++i)
+  {
+    mask |= group[i] == control ? uint32_t(1) << i : 0;
+  }
+  return mask;
+#endif
+}
+
+}  // namespace FlatHash
+
+/**
+ * An open-addressing hash table of int64 keys in the manner of Swiss tables. The slots are split
+ * into groups of 16, every slot has a control byte which is either EMPTY or 7 bits of the key's
+ * hash. A lookup compares the control bytes of a whole group at once with SSE2 and only reads
+ * the keys whose bytes match; the groups are probed linearly until one with an empty slot.
+ * Keys, control bytes and (for WITH_COUNTS) counts of the Count type are kept in flat parallel
+ * arrays.
+ * There is no erase, so no tombstones either. The storage is drawn from an arena, if given.
+ *
+ * Tables are seeded differently: with a shared hash function, the keys of one table iterated
+ * into another one would arrive in the order of their slots and pile up in long probe runs.
+ */
+template <bool WITH_COUNTS, typename Count = uint32_t>
+class FlatHashTable
+{
+public:
+  static constexpr size_t MAX_LOAD_NUMERATOR   = 7;
+  static constexpr size_t MAX_LOAD_DENOMINATOR = 8;
+
+  explicit FlatHashTable(Arena *arena = nullptr)
+    : controls_(ArenaAllocator<int8_t>(arena))
+    , keys_(ArenaAllocator<DataType>(arena))
+    , counts_(ArenaAllocator<Count>(arena))
+    , seed_(FlatHash::nextSeed())
+  {}
+
+  void reserve(size_t count)
+  {
+    if (count > max_size_)
+    {
+      rehash(capacityFor(count));
+    }
+  }
+
+  size_t size() const
+  {
+    return size_;
+  }
+
+  bool contains(DataType key) const
+  {
+    if (size_ == 0)
+    {
+      return false;
+    }
+    const uint64_t hash    = hashOf(key);
+    const int8_t   control = int8_t(hash & 0x7F);
+    for (size_t group = (hash >> 7) & group_mask_;; group = (group + 1) & group_mask_)
+    {
+      const int8_t *controls = &controls_[group * FlatHash::GROUP_SIZE];
+      for (uint32_t match = FlatHash::matchGroup(controls, control); match != 0;
+           match &= match - 1)
+      {
+        if (keys_[group * FlatHash::GROUP_SIZE + size_t(__builtin_ctz(match))] == key)
+        {
+          return true;
+        }
+      }
+      if (FlatHash::matchGroup(controls, FlatHash::EMPTY) != 0)
+      {
+        return false;
+      }
+    }
+  }
+
+protected:
+  /// Returns the slot of the key, inserting it with a zero count if it is not there yet.
+  size_t findOrInsert(DataType key, bool &inserted)
+  {
+    if (size_ + 1 > max_size_)
+    {
+      rehash(capacityFor(size_ + 1));
+    }
+    const uint64_t hash    = hashOf(key);
+    const int8_t   control = int8_t(hash & 0x7F);
+    for (size_t group = (hash >> 7) & group_mask_;; group = (group + 1) & group_mask_)
+    {
+      int8_t *controls = &controls_[group * FlatHash::GROUP_SIZE];
+      for (uint32_t match = FlatHash::matchGroup(controls, control); match != 0;
+           match &= match - 1)
+      {
+        const size_t slot = group * FlatHash::GROUP_SIZE + size_t(__builtin_ctz(match));
+        if (keys_[slot] == key)
+        {
+          inserted = false;
+          return slot;
+        }
+      }
+      const uint32_t empty = FlatHash::matchGroup(controls, FlatHash::EMPTY);
+      if (empty != 0)
+      {
+        const size_t slot = group * FlatHash::GROUP_SIZE + size_t(__builtin_ctz(empty));
+        controls_[slot]   = control;
+        keys_[slot]       = key;
+        if (WITH_COUNTS)
+        {
+          counts_[slot] = 0;
+        }
+        ++size_;
+        inserted = true;
+        return slot;
+      }
+    }
+  }
+
+  /// Calls visit(slot) for every full slot.
+  template <typename Visit>
+  void forEachSlot(Visit visit) const
+  {
+    for (size_t first{0}; first < controls_.size(); first += FlatHash::GROUP_SIZE)
+    {
+      uint32_t full = ~FlatHash::matchGroup(&controls_[first], FlatHash::EMPTY) & 0xFFFF;
+      for (; full != 0; full &= full - 1)
+      {
+        visit(first + size_t(__builtin_ctz(full)));
+      }
+    }
+  }
+
+  std::vector<int8_t, ArenaAllocator<int8_t>>     controls_;
+  std::vector<DataType, ArenaAllocator<DataType>> keys_;
+  std::vector<Count, ArenaAllocator<Count>>       counts_;  // empty unless WITH_COUNTS
+
+private:
+  uint64_t hashOf(DataType key) const
+  {
+    return FlatHash::mix(FlatHash::mix(uint64_t(key)) ^ seed_);
+  }
+
+  static size_t capacityFor(size_t count)
+  {
+    size_t capacity = FlatHash::GROUP_SIZE;
+    while (capacity / MAX_LOAD_DENOMINATOR * MAX_LOAD_NUMERATOR < count)
+    {
+      capacity *= 2;
+    }
+    return capacity;
+  }
+
+  void rehash(size_t capacity)
+  {
+    auto old_controls = std::move(controls_);
+    auto old_keys     = std::move(keys_);
+    auto old_counts   = std::move(counts_);
+    controls_ = decltype(controls_)(capacity, FlatHash::EMPTY, old_controls.get_allocator());
+    keys_     = decltype(keys_)(capacity, DataType(0), old_keys.get_allocator());
+    if (WITH_COUNTS)
+    {
+      counts_ = decltype(counts_)(capacity, Count(0), old_counts.get_allocator());
+    }
+    group_mask_ = capacity / FlatHash::GROUP_SIZE - 1;
+    max_size_   = capacity / MAX_LOAD_DENOMINATOR * MAX_LOAD_NUMERATOR;
+
+    // The keys are known to be unique, so every one goes to the first empty slot of its probe.
+    for (size_t slot{0}; slot < old_controls.size(); ++slot)
+    {
+      if (old_controls[slot] == FlatHash::EMPTY)
+      {
+        continue;
+      }
+      const DataType key = old_keys[slot];
+      for (size_t group = (hashOf(key) >> 7) & group_mask_;;
+           group = (group + 1) & group_mask_)
+      {
+        const uint32_t empty =
+            FlatHash::matchGroup(&controls_[group * FlatHash::GROUP_SIZE], FlatHash::EMPTY);
+        if (empty != 0)
+        {
+          const size_t new_slot = group * FlatHash::GROUP_SIZE + size_t(__builtin_ctz(empty));
+          controls_[new_slot]   = old_controls[slot];
+          keys_[new_slot]       = key;
+          if (WITH_COUNTS)
+          {
+            counts_[new_slot] = old_counts[slot];
+          }
+          break;
+        }
+      }
+    }
+  }
+
+  uint64_t seed_;
+  size_t   size_{0};
+  size_t   max_size_{0};
+  size_t   group_mask_{0};
+};
+
+/// A set of int64 values.
+class FlatHashSet : public FlatHashTable<false>
+{
+public:
+  using FlatHashTable<false>::FlatHashTable;
+
+  /// @return true if the value was not in the set yet
+  bool insert(DataType value)
+  {
+    bool inserted;
+    findOrInsert(value, inserted);
+    return inserted;
+  }
+
+  /// Calls visit(value) for every value, in no particular order.
+  template <typename Visit>
+  void forEach(Visit visit) const
+  {
+    forEachSlot([&](size_t slot) { visit(keys_[slot]); });
+  }
+};
+
+/// Counts of occurrences of int64 values.
+class FlatCountMap : public FlatHashTable<true>
+{
+public:
+  using FlatHashTable<true>::FlatHashTable;
+
+  /// @return the count of the value after the increment
+  size_t increment(DataType value)
+  {
+    bool inserted;
+    return ++counts_[findOrInsert(value, inserted)];
+  }
+
+  /// Calls visit(value, count) for every value, in no particular order.
+  template <typename Visit>
+  void forEach(Visit visit) const
+  {
+    forEachSlot([&](size_t slot) { visit(keys_[slot], size_t(counts_[slot])); });
+  }
+};
+
+using MatchMap = FlatCountMap;
+
+/// Numbers int64 values in the order they are first added.
+class FlatPositionMap : public FlatHashTable<true, uint32_t>
+{
+public:
+  using FlatHashTable<true, uint32_t>::FlatHashTable;
+
+  /// @return the number of the value, the count of the values before it if it is new
+  size_t positionOf(DataType value)
+  {
+    bool         inserted;
+    const size_t slot = findOrInsert(value, inserted);
+    if (inserted)
+    {
+      counts_[slot] = uint32_t(size() - 1);
+    }
+    return counts_[slot];
+  }
+};
+
+/// A bitmask of the sets holding each of int64 values, for at most 64 sets.
+class FlatMaskMap : public FlatHashTable<true, uint64_t>
+{
+public:
+  using FlatHashTable<true, uint64_t>::FlatHashTable;
+
+  void mark(DataType value, uint64_t bits)
+  {
+    bool inserted;
+    counts_[findOrInsert(value, inserted)] |= bits;
+  }
+
+  /// Calls visit(value, mask) for every value, in no particular order.
+  template <typename Visit>
+  void forEach(Visit visit) const
+  {
+    forEachSlot([&](size_t slot) { visit(keys_[slot], counts_[slot]); });
+  }
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "query.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * The condition of a tree of nested counting operations on the membership of a value in the
+ * leaves of the tree: bit i of a leaf mask tells the value is in leaf i. Every operation of the
+ * tree is a term, which counts the leaves and the inner terms holding the value and keeps it by
+ * its MatchCondition; a term counts nothing for a value none of its inputs holds, like the
+ * operation it comes from. The last term is the root of the tree.
+ *
+ * Trees of up to TABULATED_LEAVES leaves are tabulated for every leaf mask at construction,
+ * so a value is accepted by a single bit lookup; larger ones are evaluated term by term.
+ */
+class FusedPredicate
+{
+public:
+  static constexpr size_t MAX_LEAVES       = 64;
+  static constexpr size_t MAX_TERMS        = 64;
+  static constexpr size_t TABULATED_LEAVES = 16;
+
+  struct Term
+  {
+    MatchCondition      condition;
+    std::vector<size_t> leaves;  // the leaves read, a leaf read twice is listed twice
+    std::vector<size_t> terms;   // the earlier terms read
+  };
+
+  FusedPredicate(size_t leaves_count, std::vector<Term> const &terms);
+
+  bool accepts(uint64_t leaves) const
+  {
+    if (!table_.empty())
+    {
+      return (table_[size_t(leaves >> 6)] >> (leaves & 63)) & 1;
+    }
+    return evaluate(leaves);
+  }
+
+  size_t leavesCount() const;
+  std::vector<Term> const &terms() const;
+  // The tree in the expression syntax with the leaves numbered, e.g. "[ GR 1 #0 [ EQ 2 #1 #2 ] ]".
+  std::string description() const;
+
+private:
+  // The leaves and terms read by a term: a leaf read k times is in the first k layers.
+  struct CompiledTerm
+  {
+    MatchCondition        condition;
+    std::vector<uint64_t> leaf_layers;
+    std::vector<uint64_t> term_layers;
+  };
+
+  bool        evaluate(uint64_t leaves) const;
+  std::string describe(size_t term) const;
+
+  size_t                    leaves_count_;
+  std::vector<Term>         terms_;
+  std::vector<CompiledTerm> compiled_;
+  std::vector<uint64_t>     table_;  // a bit per leaf mask, empty for too many leaves
+};
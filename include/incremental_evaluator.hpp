@@ -0,0 +1,67 @@
+#pragma once
+
+#include "node.hpp"
+#include "types.hpp"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class OpFileReader;
+
+/**
+ * Evaluates an expression against the state kept in a directory by its previous evaluations, so
+ * a small change of the files costs time proportional to the change. The state of a plan lives
+ * in a subdirectory named after the plan:
+ *  - for every file, the sorted values it held and the modification time and size it had;
+ *  - for every counting operation, the number of its inputs holding each of the values.
+ * A file whose time and size are unchanged is not read. A changed one is read and compared with
+ * its old values; the added and removed values are propagated up the graph, every counting
+ * operation updates the counts of those values only and passes on the values which entered or
+ * left its result. An operation none of whose inputs changed is not touched at all.
+ *
+ * The new state is written aside and renamed over the old one when the evaluation succeeds; a
+ * state which was not completed is evaluated from scratch.
+ */
+class IncrementalEvaluator
+{
+public:
+  IncrementalEvaluator(std::string const &state_dir, Node const &root);
+
+  // The result of the root as of now, sorted.
+  SetPtr evaluate();
+
+  size_t changedFiles() const;
+  // The number of values added to or removed from the files since the last evaluation.
+  size_t changedValues() const;
+
+private:
+  // The values which entered and left the result of a node, both sorted.
+  struct Delta
+  {
+    Set added;
+    Set removed;
+  };
+
+  Delta const &      delta_of(Node const &node);
+  Delta              file_delta(OpFileReader const &reader, std::string const &key);
+  Delta              counting_delta(Node const &node, MatchCondition condition,
+                                    std::string const &key);
+  SetPtr             result_of(Node const &node);
+  std::string const &key_of(Node const &node);
+  std::string        path_of(std::string const &key, std::string const &extension) const;
+  // The file is written with a suffix and renamed over the old one by commit().
+  std::string stage(std::string const &path);
+  void        commit();
+
+  Node const &root_;
+  std::string directory_;
+  bool        fresh_{false};
+
+  std::unordered_map<Node const *, std::string> keys_;
+  // Identical subtrees share their state, so the deltas are kept by the key of the subtree.
+  std::unordered_map<std::string, Delta> deltas_;
+  std::vector<std::string>               staged_;
+  size_t                                 changed_files_{0};
+  size_t                                 changed_values_{0};
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "engine.hpp"
+#include "membership_index.hpp"
+
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * An engine which indexes the membership of every distinct value in every set it reads once, in
+ * a MembershipIndex, and computes every operation over the membership columns of the inputs:
+ * occurrences are counted 64 values a word at a time with bit-sliced counters, INT and SUM are
+ * plain AND and OR loops, a fused tree is evaluated term by term over the words. No value is
+ * hashed or compared after it was indexed, whatever the number of the sets.
+ *
+ * The sets passed between nodes are vectors in the order the values were first seen, their
+ * columns are cached while the sets are alive. The index only grows, by every new distinct value
+ * read, for the lifetime of the engine.
+ */
+class IndexEngine : public IEngine
+{
+public:
+  SetPtr keep_if_less_than_n_matches(const SetPtrEnsemble &sets, int n) override;
+  SetPtr keep_if_precisely_n_matches(const SetPtrEnsemble &sets, int n) override;
+  SetPtr keep_if_greater_than_n_matches(const SetPtrEnsemble &sets, int n) override;
+
+  SetPtr sets_intersection(const SetPtrEnsemble &sets) override;
+  SetPtr sets_difference(const SetPtrEnsemble &sets) override;
+  SetPtr sets_union(const SetPtrEnsemble &sets) override;
+
+  SetPtr query_matches_if(const SetPtrEnsemble &sets, MatchCondition condition,
+                          Query const &query) override;
+  SetPtr keep_if_fused(const SetPtrEnsemble &sets, FusedPredicate const &predicate) override;
+
+  SetPtr read_file(const std::string filename) override;
+
+  bool   sorted_output() const override;
+  size_t total_processed() override;
+
+  void set_thread_pool(ThreadPool *pool) override;
+  void set_read_chunk_size(size_t bytes) override;
+
+private:
+  using Column    = MembershipIndex::Column;
+  using ColumnPtr = MembershipIndex::ColumnPtr;
+
+  struct CachedColumn
+  {
+    std::weak_ptr<Set> set;
+    ColumnPtr          column;
+  };
+
+  ColumnPtr count_and_keep_if(std::vector<ColumnPtr> const &columns, MatchCondition condition);
+  std::vector<ColumnPtr> columns_of(const SetPtrEnsemble &sets);
+  // The column of a set the engine did not produce is indexed as a new source.
+  ColumnPtr column_of(SetPtr const &set);
+  void      remember(SetPtr const &set, ColumnPtr const &column);
+  // Computes the words of the column by ranges, split over the thread pool for large columns.
+  template <typename ComputeRange>
+  void compute_words(Column &column, ComputeRange compute_range);
+  // The result set of the inputs, which are not read any more, holding the rows of the column.
+  SetPtr materialize(const SetPtrEnsemble &sets, ColumnPtr const &column);
+
+  MembershipIndex                               index_;
+  std::mutex                                    cache_mutex_;
+  std::unordered_map<Set const *, CachedColumn> cache_;
+  std::atomic<size_t>                           total_processed_{0};
+  ThreadPool *                                  thread_pool_{nullptr};
+  FileReader::ReadOptions                       read_options_;
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+
+/// A read-only private mapping of a whole file, unmapped on destruction.
+class MappedFile
+{
+public:
+  // Hints the kernel the mapping is going to be read sequentially.
+  explicit MappedFile(std::string const &filename);
+  ~MappedFile();
+
+  MappedFile(MappedFile const &) = delete;
+  MappedFile &operator=(MappedFile const &) = delete;
+
+  const char *begin() const
+  {
+    return data_;
+  }
+
+  const char *end() const
+  {
+    return data_ + size_;
+  }
+
+  size_t size() const
+  {
+    return size_;
+  }
+
+private:
+  const char *data_{nullptr};
+  size_t      size_{0};
+};
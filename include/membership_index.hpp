@@ -0,0 +1,47 @@
+#pragma once
+
+#include "flat_hash_table.hpp"
+#include "types.hpp"
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * A value × source membership index. Every distinct value of the indexed sets gets a row, in the
+ * order the values are first seen, and every indexed set, a source, gets a column: a bitset over
+ * the rows telling which values the set holds. A value is hashed once, when the first source
+ * holding it is added; any set computed from the sources is a column as well, so an operation
+ * over columns combines 64 rows per word and never hashes a value again.
+ *
+ * Rows are only ever appended, so the columns stay valid as sources are added. Adding a source
+ * and reading values may run concurrently.
+ */
+class MembershipIndex
+{
+public:
+  using Column    = std::vector<uint64_t>;
+  using ColumnPtr = std::shared_ptr<const Column>;
+
+  static constexpr size_t ROWS_PER_WORD = 64;
+
+  MembershipIndex();
+
+  // Indexes the values of the set as a new source, duplicates included once.
+  ColumnPtr addSource(Set const &set);
+  // Appends the values of the rows set in the column to the output, in the order of rows.
+  void valuesOf(Column const &column, Set &output) const;
+
+  size_t rows() const;
+  size_t sources() const;
+
+private:
+  // The values are kept in blocks which never move, so they are read without a lock.
+  static constexpr size_t BLOCK_BITS = 16;
+  static constexpr size_t BLOCK_ROWS = size_t(1) << BLOCK_BITS;
+
+  mutable std::mutex                       mutex_;
+  FlatPositionMap                          rows_;
+  std::vector<std::unique_ptr<DataType[]>> blocks_;
+  size_t                                   sources_{0};
+};
@@ -14,14 +14,32 @@ public:
 
   SetPtrEnsemble gatherInputs() const;
   SetPtr evaluate();
+  SetPtr execute(SetPtrEnsemble const &inputs) const;
+  // Opens the subgraph under this node as a pipeline of streams. A node with several consumers
+  // is streamed once per consumer.
+  ValueStreamPtr stream(StreamOptions const &options) const;
 
   void addInput(NodeWeakPtr const &i);
+  void setInputs(std::vector<NodeWeakPtr> const &inputs);
 
-  std::string const &         name() const;
-  OperationType               operationType() const;
+  void addConsumer();
+  void resetConsumers();
+  void resetCache();
+
+  std::string const &             name() const;
+  Operation const &               operation() const;
+  OperationType                   operationType() const;
+  std::string                     signature() const;
+  std::vector<NodeWeakPtr> const &inputs() const;
 
 private:
   std::vector<NodeWeakPtr> input_nodes_;
   OpPtr       op_ptr_;
   std::string name_;
+
+  // A node read by several consumers keeps its result until the last of them reads it,
+  // so it is computed only once per evaluation.
+  size_t consumers_{0};
+  size_t pending_reads_{0};
+  SetPtr cached_result_{nullptr};
 };
@@ -1,13 +1,18 @@
 #pragma once
 
+#include "fused_predicate.hpp"
+#include "query.hpp"
 #include "types.hpp"
+#include "value_stream.hpp"
 
 #include <functional>
+#include <limits>
 #include <map>
 #include <memory>
 #include <vector>
 
 class IEngine;
+class SetCache;
 
 enum class OperationType
 {
@@ -18,10 +23,12 @@ enum class OperationType
   KEEP_IF_PRECISELY_N_MATCHES,
   KEEP_IF_MORE_THAN_N_MATCHES,
   KEEP_IF_LESS_THAN_N_MATCHES,
+  FUSED,
 
   FILEREADER,
   INTEGER,
   CONST_VECTOR,
+  QUERY,
   INVALID,
   TOTAL_OP_TYPES
 };
@@ -38,12 +45,40 @@ public:
   virtual ~Operation() = default;
 
   virtual std::shared_ptr<Set> execute(SetPtrEnsemble const &inputs) = 0;
+  // Computes the operation as a pipeline over the input streams, without materialising sets.
+  virtual ValueStreamPtr stream(ValueStreams &&inputs, StreamOptions const &options) const;
 
   virtual OperationType type() const
   {
     return type_;
   }
   virtual std::string description() const;
+  // Identifies the operation together with its parameters: equal signatures over equal inputs
+  // always produce equal results.
+  virtual std::string signature() const;
+  // The integer parameter of the operation, if it has one.
+  virtual int parameter() const
+  {
+    return 0;
+  }
+  // The condition on the number of inputs holding a value under which a counting operation
+  // keeps the value; false for the other operations.
+  virtual bool matchCondition(size_t inputs_count, MatchCondition &condition) const;
+  // An upper bound of the result size known before the evaluation, for the leaves only.
+  virtual size_t estimatedSize() const
+  {
+    return std::numeric_limits<size_t>::max();
+  }
+  // Tells the next execution returns a result kept from a previous one, used for profiling.
+  virtual bool hasCachedResult() const
+  {
+    return false;
+  }
+
+  IEngine &engine() const
+  {
+    return engine_;
+  }
 
 protected:
   OperationType type_ = OperationType::INVALID;
@@ -57,6 +92,8 @@ class OpDifference : public Operation
 public:
   explicit OpDifference(IEngine &engine);
   SetPtr execute(const SetPtrEnsemble &inputs) override;
+  ValueStreamPtr stream(ValueStreams &&inputs, StreamOptions const &options) const override;
+  bool matchCondition(size_t inputs_count, MatchCondition &condition) const override;
 };
 
 class OpIntersection : public Operation
@@ -64,6 +101,8 @@ class OpIntersection : public Operation
 public:
   explicit OpIntersection(IEngine &engine);
   SetPtr execute(const SetPtrEnsemble &inputs) override;
+  ValueStreamPtr stream(ValueStreams &&inputs, StreamOptions const &options) const override;
+  bool matchCondition(size_t inputs_count, MatchCondition &condition) const override;
 };
 
 class OpUnion : public Operation
@@ -71,17 +110,30 @@ class OpUnion : public Operation
 public:
   explicit OpUnion(IEngine &engine);
   SetPtr execute(const SetPtrEnsemble &inputs) override;
+  ValueStreamPtr stream(ValueStreams &&inputs, StreamOptions const &options) const override;
+  bool matchCondition(size_t inputs_count, MatchCondition &condition) const override;
 };
 
 class OpFileReader : public Operation
 {
 public:
-  explicit OpFileReader(IEngine &engine, std::string const &filename);
+  // With a cache given, the set is shared with the other readers of the same unchanged file.
+  // Otherwise the set is read on every execution and handed over to the consumer, which may
+  // reuse its storage.
+  explicit OpFileReader(IEngine &engine, std::string const &filename,
+                        SetCache *set_cache = nullptr);
   ~OpFileReader() override = default;
   SetPtr execute(const SetPtrEnsemble &) override;
+  ValueStreamPtr stream(ValueStreams &&inputs, StreamOptions const &options) const override;
+  std::string signature() const override;
+  bool        hasCachedResult() const override;
+  size_t      estimatedSize() const override;
+
+  std::string const &filename() const;
 
 private:
   std::string filename_;
+  SetCache *  set_cache_{nullptr};
   SetPtr      cache_{nullptr};
 };
 
@@ -91,6 +143,9 @@ public:
   explicit OpHardcoded(IEngine &engine, Set const &data);
   ~OpHardcoded() override = default;
   SetPtr execute(const SetPtrEnsemble &inputs) override;
+  ValueStreamPtr stream(ValueStreams &&inputs, StreamOptions const &options) const override;
+  std::string signature() const override;
+  size_t      estimatedSize() const override;
 
 private:
   Set data_;
@@ -101,6 +156,10 @@ class OpKeepIfMoreThanNMatches : public Operation
 public:
   explicit OpKeepIfMoreThanNMatches(IEngine &engine, int parameter);
   SetPtr execute(const SetPtrEnsemble &inputs) override;
+  ValueStreamPtr stream(ValueStreams &&inputs, StreamOptions const &options) const override;
+  std::string signature() const override;
+  int         parameter() const override;
+  bool        matchCondition(size_t inputs_count, MatchCondition &condition) const override;
 
 private:
   int parameter_;
@@ -111,6 +170,10 @@ class OpKeepIfLessThanNMatches : public Operation
 public:
   explicit OpKeepIfLessThanNMatches(IEngine &engine, int parameter);
   SetPtr execute(const SetPtrEnsemble &inputs) override;
+  ValueStreamPtr stream(ValueStreams &&inputs, StreamOptions const &options) const override;
+  std::string signature() const override;
+  int         parameter() const override;
+  bool        matchCondition(size_t inputs_count, MatchCondition &condition) const override;
 
 private:
   int parameter_;
@@ -121,14 +184,62 @@ class OpKeepIfPreciselyNMatches : public Operation
 public:
   explicit OpKeepIfPreciselyNMatches(IEngine &engine, int parameter);
   SetPtr execute(const SetPtrEnsemble &inputs) override;
+  ValueStreamPtr stream(ValueStreams &&inputs, StreamOptions const &options) const override;
+  std::string signature() const override;
+  int         parameter() const override;
+  bool        matchCondition(size_t inputs_count, MatchCondition &condition) const override;
 
 private:
   int parameter_;
 };
 
+/**
+ * Answers a query about the result of its single input. When the input is a counting operation,
+ * the query is pushed down into it: the operation is taken over and the engine answers the query
+ * over the values it would keep, without building them into a set.
+ */
+class OpQuery : public Operation
+{
+public:
+  explicit OpQuery(IEngine &engine, Query const &query);
+  SetPtr      execute(const SetPtrEnsemble &inputs) override;
+  std::string signature() const override;
+
+  Query const &query() const;
+  // The condition of the counting operation taken over, false if the query was not pushed down.
+  bool pushedDownCondition(MatchCondition &condition) const;
+  // Takes over the counting operation which produced the input, its inputs become the own ones.
+  void pushDown(Operation const &operation, size_t inputs_count);
+
+private:
+  Query          query_;
+  bool           pushed_down_{false};
+  MatchCondition condition_{MatchCondition::Kind::GREATER, 0};
+  std::string    pushed_down_signature_;
+};
+
+/**
+ * Evaluates a whole tree of nested counting operations in a single pass over the leaves of the
+ * tree, its inputs: the membership of every value in the leaves is collected as a bitmask and
+ * the FusedPredicate decides whether the value is kept, so none of the inner results is built.
+ */
+class OpFused : public Operation
+{
+public:
+  explicit OpFused(IEngine &engine, FusedPredicate const &predicate);
+  SetPtr      execute(const SetPtrEnsemble &inputs) override;
+  std::string signature() const override;
+
+private:
+  FusedPredicate predicate_;
+};
+
 /// A family of standalone fabrics to produce a necessary Operation depending on itsy type and
 /// arguments.
 OpPtr buildOperation(IEngine &engine, OperationType type);
-OpPtr buildOperation(IEngine &engine, OperationType type, const std::string &filename);
+OpPtr buildOperation(IEngine &engine, OperationType type, const std::string &filename,
+                     SetCache *set_cache = nullptr);
 OpPtr buildOperation(IEngine &engine, OperationType type, Set const &data);
 OpPtr buildOperation(IEngine &engine, OperationType type, int parameter);
+OpPtr buildOperation(IEngine &engine, OperationType type, Query const &query);
+OpPtr buildOperation(IEngine &engine, OperationType type, FusedPredicate const &predicate);
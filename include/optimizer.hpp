@@ -0,0 +1,50 @@
+#pragma once
+
+#include "node.hpp"
+
+#include <iostream>
+#include <map>
+#include <unordered_map>
+
+class IEngine;
+
+/**
+ * Rewrites an expression graph into an equivalent one which takes less work to evaluate:
+ *  - EQ, GR and LE with a parameter turning them into INT, SUM or DIF are replaced by those,
+ *    and the ones which can not produce anything are replaced by an empty set;
+ *  - empty inputs are dropped from SUM, DIF and counting operations, and empty out INT;
+ *  - nested SUM and INT read by a single consumer are flattened into their parents;
+ *  - repeated inputs of SUM and INT are dropped, operations of a single input are skipped;
+ *  - the inputs of INT are ordered by their estimated size, the smallest first.
+ * The nodes which are no longer used are removed from the graph.
+ */
+class Optimizer
+{
+public:
+  using NodePtr = std::shared_ptr<Node>;
+
+  Optimizer(IEngine &engine, std::map<std::string, NodePtr> &nodes);
+
+  // Rewrites the graph under the output node and returns the name of its replacement.
+  std::string optimize(std::string const &output_node_name);
+  // Rewrites the graph under all the output nodes at once, so the nodes they share stay shared.
+  std::vector<std::string> optimize(std::vector<std::string> const &output_node_names);
+
+  // Prints the graph under the node as an indented tree with the estimated sizes.
+  static void printPlan(Node const &root, std::ostream &output);
+
+private:
+  NodePtr rewrite(NodePtr const &node);
+  NodePtr emptyNode();
+  NodePtr makeNode(OpPtr const &operation, std::vector<NodePtr> const &inputs);
+  void    countParents(NodePtr const &node, std::unordered_map<Node const *, size_t> &visits);
+  void    removeUnreachable(std::vector<NodePtr> const &roots);
+
+  IEngine &                                 engine_;
+  std::map<std::string, NodePtr> &          nodes_;
+  std::unordered_map<Node const *, NodePtr> rewritten_;
+  std::unordered_map<Node const *, size_t>  parents_;
+  std::unordered_map<Node const *, size_t>  estimates_;
+  NodePtr                                   empty_node_;
+  size_t                                    rewrites_{0};
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <string>
+
+/**
+ * Writes values one per line through a large reusable buffer, which is handed to write(2) in
+ * big chunks. The values are formatted two digits at a time from a lookup table.
+ */
+class OutputWriter
+{
+public:
+  // Writes to an already open descriptor, e.g. STDOUT_FILENO, without taking its ownership.
+  explicit OutputWriter(int fd);
+  // Creates or truncates the file.
+  explicit OutputWriter(std::string const &filename);
+  ~OutputWriter();
+
+  OutputWriter(OutputWriter const &) = delete;
+  OutputWriter &operator=(OutputWriter const &) = delete;
+
+  void writeValue(DataType value);
+  void writeText(std::string const &text);
+  // Writes all the values in ascending order, sorting them in place unless already sorted.
+  void writeSorted(Set &values, bool already_sorted);
+  void flush();
+
+private:
+  std::string name_;
+  int         fd_{-1};
+  bool        owns_fd_{false};
+  std::string buffer_;
+  size_t      used_{0};
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Node;
+
+/**
+ * Collects a profile of every node execution while enabled: wall and CPU time, input and
+ * output cardinalities, bytes the executing thread took from the arenas and whether the result
+ * came from a cache. The profile is reported as an annotated expression tree and as a Chrome
+ * trace-event file, viewable in chrome://tracing or Perfetto.
+ */
+class Profiler
+{
+public:
+  struct Record
+  {
+    Node const *        node{nullptr};
+    std::string         name;
+    std::string         operation;
+    uint32_t            thread{0};
+    int64_t             start_us{0};
+    int64_t             wall_us{0};
+    int64_t             cpu_us{0};
+    std::vector<size_t> input_sizes;
+    size_t              output_size{0};
+    size_t              bytes_allocated{0};
+    bool                cache_hit{false};
+  };
+
+  static Profiler &instance()
+  {
+    static Profiler instance{};
+    return instance;
+  }
+
+  inline bool enabled() const
+  {
+    return enabled_;
+  }
+
+  inline void setEnabled(bool enabled)
+  {
+    enabled_ = enabled;
+  }
+
+  // Starts a record of the node's execution on the calling thread.
+  Record begin(Node const &node, std::vector<size_t> input_sizes, bool cache_hit) const;
+  void   end(Record &&record, size_t output_size);
+
+  void printTree(Node const &root, std::ostream &output) const;
+  void writeChromeTrace(std::string const &filename) const;
+
+private:
+  Profiler() = default;
+
+  void printSubtree(Node const &node, size_t depth, std::vector<Node const *> &printed,
+                    std::ostream &output) const;
+
+  bool                enabled_{false};
+  mutable std::mutex  mutex_;
+  std::vector<Record> records_;
+};
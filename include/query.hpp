@@ -0,0 +1,88 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <string>
+#include <vector>
+
+/**
+ * The rule of a counting operation: a value is kept if the number of input sets holding it is
+ * less than, equal to or greater than n. INT over m sets is EQUAL m, DIF is EQUAL 1 and SUM is
+ * GREATER 0.
+ */
+struct MatchCondition
+{
+  enum class Kind
+  {
+    LESS,
+    EQUAL,
+    GREATER
+  };
+
+  bool accepts(size_t matches) const;
+  // False if no value found in at most max_matches sets can satisfy the condition.
+  bool satisfiable(size_t max_matches) const;
+  // The smallest number of matches the condition may accept.
+  size_t minMatches() const;
+
+  Kind   kind;
+  size_t n;
+};
+
+/**
+ * A question about the result of an expression which is answered without building the result:
+ * the number of values, the smallest or the largest ones, or whether there is any value at all.
+ */
+struct Query
+{
+  enum class Kind
+  {
+    COUNT,
+    MIN,
+    MAX,
+    TOP,
+    BOTTOM,
+    EXISTS
+  };
+
+  std::string description() const;
+
+  Kind   kind;
+  size_t k;  // the number of values selected by TOP and BOTTOM
+};
+
+/**
+ * Collects the answer to a query from values passed one by one. TOP and BOTTOM keep a heap of
+ * at most k values, so a selection costs O(n log k) and no more than k values are ever stored.
+ * The answer is a set as well: the count, 1 or 0 for EXISTS, the selected values in ascending
+ * order for the others.
+ */
+class QueryAccumulator
+{
+public:
+  // With ascending values MIN, BOTTOM and EXISTS are answered as soon as enough values came.
+  QueryAccumulator(Query const &query, bool ascending);
+
+  // @return false once no further value can change the answer
+  bool add(DataType value);
+  // Accounts for values which are not passed one by one, for COUNT and EXISTS only.
+  void addCount(size_t count);
+  // Takes over the answer collected from another part of the values.
+  void absorb(QueryAccumulator const &part);
+
+  // True if the query depends on the number of values only, not on the values themselves.
+  bool countsOnly() const;
+  bool done() const;
+
+  // The answer as a set allocated from the current arena.
+  SetPtr result() const;
+
+private:
+  Query                 query_;
+  bool                  ascending_;
+  size_t                count_{0};
+  std::vector<DataType> selected_;  // a heap, the value to be replaced first on the top
+};
+
+// Answers the query over an already built set, the values are sorted if ascending is set.
+SetPtr answerQuery(Set const &set, Query const &query, bool ascending);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/**
+ * A compressed bitmap of 64-bit values in the manner of Roaring bitmaps. The values are split
+ * into chunks of 2^16 by their high bits, every non-empty chunk is stored in the cheapest of
+ * three containers:
+ *  - an array of sorted low 16-bit parts for sparse chunks,
+ *  - a bitset of 1024 words for dense chunks,
+ *  - a list of runs for chunks made of a few consecutive ranges.
+ */
+class RoaringBitmap
+{
+public:
+  static constexpr size_t CHUNK_BITS     = 16;
+  static constexpr size_t BITSET_WORDS   = (size_t(1) << CHUNK_BITS) / 64;
+  static constexpr size_t MAX_ARRAY_SIZE = 4096;  // An array this long takes as much as a bitset
+
+  struct Container
+  {
+    enum class Kind
+    {
+      ARRAY,
+      BITSET,
+      RUN
+    };
+
+    // Sets the bits of the container in a bitset of BITSET_WORDS words.
+    void addTo(uint64_t *words) const;
+
+    Kind                  kind{Kind::ARRAY};
+    uint32_t              cardinality{0};
+    std::vector<uint16_t> values;  // ARRAY: sorted values, RUN: pairs of (start, length - 1)
+    std::vector<uint64_t> words;   // BITSET only
+  };
+
+  static RoaringBitmap fromSorted(Set const &values);
+  // Picks the cheapest container for the chunk, the inputs are sorted low parts or a bitset.
+  static Container makeContainer(std::vector<uint16_t> &&values);
+  static Container makeContainer(const uint64_t *words);
+
+  void   append(DataType key, Container &&container);
+  void   appendTo(Set &output) const;
+  bool   contains(DataType value) const;
+  // Calls visit(value) for the values in ascending order until it returns false.
+  void   forEach(std::function<bool(DataType)> const &visit) const;
+  size_t cardinality() const;
+  size_t memoryUsage() const;
+
+  std::vector<DataType> const & keys() const;
+  std::vector<Container> const &containers() const;
+
+private:
+  std::vector<DataType>  keys_;
+  std::vector<Container> containers_;
+};
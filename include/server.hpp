@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+
+class IEngine;
+class OutputWriter;
+class SetCache;
+class ThreadPool;
+
+/**
+ * Answers newline-delimited expressions with one engine and a set cache kept across queries.
+ * Every expression gets a response of either
+ *   OK <size>      followed by <size> lines with the values in ascending order, or
+ *   ERROR <reason> on a single line.
+ * Blank lines are ignored.
+ */
+class Server
+{
+public:
+  Server(IEngine &engine, SetCache &set_cache, ThreadPool *thread_pool);
+
+  // Answers the expressions of the input one by one until its end.
+  void serveStream(int input_fd, int output_fd);
+
+  // Listens on a Unix domain socket forever, serving every client on a thread of its own, so
+  // the expressions of different clients are evaluated concurrently.
+  void serveSocket(std::string const &path);
+
+private:
+  void answer(std::string const &expression, OutputWriter &writer);
+
+  IEngine &   engine_;
+  SetCache &  set_cache_;
+  ThreadPool *thread_pool_;
+};
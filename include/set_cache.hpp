@@ -0,0 +1,60 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * A size-bounded cache of the sets read from files, shared by concurrent queries. An entry is
+ * valid as long as the modification time and size of its file do not change; the least recently
+ * used entries are evicted once the sets take more than the capacity. An evicted set stays alive
+ * until the queries which use it complete.
+ */
+class SetCache
+{
+public:
+  using Loader = std::function<SetPtr()>;
+  // The memory a loaded set takes, its capacity by default.
+  using Sizer = std::function<size_t(Set const &)>;
+
+  explicit SetCache(size_t capacity_bytes, Sizer memory_of = nullptr);
+
+  SetCache(SetCache const &) = delete;
+  SetCache &operator=(SetCache const &) = delete;
+
+  /**
+   * @brief Returns the cached set of the file or loads it with the loader and caches it.
+   * @throws std::runtime_error if the file can not be stat'ed, or whatever the loader throws.
+   */
+  SetPtr get(std::string const &filename, Loader const &loader);
+
+  size_t hits() const;
+  size_t misses() const;
+  size_t usedBytes() const;
+
+private:
+  struct Entry
+  {
+    std::string filename;
+    int64_t     mtime_ns{0};
+    int64_t     file_size{0};
+    SetPtr      set;
+    size_t      bytes{0};
+  };
+  using EntryList = std::list<Entry>;
+
+  void evictOverCapacity();
+
+  const size_t                                          capacity_bytes_;
+  const Sizer                                           memory_of_;
+  mutable std::mutex                                    mutex_;
+  EntryList                                             entries_;  // the most recent first
+  std::unordered_map<std::string, EntryList::iterator> index_;
+  size_t                                                used_bytes_{0};
+  size_t                                                hits_{0};
+  size_t                                                misses_{0};
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "mapped_file.hpp"
+#include "types.hpp"
+
+#include <cstdint>
+#include <string>
+
+/**
+ * A compact binary format of a set, loaded without any text parsing:
+ *  - a 56-byte little-endian header: the "SCALCSET" magic, format version, flags, value count,
+ *    minimum, maximum, payload size and payload checksum;
+ *  - the payload: the sorted unique values as varint-encoded deltas, starting from the minimum.
+ * Dense sets take about a byte per value.
+ */
+namespace SetFile {
+
+// Files with this extension are written in the binary format.
+extern const std::string EXTENSION;
+
+bool hasExtension(std::string const &filename);
+
+/**
+ * @brief Tells whether the file has the extension of the format or starts with its magic bytes.
+ */
+bool isSetFile(std::string const &filename);
+
+/**
+ * Decodes a memory-mapped binary set file value by value. The header and the checksum of the
+ * payload are checked when the file is opened, the order and the count of the values as they
+ * are read, so a corrupted file is never taken for a shorter set.
+ */
+class Reader
+{
+public:
+  // @throws std::runtime_error if the file can not be opened, is truncated or corrupted.
+  explicit Reader(std::string const &filename);
+
+  size_t count() const;
+  size_t fileSize() const;
+  // Returns false after the last value. @throws std::runtime_error on a corrupted value.
+  bool next(DataType &value);
+
+private:
+  [[noreturn]] void throwCorrupted(std::string const &reason) const;
+
+  std::string filename_;
+  MappedFile  file_;
+  const char *cursor_;
+  uint64_t    count_{0};
+  uint64_t    read_{0};
+  DataType    max_{0};
+  uint64_t    value_{0};
+};
+
+/**
+ * @brief Loads a set from a memory-mapped binary set file.
+ * @return the values in ascending order, without duplicates.
+ * @throws std::runtime_error if the file can not be opened, is truncated or corrupted.
+ */
+Set read(std::string const &filename);
+
+/**
+ * @brief Reads the value count from the header of a binary set file, without the payload.
+ * @throws std::runtime_error if the file can not be opened or has no set file header.
+ */
+size_t count(std::string const &filename);
+
+/**
+ * @brief Creates or truncates the file and writes the values into it, sorting them in place
+ * unless already sorted. The values must be unique.
+ */
+void write(std::string const &filename, Set &values, bool already_sorted);
+
+}  // namespace SetFile
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "query.hpp"
+#include "types.hpp"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * A HyperLogLog sketch of the distinct values of a set: 4096 registers keep the longest run of
+ * leading zero bits among the hashes falling into each of them. The estimate is within about
+ * 1.6% of the exact count, and the sketch of a union is the register-wise maximum of the sketches.
+ */
+class HyperLogLog
+{
+public:
+  static constexpr unsigned PRECISION = 12;
+  static constexpr size_t   REGISTERS = size_t(1) << PRECISION;
+
+  HyperLogLog();
+
+  void   add(uint64_t hash);
+  void   merge(HyperLogLog const &other);
+  size_t estimate() const;
+
+private:
+  std::array<uint8_t, REGISTERS> registers_;
+};
+
+/**
+ * What is known about a set without reading it: the size, the value range and a sketch of the
+ * distinct values, and a coordinated sample: the values with the smallest hashes, below a
+ * threshold. Values are hashed the same way for all sets, so the samples of several sets show
+ * how they overlap: every value of the union whose hash is below the thresholds of all the sets
+ * is in the sample of every set holding it.
+ *
+ * The statistics of an input are collected exactly when it is read. The statistics of a result
+ * are estimated from the statistics of the inputs of the operation, before it runs, so the
+ * operation can size its tables and output from them.
+ */
+struct SetStatistics;
+using StatisticsPtr = std::shared_ptr<const SetStatistics>;
+
+struct SetStatistics
+{
+  static constexpr size_t SAMPLE_SIZE = 256;
+
+  // The hash the samples and sketches are built on, the same for all the sets.
+  static uint64_t hashOf(DataType value);
+
+  static SetStatistics collect(Set const &set);
+  // The statistics of the values kept by a counting operation over sets with the given ones.
+  static SetStatistics estimate(std::vector<StatisticsPtr> const &inputs,
+                                MatchCondition                    condition);
+
+  // The share of the value range taken by the values, 1 for consecutive values.
+  double density() const;
+  // True if no value can be in all the inputs: one is empty or their value ranges do not meet.
+  static bool disjoint(std::vector<StatisticsPtr> const &inputs);
+  // The distinct values of all the inputs of an operation, estimated by the merged sketches.
+  static size_t distinctValues(std::vector<StatisticsPtr> const &inputs);
+
+  size_t                size{0};
+  DataType              min{0};
+  DataType              max{0};
+  bool                  exact{true};
+  std::vector<DataType> sample;  // in the ascending order of hashes
+  uint64_t              sample_threshold{UINT64_MAX};  // every value hashed up to it is sampled
+  HyperLogLog           sketch;  // of the values of the inputs, for an estimated result
+};
+
+/**
+ * The statistics of the sets alive, kept by set identity: a set taken over by another result
+ * gets the statistics of that result, the entries of the destroyed sets are dropped.
+ */
+class StatisticsCache
+{
+public:
+  // The statistics of the set, collected now if nobody remembered them.
+  StatisticsPtr of(SetPtr const &set);
+  void remember(SetPtr const &set, SetStatistics statistics);
+
+private:
+  struct Entry
+  {
+    std::weak_ptr<Set> set;
+    StatisticsPtr      statistics;
+  };
+
+  std::mutex                             mutex_;
+  std::unordered_map<Set const *, Entry> entries_;
+};
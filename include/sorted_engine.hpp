@@ -0,0 +1,47 @@
+#pragma once
+
+#include "engine.hpp"
+
+/**
+ * An engine which keeps every set as a sorted vector of unique values.
+ * All the operations are merges of the input sets by the vectorized SortedKernels: the
+ * occurrences of a value are counted from the runs of the merged array, so no intermediate match
+ * map is built and every produced set is sorted as well. Queries are answered by a k-way heap
+ * merge, which can stop early. With a thread pool set, large merges are split into
+ * value intervals merged concurrently. An intersection narrows down the smallest set instead,
+ * probing much larger sets by galloping.
+ */
+class SortedEngine : public IEngine
+{
+public:
+  SetPtr keep_if_less_than_n_matches(const SetPtrEnsemble &sets, int n) override;
+  SetPtr keep_if_precisely_n_matches(const SetPtrEnsemble &sets, int n) override;
+  SetPtr keep_if_greater_than_n_matches(const SetPtrEnsemble &sets, int n) override;
+
+  SetPtr sets_intersection(const SetPtrEnsemble &sets) override;
+  SetPtr sets_difference(const SetPtrEnsemble &sets) override;
+  SetPtr sets_union(const SetPtrEnsemble &sets) override;
+
+  SetPtr query_matches_if(const SetPtrEnsemble &sets, MatchCondition condition,
+                          Query const &query) override;
+  SetPtr keep_if_fused(const SetPtrEnsemble &sets, FusedPredicate const &predicate) override;
+
+  SetPtr read_file(const std::string filename) override;
+
+  bool   sorted_output() const override;
+  size_t total_processed() override;
+
+  void set_thread_pool(ThreadPool *pool) override;
+  void set_read_chunk_size(size_t bytes) override;
+
+protected:
+  SetPtr intersect_adaptive(const SetPtrEnsemble &sets);
+  bool   is_skewed(const SetPtrEnsemble &sets) const;
+
+  std::atomic<size_t>     total_processed_{0};
+  ThreadPool *            thread_pool_{nullptr};
+  FileReader::ReadOptions read_options_;
+
+private:
+  SetPtr merge_matches_if(const SetPtrEnsemble &sets, MatchCondition condition);
+};
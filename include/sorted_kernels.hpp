@@ -0,0 +1,45 @@
+#pragma once
+
+#include "query.hpp"
+#include "types.hpp"
+
+/**
+ * Kernels over sorted arrays of 64-bit values used by the sorted engine. Each has a portable
+ * branchless scalar version; the intersection and the filters also have an AVX2 version
+ * comparing 4 values per instruction and an SSE4.2 one working on pairs, the merge an AVX2
+ * version only. The best level supported by the CPU is picked at runtime, on the first use.
+ *
+ * The vector stores write whole registers, so an output array must have room for SLACK values
+ * past the largest possible result; a kernel allowed to run in place needs no slack then.
+ */
+namespace SortedKernels {
+
+static constexpr size_t SLACK = 4;
+
+enum class Level
+{
+  SCALAR,
+  SSE42,
+  AVX2
+};
+
+// The best level the CPU supports.
+Level supported();
+Level active();
+// Makes the kernels run at the given level, limited to the supported one. Not thread-safe with
+// running kernels, meant for benchmarks.
+void        select(Level level);
+const char *name(Level level);
+
+// The values found in both unique arrays; out may be a.
+size_t intersect(const DataType *a, size_t a_size, const DataType *b, size_t b_size,
+                 DataType *out);
+// The values found in any of the unique arrays, once.
+size_t unite(const DataType *a, size_t a_size, const DataType *b, size_t b_size, DataType *out);
+// All the values of both arrays, with the values found in both twice.
+size_t merge(const DataType *a, size_t a_size, const DataType *b, size_t b_size, DataType *out);
+// Keeps the values of a sorted array with duplicates which occur the accepted number of times,
+// once each; out may be values.
+size_t keepMatches(const DataType *values, size_t size, MatchCondition condition, DataType *out);
+
+}  // namespace SortedKernels
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed-size pool of worker threads with a task deque per worker. A worker runs the tasks it
+ * has submitted itself in LIFO order and steals the oldest tasks of the other workers when its
+ * own deque is empty. Tasks submitted from outside of the pool are spread round-robin.
+ */
+class ThreadPool
+{
+public:
+  using Task = std::function<void()>;
+
+  explicit ThreadPool(size_t workers_count);
+  ~ThreadPool();
+
+  ThreadPool(ThreadPool const &) = delete;
+  ThreadPool &operator=(ThreadPool const &) = delete;
+
+  void submit(Task task);
+
+  // Runs one pending task on the calling thread, if there is any. Used by threads which wait
+  // for a group of tasks to complete, so they help instead of blocking a worker.
+  bool runPendingTask();
+
+  size_t size() const;
+
+private:
+  struct WorkQueue
+  {
+    std::mutex       mutex;
+    std::deque<Task> tasks;
+  };
+
+  void workerLoop(size_t index);
+  bool popTask(size_t preferred_queue, Task &task);
+
+  std::vector<std::unique_ptr<WorkQueue>> queues_;
+  std::vector<std::thread>                workers_;
+
+  std::mutex              sleep_mutex_;
+  std::condition_variable wake_up_;
+  std::atomic<size_t>     queued_tasks_{0};
+  std::atomic<size_t>     next_queue_{0};
+  bool                    stopping_{false};
+};
+
+/**
+ * Waits until a known number of tasks report their completion, running pending pool tasks on
+ * the waiting thread meanwhile.
+ */
+class TaskLatch
+{
+public:
+  explicit TaskLatch(size_t count);
+
+  void countDown();
+  void wait(ThreadPool &pool);
+
+private:
+  std::mutex              mutex_;
+  std::condition_variable done_;
+  size_t                  remaining_;
+};
@@ -1,14 +1,18 @@
 #pragma once
 
+#include "arena.hpp"
+
 #include <cstdint>
 #include <memory>
-#include <unordered_map>
-#include <unordered_set>
+#include <string>
 #include <vector>
 
 using DataType       = int64_t;
-using MatchMap       = std::unordered_map<DataType, size_t>;
-using Set            = std::unordered_set<DataType>;
+
+// A set is a vector of unique values. Engines which report sorted_output() keep it
+// in ascending order, the others give no guarantee about the order of elements.
+// Intermediate sets of an evaluation draw their storage from its arena, see arena.hpp.
+using Set            = std::vector<DataType, ArenaAllocator<DataType>>;
 using SetPtr         = std::shared_ptr<Set>;
 using SetPtrEnsemble = std::vector<SetPtr>;
 
@@ -25,6 +29,13 @@ enum class Lexem
   LE,
   GR,
   //
+  COUNT,
+  MIN,
+  MAX,
+  TOP,
+  BOTTOM,
+  EXISTS,
+  //
   FILENAME,
   //
   SPACE,
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * A source of unique values in ascending order, pulled one at a time. Streams let an expression
+ * over inputs larger than the memory be evaluated as a pipeline of k-way merges: only a read
+ * buffer per input file and a merge heap per operation are kept in memory.
+ */
+class ValueStream
+{
+public:
+  virtual ~ValueStream() = default;
+
+  // Returns false once the stream is exhausted.
+  virtual bool next(DataType &value) = 0;
+};
+
+using ValueStreamPtr = std::unique_ptr<ValueStream>;
+using ValueStreams   = std::vector<ValueStreamPtr>;
+
+struct StreamOptions
+{
+  // Where the sorted runs of unsorted input files are spilled.
+  std::string temp_dir{"/tmp"};
+  // The most memory an external sort of an unsorted file may take at once.
+  size_t sort_memory_bytes{size_t(256) << 20};
+};
+
+/**
+ * @brief Opens a file of integers as a stream. A binary set file or a sorted text file is read
+ * sequentially as is; an unsorted one is sorted first in runs of bounded size, which are spilled
+ * into the temporary directory and merged while the stream is read.
+ * @throws std::runtime_error if the file can not be read, contains a malformed line or is a
+ * corrupted set file.
+ */
+ValueStreamPtr openFileStream(std::string const &filename, StreamOptions const &options);
+
+/// A stream of the values of a set held in memory, the set gets sorted.
+ValueStreamPtr openSetStream(Set values);
+
+/**
+ * @brief Merges the streams, passing on the values whose number of occurrences satisfies the
+ * condition.
+ * @param min_matches the smallest occurrence count the condition may accept; the merge stops as
+ * soon as fewer streams than that are left unexhausted.
+ */
+ValueStreamPtr mergeStreams(ValueStreams &&inputs, size_t min_matches,
+                            std::function<bool(size_t)> condition);
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "query.hpp"
+
+#include <cstdint>
+
+/**
+ * Decides which of 64 values a word are kept by the number of inputs holding them. Every input
+ * word is added to bit-sliced counters: plane b holds the bit b of the occurrence count of every
+ * of the values, so the counts are compared with n for the whole word at once. A value no input
+ * holds is never kept. Used by the bitmap and the index engines alike.
+ */
+class WordCounter
+{
+public:
+  WordCounter(size_t inputs_count, MatchCondition condition)
+    : condition_(condition)
+  {
+    while ((inputs_count >> planes_count_) != 0)
+    {
+      ++planes_count_;
+    }
+    n_is_out_of_range_ = (condition.n >> planes_count_) != 0;
+  }
+
+  uint64_t keep(const uint64_t *words, size_t count) const
+  {
+    uint64_t planes[64] = {};
+    uint64_t present    = 0;
+    for (size_t i{0}; i < count; ++i)
+    {
+      uint64_t carry = words[i];
+      present |= carry;
+      for (size_t b{0}; b < planes_count_ && carry != 0; ++b)
+      {
+        const uint64_t next_carry = planes[b] & carry;
+        planes[b] ^= carry;
+        carry = next_carry;
+      }
+    }
+
+    // Compare the counters with n from the highest bit down.
+    uint64_t greater = 0;
+    uint64_t equal   = n_is_out_of_range_ ? 0 : ~uint64_t(0);
+    for (size_t b = planes_count_; b-- > 0 && !n_is_out_of_range_;)
+    {
+      if ((condition_.n >> b) & 1)
+      {
+        equal &= planes[b];
+      }
+      else
+      {
+        greater |= equal & planes[b];
+        equal &= ~planes[b];
+      }
+    }
+    switch (condition_.kind)
+    {
+    case MatchCondition::Kind::LESS:
+      return ~(greater | equal) & present;
+    case MatchCondition::Kind::EQUAL:
+      return equal & present;
+    case MatchCondition::Kind::GREATER:
+      return greater & present;
+    }
+    return 0;
+  }
+
+private:
+  MatchCondition condition_;
+  size_t         planes_count_{1};
+  bool           n_is_out_of_range_{false};
+};
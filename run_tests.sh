@@ -4,72 +4,268 @@ cd build
 
 TEST_FOLDER="../test"
 
-./scalc [ DIF $TEST_FOLDER/nonzero.txt $TEST_FOLDER/naturals.txt ] > nonzero_dif_naturals.txt
-TEST1=`cmp nonzero_dif_naturals.txt $TEST_FOLDER/zero.txt`
-if [ "$TEST1" ]
-then 
-    echo "DIF [1 2 3 ... ] [0 1 2 ... ] == 0, FAILED"
-else
-    echo "DIF [1 2 3 ... ] [0 1 2 ... ] == 0, PASSED"
+if [ ! -f $TEST_FOLDER/naturals.txt ] || [ ! -f $TEST_FOLDER/nonzero.txt ]
+then
+    (cd $TEST_FOLDER && python3 test_sets_generator.py)
 fi
-rm nonzero_dif_naturals.txt
 
-./scalc [ SUM $TEST_FOLDER/odds.txt $TEST_FOLDER/evens.txt ] > odds_sum_evens.txt
-TEST2=`cmp odds_sum_evens.txt $TEST_FOLDER/naturals.txt`
-if [ "$TEST2" ]
+for ENGINE in hash sorted bitmap index
+do
+    ./scalc -e $ENGINE [ DIF $TEST_FOLDER/nonzero.txt $TEST_FOLDER/naturals.txt ] > nonzero_dif_naturals.txt
+    TEST1=`cmp nonzero_dif_naturals.txt $TEST_FOLDER/zero.txt`
+    if [ "$TEST1" ]
+    then 
+        echo "DIF [1 2 3 ... ] [0 1 2 ... ] == 0, $ENGINE, FAILED"
+    else
+        echo "DIF [1 2 3 ... ] [0 1 2 ... ] == 0, $ENGINE, PASSED"
+    fi
+    rm nonzero_dif_naturals.txt
+
+    ./scalc -e $ENGINE [ SUM $TEST_FOLDER/odds.txt $TEST_FOLDER/evens.txt ] > odds_sum_evens.txt
+    TEST2=`cmp odds_sum_evens.txt $TEST_FOLDER/naturals.txt`
+    if [ "$TEST2" ]
+    then 
+        echo "SUM [1 3 5 ... ] [0 2 4 ... ] == [1 2 3 4 ... ], $ENGINE, FAILED"
+    else
+        echo "SUM [1 3 5 ... ] [0 2 4 ... ] == [1 2 3 4 ... ], $ENGINE, PASSED"
+    fi
+    rm odds_sum_evens.txt
+
+    ./scalc -e $ENGINE [ INT $TEST_FOLDER/naturals.txt $TEST_FOLDER/evens.txt $TEST_FOLDER/zero.txt ] > int_naturals_evens_zero.txt
+    TEST3=`cmp int_naturals_evens_zero.txt $TEST_FOLDER/zero.txt`
+    if [ "$TEST3" ]
+    then 
+        echo "INT [1 2 3 ... ] [1 2 3 ... ] [ 0 ] == [ 0 ], $ENGINE, FAILED"
+    else
+        echo "INT [1 2 3 ... ] [1 2 3 ... ] [ 0 ] == [ 0 ], $ENGINE, PASSED"
+    fi
+    rm int_naturals_evens_zero.txt
+
+    ./scalc -e $ENGINE [ GR 2 $TEST_FOLDER/nonzero.txt $TEST_FOLDER/odds.txt $TEST_FOLDER/zero.txt $TEST_FOLDER/evens.txt $TEST_FOLDER/zero.txt ] > test.txt
+    TEST4=`cmp test.txt $TEST_FOLDER/zero.txt`
+    if [ "$TEST4" ]
+    then 
+        echo "GR 2 [1 2 3 ... ] [1 2 3 ... ] [ 0 ] [ 0 ] [0 2 4 ... ] == [ 0 ], $ENGINE, FAILED"
+    else
+        echo "GR 2 [1 2 3 ... ] [1 2 3 ... ] [ 0 ] [ 0 ] [0 2 4 ... ] == [ 0 ], $ENGINE, PASSED"
+    fi
+    rm test.txt
+
+    ./scalc -e $ENGINE [ EQ 2 $TEST_FOLDER/nonzero.txt $TEST_FOLDER/odds.txt $TEST_FOLDER/evens.txt $TEST_FOLDER/zero.txt ] > test.txt
+    TEST5=`cmp test.txt $TEST_FOLDER/naturals.txt`
+    if [ "$TEST5" ]
+    then 
+        echo "EQ 2 [1 2 3 ... ] [1 3 5... ] [ 0 ] [0 2 4 ... ] [ 0 ] == [ N ], $ENGINE, FAILED"
+    else
+        echo "EQ 2 [1 2 3 ... ] [1 3 5... ] [ 0 ] [0 2 4 ... ] [ 0 ] == [ N ], $ENGINE, PASSED"
+    fi
+    rm test.txt
+
+    ./scalc -e $ENGINE [ LE 2 $TEST_FOLDER/odds.txt $TEST_FOLDER/evens.txt $TEST_FOLDER/zero.txt ] > test.txt
+    TEST6=`cmp test.txt $TEST_FOLDER/nonzero.txt`
+    if [ "$TEST6" ]
+    then 
+        echo "LE 2 [1 3 5... ] [ 0 ] [0 2 4 ... ] == [ 1 2 3 4 ... ], $ENGINE, FAILED"
+    else
+        echo "LE 2 [1 3 5... ] [ 0 ] [0 2 4 ... ] == [ 1 2 3 4 ... ], $ENGINE, PASSED"
+    fi
+    rm test.txt
+
+    ./scalc -e $ENGINE [ EQ 1 [ GR 0 [ LE 10 [ INT [ SUM [ EQ 3 $TEST_FOLDER/zero.txt [ SUM $TEST_FOLDER/empty.txt ] $TEST_FOLDER/empty.txt [ DIF $TEST_FOLDER/odds.txt $TEST_FOLDER/evens.txt ] $TEST_FOLDER/zero.txt ] ] ] ] ] ] > test.txt
+    TEST7=`cmp test.txt $TEST_FOLDER/zero.txt`
+    if [ "$TEST7" ]
+    then 
+        echo "Deep tree test, $ENGINE, FAILED"
+    else
+        echo "Deep tree test, $ENGINE, PASSED"
+    fi
+    rm test.txt
+
+    ./scalc -e $ENGINE [ DIF [ SUM $TEST_FOLDER/odds.txt $TEST_FOLDER/evens.txt ] [ SUM $TEST_FOLDER/evens.txt $TEST_FOLDER/odds.txt ] $TEST_FOLDER/zero.txt ] > test.txt
+    TEST8=`cmp test.txt $TEST_FOLDER/empty.txt`
+    if [ "$TEST8" ]
+    then 
+        echo "Common subexpression test, $ENGINE, FAILED"
+    else
+        echo "Common subexpression test, $ENGINE, PASSED"
+    fi
+    rm test.txt
+
+    ./scalc -e $ENGINE -j 4 [ SUM [ INT $TEST_FOLDER/naturals.txt $TEST_FOLDER/evens.txt ] [ INT $TEST_FOLDER/odds.txt $TEST_FOLDER/nonzero.txt ] ] > test.txt
+    TEST9=`cmp test.txt $TEST_FOLDER/naturals.txt`
+    if [ "$TEST9" ]
+    then 
+        echo "Parallel evaluation test, $ENGINE, FAILED"
+    else
+        echo "Parallel evaluation test, $ENGINE, PASSED"
+    fi
+    rm test.txt
+
+    ./scalc -e $ENGINE -o odds.sset [ SUM $TEST_FOLDER/odds.txt ]
+    ./scalc -e $ENGINE [ SUM odds.sset $TEST_FOLDER/evens.txt ] > test.txt
+    TEST10=`cmp test.txt $TEST_FOLDER/naturals.txt`
+    if [ "$TEST10" ]
+    then 
+        echo "Binary set file test, $ENGINE, FAILED"
+    else
+        echo "Binary set file test, $ENGINE, PASSED"
+    fi
+    rm test.txt odds.sset
+
+    printf "[ INT $TEST_FOLDER/naturals.txt $TEST_FOLDER/zero.txt ]\n[ INT $TEST_FOLDER/zero.txt $TEST_FOLDER/naturals.txt ]\n" | ./scalc -e $ENGINE --serve > test.txt
+    printf "OK 1\n0\nOK 1\n0\n" > expected.txt
+    # The index only grows, so a server does not take the index engine.
+    if [ "$ENGINE" = "index" ]
+    then
+        echo "Error : '-e index' keeps every value read for the lifetime of the process, it can not be used with '--serve' or '--socket'." > expected.txt
+    fi
+    TEST11=`cmp test.txt expected.txt`
+    if [ "$TEST11" ]
+    then 
+        echo "Server mode test, $ENGINE, FAILED"
+    else
+        echo "Server mode test, $ENGINE, PASSED"
+    fi
+    rm test.txt expected.txt
+
+    ./scalc -e $ENGINE [ SUM [ SUM $TEST_FOLDER/odds.txt [ INT $TEST_FOLDER/naturals.txt $TEST_FOLDER/empty.txt ] ] [ GR 0 $TEST_FOLDER/evens.txt [ EQ 3 $TEST_FOLDER/odds.txt $TEST_FOLDER/evens.txt ] ] ] > test.txt
+    TEST13=`cmp test.txt $TEST_FOLDER/naturals.txt`
+    if [ "$TEST13" ]
+    then 
+        echo "Optimizer rewrites test, $ENGINE, FAILED"
+    else
+        echo "Optimizer rewrites test, $ENGINE, PASSED"
+    fi
+    rm test.txt
+
+    ./scalc -e $ENGINE [ COUNT [ SUM $TEST_FOLDER/odds.txt $TEST_FOLDER/evens.txt ] ] > test.txt
+    ./scalc -e $ENGINE [ BOTTOM 3 [ SUM $TEST_FOLDER/odds.txt $TEST_FOLDER/evens.txt ] ] >> test.txt
+    ./scalc -e $ENGINE [ MAX [ INT $TEST_FOLDER/naturals.txt $TEST_FOLDER/odds.txt ] ] >> test.txt
+    ./scalc -e $ENGINE [ EXISTS [ INT $TEST_FOLDER/odds.txt $TEST_FOLDER/evens.txt ] ] >> test.txt
+    (wc -l < $TEST_FOLDER/naturals.txt; head -n 3 $TEST_FOLDER/naturals.txt; tail -n 1 $TEST_FOLDER/odds.txt; echo 0) | tr -d ' ' > expected.txt
+    TEST14=`cmp test.txt expected.txt`
+    if [ "$TEST14" ]
+    then 
+        echo "Query modes test, $ENGINE, FAILED"
+    else
+        echo "Query modes test, $ENGINE, PASSED"
+    fi
+    rm test.txt expected.txt
+
+    printf "sum.txt [ SUM $TEST_FOLDER/odds.txt [ INT $TEST_FOLDER/naturals.txt $TEST_FOLDER/evens.txt ] ]\n\ncount.txt [ COUNT [ INT $TEST_FOLDER/evens.txt $TEST_FOLDER/naturals.txt ] ]\n" > batch.txt
+    ./scalc -e $ENGINE -j 2 --batch batch.txt > /dev/null
+    (cat $TEST_FOLDER/naturals.txt; wc -l < $TEST_FOLDER/evens.txt | tr -d ' ') > expected.txt
+    cat sum.txt count.txt > test.txt
+    TEST15=`cmp test.txt expected.txt`
+    if [ "$TEST15" ]
+    then 
+        echo "Batch mode test, $ENGINE, FAILED"
+    else
+        echo "Batch mode test, $ENGINE, PASSED"
+    fi
+    rm batch.txt sum.txt count.txt test.txt expected.txt
+
+    ./scalc -e $ENGINE --fuse --no-optimize [ SUM [ DIF $TEST_FOLDER/odds.txt $TEST_FOLDER/evens.txt ] [ GR 0 [ INT $TEST_FOLDER/naturals.txt $TEST_FOLDER/zero.txt ] $TEST_FOLDER/empty.txt ] ] > test.txt
+    TEST16=`cmp test.txt $TEST_FOLDER/naturals.txt`
+    if [ "$TEST16" ]
+    then 
+        echo "Fused evaluation test, $ENGINE, FAILED"
+    else
+        echo "Fused evaluation test, $ENGINE, PASSED"
+    fi
+    rm test.txt
+
+    # The fused result of a shared subexpression is intersected again in a later expression.
+    seq 1 8 > fused_a.txt; echo 100 > fused_b.txt; echo 3 > fused_f.txt; echo 500 > fused_d.txt
+    printf "w.txt [ SUM [ INT [ DIF fused_a.txt fused_b.txt ] fused_f.txt ] fused_b.txt ]\nx.txt [ SUM [ INT [ DIF fused_a.txt fused_b.txt ] fused_a.txt ] fused_d.txt ]\ny.txt [ INT [ SUM [ INT [ DIF fused_a.txt fused_b.txt ] fused_a.txt ] fused_d.txt ] fused_d.txt ]\n" > batch.txt
+    ./scalc -e $ENGINE --fuse --batch batch.txt > /dev/null
+    TEST19=`cmp y.txt fused_d.txt`
+    if [ "$TEST19" ]
+    then 
+        echo "Fused shared subexpression test, $ENGINE, FAILED"
+    else
+        echo "Fused shared subexpression test, $ENGINE, PASSED"
+    fi
+    rm batch.txt w.txt x.txt y.txt fused_a.txt fused_b.txt fused_f.txt fused_d.txt
+
+    ./scalc -e $ENGINE -j 3 --chunk-mb 1 [ SUM $TEST_FOLDER/odds.txt $TEST_FOLDER/naturals.txt ] > test.txt
+    TEST18=`cmp test.txt $TEST_FOLDER/naturals.txt`
+    if [ "$TEST18" ]
+    then 
+        echo "Chunked parsing test, $ENGINE, FAILED"
+    else
+        echo "Chunked parsing test, $ENGINE, PASSED"
+    fi
+    rm test.txt
+done
+
+# The size of a binary set file is told exactly by its header, a text file is bounded by its bytes.
+./scalc -o odds.sset [ SUM $TEST_FOLDER/odds.txt ] > /dev/null
+./scalc --explain [ INT odds.sset $TEST_FOLDER/zero.txt ] 2> test.txt > /dev/null
+TEST21=`grep -c "FILEREADER:odds.sset\] at most $(wc -l < $TEST_FOLDER/odds.txt) values" test.txt`
+if [ "$TEST21" = "0" ]
 then 
-    echo "SUM [1 3 5 ... ] [0 2 4 ... ] == [1 2 3 4 ... ], FAILED"
+    echo "Set file size estimate test, FAILED"
 else
-    echo "SUM [1 3 5 ... ] [0 2 4 ... ] == [1 2 3 4 ... ], PASSED"
+    echo "Set file size estimate test, PASSED"
 fi
-rm odds_sum_evens.txt
+rm test.txt odds.sset
 
-./scalc [ INT $TEST_FOLDER/naturals.txt $TEST_FOLDER/evens.txt $TEST_FOLDER/zero.txt ] > int_naturals_evens_zero.txt
-TEST3=`cmp int_naturals_evens_zero.txt $TEST_FOLDER/zero.txt`
-if [ "$TEST3" ]
+# The streaming mode does not depend on the engine. Unsorted input is sorted in spilled runs.
+sort -R $TEST_FOLDER/odds.txt > shuffled_odds.txt
+./scalc --stream --sort-memory-mb 1 [ SUM [ INT $TEST_FOLDER/naturals.txt $TEST_FOLDER/evens.txt ] [ INT shuffled_odds.txt $TEST_FOLDER/nonzero.txt ] ] > test.txt
+TEST12=`cmp test.txt $TEST_FOLDER/naturals.txt`
+if [ "$TEST12" ]
 then 
-    echo "INT [1 2 3 ... ] [1 2 3 ... ] [ 0 ] == [ 0 ], FAILED"
+    echo "Streaming evaluation test, FAILED"
 else
-    echo "INT [1 2 3 ... ] [1 2 3 ... ] [ 0 ] == [ 0 ], PASSED"
+    echo "Streaming evaluation test, PASSED"
 fi
-rm int_naturals_evens_zero.txt
+rm test.txt
 
-./scalc [ GR 2 $TEST_FOLDER/nonzero.txt $TEST_FOLDER/odds.txt $TEST_FOLDER/zero.txt $TEST_FOLDER/evens.txt $TEST_FOLDER/zero.txt ] > test.txt
-TEST4=`cmp test.txt $TEST_FOLDER/zero.txt`
-if [ "$TEST4" ]
+# A binary set file is streamed as it is.
+./scalc -o odds.sset [ SUM $TEST_FOLDER/odds.txt ] > /dev/null
+./scalc --stream [ SUM odds.sset $TEST_FOLDER/evens.txt ] > test.txt
+TEST22=`cmp test.txt $TEST_FOLDER/naturals.txt`
+if [ "$TEST22" ]
 then 
-    echo "GR 2 [1 2 3 ... ] [1 2 3 ... ] [ 0 ] [ 0 ] [0 2 4 ... ] == [ 0 ], FAILED"
+    echo "Streaming set file test, FAILED"
 else
-    echo "GR 2 [1 2 3 ... ] [1 2 3 ... ] [ 0 ] [ 0 ] [0 2 4 ... ] == [ 0 ], PASSED"
+    echo "Streaming set file test, PASSED"
 fi
-rm test.txt
+rm test.txt odds.sset
 
-./scalc [ EQ 2 $TEST_FOLDER/nonzero.txt $TEST_FOLDER/odds.txt $TEST_FOLDER/evens.txt $TEST_FOLDER/zero.txt ] > test.txt
-TEST5=`cmp test.txt $TEST_FOLDER/naturals.txt`
-if [ "$TEST5" ]
+# Hundreds of spilled runs are merged in passes, within a small file descriptor limit.
+(ulimit -n 100; ./scalc --stream --sort-memory-mb 0 [ SUM shuffled_odds.txt ] > test.txt)
+TEST20=`cmp test.txt $TEST_FOLDER/odds.txt`
+if [ "$TEST20" ]
 then 
-    echo "EQ 2 [1 2 3 ... ] [1 3 5... ] [ 0 ] [0 2 4 ... ] [ 0 ] == [ N ], FAILED"
+    echo "Streaming merge passes test, FAILED"
 else
-    echo "EQ 2 [1 2 3 ... ] [1 3 5... ] [ 0 ] [0 2 4 ... ] [ 0 ] == [ N ], PASSED"
+    echo "Streaming merge passes test, PASSED"
 fi
-rm test.txt
+rm test.txt shuffled_odds.txt
 
-./scalc [ LE 2 $TEST_FOLDER/odds.txt $TEST_FOLDER/evens.txt $TEST_FOLDER/zero.txt ] > test.txt
-TEST6=`cmp test.txt $TEST_FOLDER/nonzero.txt`
-if [ "$TEST6" ]
+# An incremental evaluation picks up the values added to a file since the previous one.
+cp $TEST_FOLDER/evens.txt inc_evens.txt
+head -n 10 $TEST_FOLDER/odds.txt > inc_odds.txt
+./scalc --incremental inc_state [ SUM [ INT inc_evens.txt $TEST_FOLDER/naturals.txt ] inc_odds.txt ] > /dev/null
+cp $TEST_FOLDER/odds.txt inc_odds.txt
+./scalc --incremental inc_state [ SUM [ INT inc_evens.txt $TEST_FOLDER/naturals.txt ] inc_odds.txt ] > test.txt
+TEST17=`cmp test.txt $TEST_FOLDER/naturals.txt`
+if [ "$TEST17" ]
 then 
-    echo "LE 2 [1 3 5... ] [ 0 ] [0 2 4 ... ] == [ 1 2 3 4 ... ], FAILED"
+    echo "Incremental evaluation test, FAILED"
 else
-    echo "LE 2 [1 3 5... ] [ 0 ] [0 2 4 ... ] == [ 1 2 3 4 ... ], PASSED"
+    echo "Incremental evaluation test, PASSED"
 fi
-rm test.txt
+rm -r test.txt inc_evens.txt inc_odds.txt inc_state
 
-./scalc [ EQ 1 [ GR 0 [ LE 10 [ INT [ SUM [ EQ 3 $TEST_FOLDER/zero.txt [ SUM $TEST_FOLDER/empty.txt ] $TEST_FOLDER/empty.txt [ DIF $TEST_FOLDER/odds.txt $TEST_FOLDER/evens.txt ] $TEST_FOLDER/zero.txt ] ] ] ] ] ] > test.txt
-TEST7=`cmp test.txt $TEST_FOLDER/zero.txt`
-if [ "$TEST7" ]
+# The sorted-set kernels of every level the CPU supports must agree with the hash engine.
+./scalc_kernel_bench --sizes 3,1000,100000 --repeat 1 > /dev/null
+if [ $? -ne 0 ]
 then 
-    echo "Deep tree test, FAILED"
+    echo "Sorted kernels test, FAILED"
 else
-    echo "Deep tree test, PASSED"
+    echo "Sorted kernels test, PASSED"
 fi
-rm test.txt
@@ -0,0 +1,151 @@
+#include "arena.hpp"
+
+#include <algorithm>
+
+constexpr size_t Arena::ALIGNMENT;
+constexpr size_t Arena::SMALL_BLOCK_SIZE;
+constexpr size_t Arena::LARGE_BLOCK_SIZE;
+constexpr size_t Arena::FIRST_CHUNK_SIZE;
+constexpr size_t Arena::MAX_CHUNK_SIZE;
+constexpr size_t Arena::SIZE_CLASSES;
+
+namespace {
+
+thread_local Arena *current_arena = nullptr;
+thread_local size_t thread_allocated_bytes = 0;
+
+static constexpr size_t SMALL_CLASSES   = Arena::SMALL_BLOCK_SIZE / Arena::ALIGNMENT;
+static constexpr size_t FIRST_POWER_BIT = 9;  // the first power of 2 above SMALL_BLOCK_SIZE
+
+}  // namespace
+
+Arena::Arena(bool shared, Arena *parent)
+  : shared_(shared)
+  , parent_(parent)
+{}
+
+Arena::~Arena()
+{
+  for (auto chunk : chunks_)
+  {
+    ::operator delete(chunk);
+  }
+  if (parent_ != nullptr)
+  {
+    auto lock = parent_->lockIfShared();
+    parent_->statistics_.allocations += statistics_.allocations;
+    parent_->statistics_.reused += statistics_.reused;
+    parent_->statistics_.system_allocations += statistics_.system_allocations;
+    parent_->statistics_.reserved_bytes += statistics_.reserved_bytes;
+  }
+}
+
+size_t Arena::classOf(size_t bytes)
+{
+  if (bytes <= SMALL_BLOCK_SIZE)
+  {
+    return (std::max(bytes, size_t(1)) + ALIGNMENT - 1) / ALIGNMENT - 1;
+  }
+  const size_t power_bit = size_t(64 - __builtin_clzll(uint64_t(bytes - 1)));
+  return SMALL_CLASSES + power_bit - FIRST_POWER_BIT;
+}
+
+size_t Arena::classSize(size_t size_class)
+{
+  if (size_class < SMALL_CLASSES)
+  {
+    return (size_class + 1) * ALIGNMENT;
+  }
+  return size_t(1) << (size_class - SMALL_CLASSES + FIRST_POWER_BIT);
+}
+
+void *Arena::allocate(size_t bytes)
+{
+  thread_allocated_bytes += bytes;
+  if (bytes > LARGE_BLOCK_SIZE)
+  {
+    void *block = ::operator new(bytes);
+    auto  lock  = lockIfShared();
+    ++statistics_.allocations;
+    ++statistics_.system_allocations;
+    return block;
+  }
+
+  const size_t size_class = classOf(bytes);
+  auto         lock       = lockIfShared();
+  ++statistics_.allocations;
+  if (FreeBlock *block = free_lists_[size_class])
+  {
+    free_lists_[size_class] = block->next;
+    ++statistics_.reused;
+    return block;
+  }
+  return carve(classSize(size_class));
+}
+
+void Arena::deallocate(void *block, size_t bytes)
+{
+  if (bytes > LARGE_BLOCK_SIZE)
+  {
+    ::operator delete(block);
+    return;
+  }
+  const size_t size_class = classOf(bytes);
+  auto         lock       = lockIfShared();
+  auto *       free_block = static_cast<FreeBlock *>(block);
+  free_block->next        = free_lists_[size_class];
+  free_lists_[size_class] = free_block;
+}
+
+Arena::Statistics Arena::statistics() const
+{
+  auto lock = lockIfShared();
+  return statistics_;
+}
+
+std::unique_lock<std::mutex> Arena::lockIfShared() const
+{
+  return shared_ ? std::unique_lock<std::mutex>(mutex_) : std::unique_lock<std::mutex>();
+}
+
+size_t Arena::allocatedByThread()
+{
+  return thread_allocated_bytes;
+}
+
+Arena *Arena::current()
+{
+  return current_arena;
+}
+
+/**
+ * @brief Cuts a block off the current chunk, starting a new chunk when it does not fit. The
+ * remainder of the old chunk is abandoned; chunks grow twice up to MAX_CHUNK_SIZE, so it is small.
+ */
+void *Arena::carve(size_t bytes)
+{
+  if (size_t(chunk_end_ - cursor_) < bytes)
+  {
+    const size_t chunk_size = std::max(next_chunk_size_, bytes);
+    cursor_                 = static_cast<char *>(::operator new(chunk_size));
+    chunk_end_              = cursor_ + chunk_size;
+    chunks_.push_back(cursor_);
+    next_chunk_size_ = std::min(next_chunk_size_ * 2, MAX_CHUNK_SIZE);
+    ++statistics_.system_allocations;
+    statistics_.reserved_bytes += chunk_size;
+  }
+  void *block = cursor_;
+  cursor_ += bytes;
+  return block;
+}
+
+ArenaScope::ArenaScope(Arena *arena)
+  : previous_(current_arena)
+{
+  current_arena = arena;
+}
+
+ArenaScope::~ArenaScope()
+{
+  current_arena = previous_;
+}
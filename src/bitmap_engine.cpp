@@ -0,0 +1,413 @@
+#include "bitmap_engine.hpp"
+
+#include "logger.hpp"
+#include "word_counter.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+using Container = RoaringBitmap::Container;
+using Condition = MatchCondition;
+
+static constexpr size_t WORDS = RoaringBitmap::BITSET_WORDS;
+
+/**
+ * @brief Counts the occurrences of values in arrays by sorting all of them together. Sparse
+ * chunks are cheaper to count this way than in bitsets.
+ */
+Container combineArrays(std::vector<const Container *> const &containers, Condition condition)
+{
+  std::vector<uint16_t> all_values;
+  for (auto container : containers)
+  {
+    all_values.insert(all_values.end(), container->values.begin(), container->values.end());
+  }
+  std::sort(all_values.begin(), all_values.end());
+
+  std::vector<uint16_t> kept;
+  for (size_t begin{0}; begin < all_values.size();)
+  {
+    size_t end = begin + 1;
+    while (end < all_values.size() && all_values[end] == all_values[begin])
+    {
+      ++end;
+    }
+    if (condition.accepts(end - begin))
+    {
+      kept.push_back(all_values[begin]);
+    }
+    begin = end;
+  }
+  return RoaringBitmap::makeContainer(std::move(kept));
+}
+
+/**
+ * @brief Combines the chunk bitsets word by word: INT and SUM are AND and OR loops, the other
+ * conditions count the occurrences with bit-sliced counters.
+ */
+Container combineBitsets(std::vector<const uint64_t *> const &inputs, Condition condition)
+{
+  std::vector<uint64_t> output(WORDS, 0);
+
+  if (condition.kind == Condition::Kind::GREATER && condition.n == 0)
+  {
+    for (auto input : inputs)
+    {
+      for (size_t w{0}; w < WORDS; ++w)
+      {
+        output[w] |= input[w];
+      }
+    }
+    return RoaringBitmap::makeContainer(output.data());
+  }
+  if (condition.kind == Condition::Kind::EQUAL && condition.n == inputs.size())
+  {
+    std::copy(inputs.front(), inputs.front() + WORDS, output.begin());
+    for (size_t i{1}; i < inputs.size(); ++i)
+    {
+      for (size_t w{0}; w < WORDS; ++w)
+      {
+        output[w] &= inputs[i][w];
+      }
+    }
+    return RoaringBitmap::makeContainer(output.data());
+  }
+
+  const WordCounter     counter(inputs.size(), condition);
+  std::vector<uint64_t> words(inputs.size());
+  for (size_t w{0}; w < WORDS; ++w)
+  {
+    for (size_t i{0}; i < inputs.size(); ++i)
+    {
+      words[i] = inputs[i][w];
+    }
+    output[w] = counter.keep(words.data(), words.size());
+  }
+  return RoaringBitmap::makeContainer(output.data());
+}
+
+Container combine(std::vector<const Container *> const &containers, Condition condition)
+{
+  const bool all_arrays =
+      std::all_of(containers.begin(), containers.end(), [](const Container *container) {
+        return container->kind == Container::Kind::ARRAY;
+      });
+  if (all_arrays)
+  {
+    return combineArrays(containers, condition);
+  }
+
+  std::vector<uint64_t>        scratch;
+  std::vector<const uint64_t *> inputs;
+  scratch.reserve(containers.size() * WORDS);
+  for (auto container : containers)
+  {
+    if (container->kind == Container::Kind::BITSET)
+    {
+      inputs.push_back(container->words.data());
+    }
+  }
+  for (auto container : containers)
+  {
+    if (container->kind != Container::Kind::BITSET)
+    {
+      scratch.resize(scratch.size() + WORDS, 0);
+      container->addTo(&scratch[scratch.size() - WORDS]);
+    }
+  }
+  for (size_t offset{0}; offset < scratch.size(); offset += WORDS)
+  {
+    inputs.push_back(&scratch[offset]);
+  }
+  return combineBitsets(inputs, condition);
+}
+
+/**
+ * @brief Walks all the bitmaps chunk by chunk in the ascending order of keys and combines the
+ * containers of every chunk.
+ */
+RoaringBitmap keepMatchesIf(std::vector<std::shared_ptr<const RoaringBitmap>> const &bitmaps,
+                            Condition                                               condition)
+{
+  RoaringBitmap                  result;
+  std::vector<size_t>            positions(bitmaps.size(), 0);
+  std::vector<const Container *> chunk;
+  while (true)
+  {
+    bool     found_key = false;
+    DataType key       = 0;
+    for (size_t i{0}; i < bitmaps.size(); ++i)
+    {
+      auto const &keys = bitmaps[i]->keys();
+      if (positions[i] < keys.size() && (!found_key || keys[positions[i]] < key))
+      {
+        key       = keys[positions[i]];
+        found_key = true;
+      }
+    }
+    if (!found_key)
+    {
+      return result;
+    }
+
+    chunk.clear();
+    for (size_t i{0}; i < bitmaps.size(); ++i)
+    {
+      auto const &keys = bitmaps[i]->keys();
+      if (positions[i] < keys.size() && keys[positions[i]] == key)
+      {
+        chunk.push_back(&bitmaps[i]->containers()[positions[i]]);
+        ++positions[i];
+      }
+    }
+    if (condition.satisfiable(chunk.size()))
+    {
+      result.append(key, combine(chunk, condition));
+    }
+  }
+}
+
+}  // namespace
+
+BitmapEngine::CachedBitmap BitmapEngine::cached(const Set &set) const
+{
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  auto const                  entry = cache_.find(&set);
+  if (entry != cache_.end() && !entry->second.set.expired())
+  {
+    return entry->second;
+  }
+  return CachedBitmap{std::weak_ptr<Set>(), nullptr, false};
+}
+
+BitmapEngine::BitmapPtr BitmapEngine::bitmap_of(const SetPtr &set)
+{
+  auto bitmap = cached(*set).bitmap;
+  if (bitmap)
+  {
+    return bitmap;
+  }
+  bitmap = std::make_shared<const RoaringBitmap>(RoaringBitmap::fromSorted(*set));
+  remember(set, bitmap, false);
+  return bitmap;
+}
+
+std::vector<BitmapEngine::BitmapPtr> BitmapEngine::bitmaps_of(const SetPtrEnsemble &sets)
+{
+  std::vector<BitmapPtr> bitmaps;
+  bitmaps.reserve(sets.size());
+  for (const auto &set : sets)
+  {
+    bitmaps.push_back(bitmap_of(set));
+    total_processed_ += bitmaps.back()->cardinality();
+  }
+  return bitmaps;
+}
+
+void BitmapEngine::remember(const SetPtr &set, BitmapPtr const &bitmap, bool only)
+{
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  for (auto it = cache_.begin(); it != cache_.end();)
+  {
+    it = it->second.set.expired() ? cache_.erase(it) : std::next(it);
+  }
+  cache_[set.get()] = CachedBitmap{set, bitmap, only};
+}
+
+SetPtr BitmapEngine::make_set_of(BitmapPtr bitmap)
+{
+  auto result = Helpers::makeEvaluationSet(Arena::current());
+  total_processed_ += bitmap->cardinality();
+  remember(result, bitmap, true);
+  return result;
+}
+
+void BitmapEngine::materialize(Set &set)
+{
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  auto const                  entry = cache_.find(&set);
+  if (entry == cache_.end() || entry->second.set.expired() || !entry->second.only)
+  {
+    return;
+  }
+  set.reserve(entry->second.bitmap->cardinality());
+  entry->second.bitmap->appendTo(set);
+  cache_.erase(entry);
+}
+
+size_t BitmapEngine::size_of(const Set &set) const
+{
+  const auto entry = cached(set);
+  return entry.only ? entry.bitmap->cardinality() : set.size();
+}
+
+size_t BitmapEngine::memory_of(const Set &set) const
+{
+  const auto entry = cached(set);
+  if (entry.only)
+  {
+    return entry.bitmap->memoryUsage();
+  }
+  return set.capacity() * sizeof(DataType) + (entry.bitmap ? entry.bitmap->memoryUsage() : 0);
+}
+
+/**
+ * @brief Keeps the values of the smallest set which all the other sets hold: a set with a
+ * bitmap is probed through it, any other one by binary search.
+ */
+SetPtr BitmapEngine::intersect_by_probing(const SetPtrEnsemble &sets)
+{
+  auto result = Helpers::makeEvaluationSet(Arena::current());
+  if (sets.empty())
+  {
+    return result;
+  }
+  std::vector<size_t> sizes;
+  for (const auto &set : sets)
+  {
+    sizes.push_back(size_of(*set));
+  }
+  const size_t smallest = size_t(std::min_element(sizes.begin(), sizes.end()) - sizes.begin());
+  const auto   entry    = cached(*sets[smallest]);
+  if (entry.only)
+  {
+    entry.bitmap->appendTo(*result);
+  }
+  else
+  {
+    result->assign(sets[smallest]->begin(), sets[smallest]->end());
+  }
+  total_processed_ += result->size();
+
+  for (size_t i{0}; i < sets.size() && !result->empty(); ++i)
+  {
+    if (i == smallest)
+    {
+      continue;
+    }
+    Set const & other        = *sets[i];
+    const auto  other_bitmap = cached(other).bitmap;
+    const auto  kept         = std::remove_if(result->begin(), result->end(), [&](DataType value) {
+      return other_bitmap ? !other_bitmap->contains(value)
+                          : !std::binary_search(other.begin(), other.end(), value);
+    });
+    result->erase(kept, result->end());
+  }
+  return result;
+}
+
+SetPtr BitmapEngine::keep_if_less_than_n_matches(const SetPtrEnsemble &sets, int n)
+{
+  return make_set_of(std::make_shared<const RoaringBitmap>(keepMatchesIf(
+      bitmaps_of(sets), MatchCondition{MatchCondition::Kind::LESS, size_t(n)})));
+}
+
+SetPtr BitmapEngine::keep_if_precisely_n_matches(const SetPtrEnsemble &sets, int n)
+{
+  return make_set_of(std::make_shared<const RoaringBitmap>(keepMatchesIf(
+      bitmaps_of(sets), MatchCondition{MatchCondition::Kind::EQUAL, size_t(n)})));
+}
+
+SetPtr BitmapEngine::keep_if_greater_than_n_matches(const SetPtrEnsemble &sets, int n)
+{
+  return make_set_of(std::make_shared<const RoaringBitmap>(keepMatchesIf(
+      bitmaps_of(sets), MatchCondition{MatchCondition::Kind::GREATER, size_t(n)})));
+}
+
+SetPtr BitmapEngine::sets_intersection(const SetPtrEnsemble &sets)
+{
+  // Building bitmaps of the large sets costs more than probing them for a few values.
+  if (is_skewed(sets))
+  {
+    return intersect_by_probing(sets);
+  }
+  return keep_if_precisely_n_matches(sets, int(sets.size()));
+}
+
+SetPtr BitmapEngine::sets_difference(const SetPtrEnsemble &sets)
+{
+  return keep_if_precisely_n_matches(sets, 1);
+}
+
+SetPtr BitmapEngine::sets_union(const SetPtrEnsemble &sets)
+{
+  return keep_if_greater_than_n_matches(sets, 0);
+}
+
+/**
+ * @brief Combines the bitmaps like the counting operations but never converts the result into a
+ * set: a count is the cardinality of the bitmap, the other queries walk it in ascending order.
+ */
+SetPtr BitmapEngine::query_matches_if(const SetPtrEnsemble &sets, MatchCondition condition,
+                                      Query const &query)
+{
+  if (condition.kind == MatchCondition::Kind::EQUAL && condition.n == sets.size() &&
+      is_skewed(sets))
+  {
+    return answerQuery(*intersect_by_probing(sets), query, true);
+  }
+  const RoaringBitmap bitmap = keepMatchesIf(bitmaps_of(sets), condition);
+  QueryAccumulator    answer(query, true);
+  if (answer.countsOnly())
+  {
+    answer.addCount(bitmap.cardinality());
+  }
+  else
+  {
+    bitmap.forEach([&answer](DataType value) { return answer.add(value); });
+  }
+  return answer.result();
+}
+
+/**
+ * @brief Combines the bitmaps term by term, the bitmaps of the inner terms being counted by the
+ * outer ones like the bitmaps of the leaves.
+ */
+SetPtr BitmapEngine::keep_if_fused(const SetPtrEnsemble &sets, FusedPredicate const &predicate)
+{
+  if (sets.size() != predicate.leavesCount())
+  {
+    throw std::runtime_error("The fused predicate expects " +
+                             std::to_string(predicate.leavesCount()) + " inputs.");
+  }
+  const auto  leaves = bitmaps_of(sets);
+  auto const &terms  = predicate.terms();
+
+  std::vector<BitmapPtr> term_bitmaps;
+  term_bitmaps.reserve(terms.size());
+  std::vector<BitmapPtr> inputs;
+  for (auto const &term : terms)
+  {
+    inputs.clear();
+    for (auto leaf : term.leaves)
+    {
+      inputs.push_back(leaves[leaf]);
+    }
+    for (auto inner : term.terms)
+    {
+      inputs.push_back(term_bitmaps[inner]);
+    }
+    term_bitmaps.push_back(
+        std::make_shared<const RoaringBitmap>(keepMatchesIf(inputs, term.condition)));
+  }
+  return make_set_of(term_bitmaps.back());
+}
+
+/**
+ * @brief Reads the file like the sorted engine and keeps it as a bitmap only, the vector parsed
+ * being released.
+ */
+SetPtr BitmapEngine::read_file(const std::string filename)
+{
+  auto values = SortedEngine::read_file(filename);
+  auto bitmap = std::make_shared<const RoaringBitmap>(RoaringBitmap::fromSorted(*values));
+  Logger::instance() << "'" << filename << "': " << values->size() << " values take "
+                     << bitmap->memoryUsage() << " bytes as a bitmap, "
+                     << values->size() * sizeof(DataType) << " bytes as a vector\n";
+  auto result = Helpers::makeEvaluationSet(Arena::current());
+  remember(result, bitmap, true);
+  return result;
+}
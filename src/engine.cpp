@@ -1,19 +1,31 @@
 #include "engine.hpp"
 
+#include "bitmap_engine.hpp"
+#include "file_reader.hpp"
+#include "index_engine.hpp"
 #include "logger.hpp"
+#include "output_writer.hpp"
+#include "set_file.hpp"
+#include "sorted_engine.hpp"
+#include "thread_pool.hpp"
 
 #include <algorithm>
-#include <fstream>
 #include <iostream>
 
+#include <unistd.h>
+
 namespace Helpers {
 
-void printVectorToCout(const std::vector<DataType> &vec)
+void printVectorToCout(Set const &vec)
 {
+  // Anything already buffered by std::cout must go out before the values.
+  std::cout.flush();
+  OutputWriter writer(STDOUT_FILENO);
   for (auto value : vec)
   {
-    std::cout << value << std::endl;
+    writer.writeValue(value);
   }
+  writer.flush();
 }
 
 void printVectorInLine(const Set &set)
@@ -26,74 +38,487 @@ void printVectorInLine(const Set &set)
 
 }  // namespace Helpers
 
-MatchMap Engine::count_matches(const SetPtrEnsemble &sets)
+namespace {
+
+// Below this total input size splitting an operation into shards costs more than it saves.
+static constexpr size_t PARALLEL_COUNTING_THRESHOLD = 1 << 16;
+// An intersection whose smallest set is this many times smaller than the largest one is
+// computed by probing even when it could be sharded.
+static constexpr size_t PROBING_RATIO = 32;
+
+size_t total_size(const SetPtrEnsemble &sets)
 {
-  MatchMap matches;
-  size_t   total_elements_to_process = 0;
+  size_t total = 0;
   for (const auto &set : sets)
   {
-    total_elements_to_process += set->size();
+    total += set->size();
   }
-  total_processed_ += total_elements_to_process;
+  return total;
+}
+
+/// An estimate raised by its typical error, so a table sized from it is rarely grown.
+inline size_t with_margin(size_t estimate)
+{
+  return estimate + estimate / 16;
+}
 
-  // A rough estimate of an average match-count operation for
-  // large sets with dense value distribution is about half of
-  // the total elements count.
-  matches.reserve(total_elements_to_process / 2);
+/// Fibonacci hashing: the high bits of the product are well mixed even for dense values.
+inline size_t shard_of(DataType value, unsigned shard_bits)
+{
+  return size_t((uint64_t(value) * 0x9E3779B97F4A7C15ULL) >> (64 - shard_bits));
+}
+
+/// Enough shards to keep all the threads of the pool and the calling one busy.
+unsigned shard_bits_for(ThreadPool const &pool)
+{
+  unsigned shard_bits = 1;
+  while ((size_t(1) << shard_bits) < pool.size() + 1)
+  {
+    ++shard_bits;
+  }
+  return shard_bits;
+}
+
+/**
+ * @brief Counts the occurrences of the values of all the sets in shards on the thread pool.
+ * The inputs are first scattered into shards by the hash of a value, so all occurrences of a
+ * value land in the same shard. Then every shard is counted in its own match map without any
+ * locking and handed to keep_shard(shard, matches) on the same task. The tasks may run on threads
+ * of other evaluations, so they allocate from the given arena rather than the current one.
+ * @param distinct_values the estimate the match maps are sized from, a hash spreads the values
+ * evenly over the shards
+ * @return the number of distinct values
+ */
+template <typename KeepShard>
+size_t count_partitioned(ThreadPool &pool, Arena *arena, const SetPtrEnsemble &sets,
+                         size_t distinct_values, unsigned shard_bits, KeepShard keep_shard)
+{
+  const size_t shards_count = size_t(1) << shard_bits;
+
+  // Every scatter task takes an equal slice of all the inputs laid out one after another.
+  using Buckets = std::vector<Set>;
+
+  const size_t         total      = total_size(sets);
+  const size_t         slice_size = (total + shards_count - 1) / shards_count;
+  std::vector<Buckets> buckets(shards_count, Buckets(shards_count));
+  {
+    TaskLatch scattered(shards_count);
+    for (size_t task{0}; task < shards_count; ++task)
+    {
+      pool.submit([&, task] {
+        auto &       own_buckets = buckets[task];
+        const size_t first       = task * slice_size;
+        const size_t last        = std::min(total, first + slice_size);
+        for (auto &bucket : own_buckets)
+        {
+          bucket = Set(ArenaAllocator<DataType>(arena));
+          bucket.reserve((last > first ? last - first : 0) / shards_count * 5 / 4);
+        }
+        size_t offset = 0;
+        for (const auto &set : sets)
+        {
+          const size_t begin = std::max(first, offset);
+          const size_t end   = std::min(last, offset + set->size());
+          for (size_t i{begin}; i < end; ++i)
+          {
+            const DataType value = (*set)[i - offset];
+            own_buckets[shard_of(value, shard_bits)].push_back(value);
+          }
+          offset += set->size();
+        }
+        scattered.countDown();
+      });
+    }
+    scattered.wait(pool);
+  }
+
+  std::atomic<size_t> counted_values{0};
+  {
+    TaskLatch counted(shards_count);
+    for (size_t shard{0}; shard < shards_count; ++shard)
+    {
+      pool.submit([&, shard] {
+        MatchMap matches(arena);
+        matches.reserve(with_margin(distinct_values / shards_count));
+        for (auto &own_buckets : buckets)
+        {
+          for (auto value : own_buckets[shard])
+          {
+            matches.increment(value);
+          }
+          Set().swap(own_buckets[shard]);
+        }
+        keep_shard(shard, matches);
+        counted_values += matches.size();
+        counted.countDown();
+      });
+    }
+    counted.wait(pool);
+  }
+  return counted_values;
+}
+
+/**
+ * @brief Hashes the smallest set and narrows it down by probing every other set but the largest
+ * one in the order of size, until nothing is left.
+ * @param total accumulates the number of values read
+ */
+FlatHashSet narrow_candidates(std::vector<Set const *> const &by_size, size_t &total)
+{
+  FlatHashSet candidates(Arena::current());
+  candidates.reserve(by_size.front()->size());
+  for (auto value : *by_size.front())
+  {
+    candidates.insert(value);
+  }
+  total += by_size.front()->size();
+  for (size_t i{1}; i + 1 < by_size.size() && candidates.size() > 0; ++i)
+  {
+    FlatHashSet found(Arena::current());
+    found.reserve(candidates.size());
+    for (auto value : *by_size[i])
+    {
+      if (candidates.contains(value))
+      {
+        found.insert(value);
+      }
+    }
+    total += by_size[i]->size();
+    std::swap(candidates, found);
+  }
+  return candidates;
+}
+
+std::vector<Set const *> sorted_by_size(const SetPtrEnsemble &sets)
+{
+  std::vector<Set const *> by_size;
+  for (const auto &set : sets)
+  {
+    by_size.push_back(set.get());
+  }
+  std::sort(by_size.begin(), by_size.end(),
+            [](Set const *lhs, Set const *rhs) { return lhs->size() < rhs->size(); });
+  return by_size;
+}
+
+}  // namespace
+
+namespace Helpers {
+
+SetPtr makeEvaluationSet(Arena *arena)
+{
+  return std::make_shared<Set>(ArenaAllocator<DataType>(arena));
+}
+
+bool isReusable(SetPtr const &set)
+{
+  Arena *const arena = set ? set->get_allocator().arena() : nullptr;
+  return arena != nullptr && arena == Arena::current() && set.use_count() == 1;
+}
+
+SetPtr reuseInputOrMake(SetPtrEnsemble const &sets)
+{
+  SetPtr const *largest = nullptr;
+  for (auto const &set : sets)
+  {
+    if (isReusable(set) && (largest == nullptr || set->capacity() > (*largest)->capacity()))
+    {
+      largest = &set;
+    }
+  }
+  if (largest == nullptr)
+  {
+    return makeEvaluationSet(Arena::current());
+  }
+  (*largest)->clear();
+  return *largest;
+}
+
+void makeExclusive(SetPtr &set)
+{
+  if (set.use_count() > 1)
+  {
+    set = std::make_shared<Set>(*set);
+  }
+}
+
+}  // namespace Helpers
+
+void IEngine::materialize(Set &)
+{}
+
+size_t IEngine::size_of(const Set &set) const
+{
+  return set.size();
+}
+
+size_t IEngine::memory_of(const Set &set) const
+{
+  return set.capacity() * sizeof(DataType);
+}
+
+std::unique_ptr<IEngine> buildEngine(std::string const &name)
+{
+  if (name == "hash")
+  {
+    return std::unique_ptr<IEngine>(new Engine());
+  }
+  if (name == "sorted")
+  {
+    return std::unique_ptr<IEngine>(new SortedEngine());
+  }
+  if (name == "bitmap")
+  {
+    return std::unique_ptr<IEngine>(new BitmapEngine());
+  }
+  if (name == "index")
+  {
+    return std::unique_ptr<IEngine>(new IndexEngine());
+  }
+  throw std::runtime_error("unknown engine '" + name +
+                           "', expected 'hash', 'sorted', 'bitmap' or 'index'.");
+}
+
+/**
+ * @brief The statistics of the result are estimated from the ones of the inputs before the
+ * counting: the match map is sized for the distinct values of the inputs and the result for the
+ * values expected to be kept, then the result is remembered with its exact size.
+ */
+SetPtr Engine::count_and_keep_if(const SetPtrEnsemble &sets, MatchCondition condition)
+{
+  const auto    inputs          = statistics_of(sets);
+  const size_t  distinct_values = SetStatistics::distinctValues(inputs);
+  SetStatistics expected        = SetStatistics::estimate(inputs, condition);
+  SetPtr        result;
+  if (thread_pool_ != nullptr && total_size(sets) >= PARALLEL_COUNTING_THRESHOLD)
+  {
+    result = count_and_keep_if_partitioned(sets, condition, distinct_values, expected.size);
+  }
+  else
+  {
+    MatchMap matches = count_matches(sets, distinct_values);
+    result           = keep_matches_if(std::move(matches), condition,
+                                       Helpers::reuseInputOrMake(sets), expected.size);
+  }
+  expected.size = result->size();
+  statistics_.remember(result, std::move(expected));
+  return result;
+}
+
+/**
+ * @brief A parallel equivalent of keep_matches_if(count_matches(sets), condition): every shard
+ * is filtered on its own task and the shard results are concatenated.
+ */
+SetPtr Engine::count_and_keep_if_partitioned(const SetPtrEnsemble &sets, MatchCondition condition,
+                                             size_t distinct_values, size_t expected_size)
+{
+  Arena *        arena        = Arena::current();
+  const unsigned shard_bits   = shard_bits_for(*thread_pool_);
+  const size_t   shards_count = size_t(1) << shard_bits;
+  const size_t   total        = total_size(sets);
+
+  std::vector<Set> shard_results(shards_count);
+  const size_t     counted_values = count_partitioned(
+      *thread_pool_, arena, sets, distinct_values, shard_bits,
+      [&](size_t shard, MatchMap const &matches) {
+        auto &result = shard_results[shard];
+        result       = Set(ArenaAllocator<DataType>(arena));
+        result.reserve(with_margin(expected_size / shards_count));
+        matches.forEach([&](DataType value, size_t count) {
+          if (condition.accepts(count))
+          {
+            result.push_back(value);
+          }
+        });
+      });
+
+  size_t result_size = 0;
+  for (const auto &shard_result : shard_results)
+  {
+    result_size += shard_result.size();
+  }
+  // The inputs are all scattered by now, so one of them may take the result.
+  auto result = Helpers::reuseInputOrMake(sets);
+  result->reserve(result_size);
+  for (const auto &shard_result : shard_results)
+  {
+    result->insert(result->end(), shard_result.begin(), shard_result.end());
+  }
+  total_processed_ += total + counted_values;
+  return result;
+}
+
+/**
+ * @param distinct_values the estimated number of distinct values, the match map is sized for
+ */
+MatchMap Engine::count_matches(const SetPtrEnsemble &sets, size_t distinct_values)
+{
+  MatchMap matches(Arena::current());
+  total_processed_ += total_size(sets);
+  matches.reserve(with_margin(distinct_values));
 
   for (const auto &set : sets)
   {
     for (const auto &element : *set)
     {
-      ++matches[element];
+      matches.increment(element);
     }
   }
   return matches;
 }
 
-SetPtr Engine::keep_matches_if(MatchMap &&matches, std::function<bool(size_t)> condition)
+SetPtr Engine::keep_matches_if(MatchMap &&matches, MatchCondition condition, SetPtr result,
+                               size_t expected_size)
+{
+  result->reserve(std::min(with_margin(expected_size), matches.size()));
+  matches.forEach([&](DataType value, size_t count) {
+    if (condition.accepts(count))
+    {
+      result->push_back(value);
+    }
+  });
+  total_processed_ += matches.size();
+  return result;
+}
+
+/**
+ * @brief Marks every value with the bits of the leaves holding it in a single mask map, sized
+ * for the distinct values of the leaves, and keeps the values whose masks the predicate accepts.
+ * The result lies within the union of the leaves, so it is remembered with the statistics
+ * estimated for that union and its exact size.
+ */
+SetPtr Engine::keep_if_fused(const SetPtrEnsemble &sets, FusedPredicate const &predicate)
 {
-  auto result = std::make_shared<Set>();
-  result->reserve(matches.size() / 2);
-  for (const auto &match : matches)
+  const auto    inputs          = statistics_of(sets);
+  const size_t  distinct_values = SetStatistics::distinctValues(inputs);
+  SetStatistics expected =
+      SetStatistics::estimate(inputs, MatchCondition{MatchCondition::Kind::GREATER, 0});
+  FlatMaskMap  masks(Arena::current());
+  masks.reserve(with_margin(distinct_values));
+  for (size_t leaf{0}; leaf < sets.size(); ++leaf)
   {
-    if (condition(match.second))
+    const uint64_t bit = uint64_t(1) << leaf;
+    for (const auto &element : *sets[leaf])
     {
-      result->insert(match.first);
+      masks.mark(element, bit);
     }
   }
-  total_processed_ += matches.size();
+  // The leaves are all scattered by now, so one of them may take the result.
+  auto result = Helpers::reuseInputOrMake(sets);
+  result->reserve(masks.size());
+  masks.forEach([&](DataType value, uint64_t mask) {
+    if (predicate.accepts(mask))
+    {
+      result->push_back(value);
+    }
+  });
+  total_processed_ += total_size(sets) + masks.size();
+  expected.size = result->size();
+  statistics_.remember(result, std::move(expected));
   return result;
 }
 
+std::vector<StatisticsPtr> Engine::statistics_of(const SetPtrEnsemble &sets)
+{
+  std::vector<StatisticsPtr> statistics;
+  statistics.reserve(sets.size());
+  for (const auto &set : sets)
+  {
+    statistics.push_back(statistics_.of(set));
+  }
+  return statistics;
+}
+
+bool Engine::sorted_output() const
+{
+  return false;
+}
+
 size_t Engine::total_processed()
 {
   return total_processed_;
 }
 
+void Engine::set_thread_pool(ThreadPool *pool)
+{
+  thread_pool_       = pool;
+  read_options_.pool = pool;
+}
+
+void Engine::set_read_chunk_size(size_t bytes)
+{
+  read_options_.chunk_bytes = bytes;
+}
+
 SetPtr Engine::keep_if_less_than_n_matches(const SetPtrEnsemble &sets, int n)
 {
-  auto condition = [&n](size_t matches) { return matches < size_t(n); };
-  return keep_matches_if(count_matches(sets), condition);
+  return count_and_keep_if(sets, MatchCondition{MatchCondition::Kind::LESS, size_t(n)});
 }
 
 SetPtr Engine::keep_if_precisely_n_matches(const SetPtrEnsemble &sets, int n)
 {
-  auto condition = [&n](size_t matches) { return matches == size_t(n); };
-  return keep_matches_if(count_matches(sets), condition);
+  return count_and_keep_if(sets, MatchCondition{MatchCondition::Kind::EQUAL, size_t(n)});
 }
 
 SetPtr Engine::keep_if_greater_than_n_matches(const SetPtrEnsemble &sets, int n)
 {
-  auto condition = [&n](size_t matches) { return matches > size_t(n); };
-  return keep_matches_if(count_matches(sets), condition);
+  return count_and_keep_if(sets, MatchCondition{MatchCondition::Kind::GREATER, size_t(n)});
 }
 
+/**
+ * @brief Intersection of the N sets are all elements which occur in each set. Instead of
+ * counting all the elements, the smallest set is hashed and narrowed down by probing every
+ * other set in the order of size, until nothing is left. Only the candidates are hashed, so a
+ * small set intersected with large ones costs a scan of them with lookups into a small table.
+ * Inputs whose value ranges do not overlap are not read at all.
+ */
 SetPtr Engine::sets_intersection(const SetPtrEnsemble &sets)
 {
-  // Intersection of the N sets are all elements which occurs in
-  // each set, e.g. N times.
-  return keep_if_precisely_n_matches(sets, int(sets.size()));
+  if (sets.empty())
+  {
+    return Helpers::makeEvaluationSet(Arena::current());
+  }
+  const auto    inputs   = statistics_of(sets);
+  SetStatistics expected = SetStatistics::estimate(
+      inputs, MatchCondition{MatchCondition::Kind::EQUAL, sets.size()});
+  if (SetStatistics::disjoint(inputs))
+  {
+    auto result = Helpers::makeEvaluationSet(Arena::current());
+    statistics_.remember(result, std::move(expected));
+    return result;
+  }
+  const auto   by_size  = sorted_by_size(sets);
+  const size_t smallest = by_size.front()->size();
+  if (thread_pool_ != nullptr && smallest >= PARALLEL_COUNTING_THRESHOLD &&
+      by_size.back()->size() < PROBING_RATIO * smallest)
+  {
+    // Large sets of similar sizes are counted faster in shards on all the threads.
+    return keep_if_precisely_n_matches(sets, int(sets.size()));
+  }
+
+  size_t      total      = 0;
+  FlatHashSet candidates = narrow_candidates(by_size, total);
+  if (by_size.size() > 1 && candidates.size() > 0)
+  {
+    FlatHashSet found(Arena::current());
+    found.reserve(candidates.size());
+    for (auto value : *by_size.back())
+    {
+      if (candidates.contains(value))
+      {
+        found.insert(value);
+      }
+    }
+    total += by_size.back()->size();
+    std::swap(candidates, found);
+  }
+  total_processed_ += total;
+  auto result = Helpers::reuseInputOrMake(sets);
+  result->reserve(candidates.size());
+  candidates.forEach([&](DataType value) { result->push_back(value); });
+  expected.size = result->size();
+  statistics_.remember(result, std::move(expected));
+  return result;
 }
 
 SetPtr Engine::sets_difference(const SetPtrEnsemble &sets)
@@ -108,21 +533,153 @@ SetPtr Engine::sets_union(const SetPtrEnsemble &sets)
   return keep_if_greater_than_n_matches(sets, 0);
 }
 
-SetPtr Engine::read_file(const std::string filename)
+/**
+ * @brief Passes the values kept by the condition to the query instead of a result set. An
+ * intersection probes the largest set for the narrowed candidates and stops once the query is
+ * answered; EXISTS over a condition which only grows with the matches, such as a union, stops
+ * counting at the first value satisfying it.
+ */
+SetPtr Engine::query_matches_if(const SetPtrEnsemble &sets, MatchCondition condition,
+                                Query const &query)
 {
-  std::ifstream ifs;
-  ifs.open(filename, std::ifstream::in);
-  if (!ifs.is_open())
+  QueryAccumulator answer(query, false);
+  if (sets.empty() || !condition.satisfiable(sets.size()))
+  {
+    return answer.result();
+  }
+  const size_t total           = total_size(sets);
+  const auto   by_size         = sorted_by_size(sets);
+  const size_t smallest        = by_size.front()->size();
+  const bool   parallel        = thread_pool_ != nullptr && total >= PARALLEL_COUNTING_THRESHOLD;
+  const size_t distinct_values = SetStatistics::distinctValues(statistics_of(sets));
+
+  if (condition.kind == MatchCondition::Kind::EQUAL && condition.n == sets.size() &&
+      !(parallel && smallest >= PARALLEL_COUNTING_THRESHOLD &&
+        by_size.back()->size() < PROBING_RATIO * smallest))
+  {
+    size_t      read       = 0;
+    FlatHashSet candidates = narrow_candidates(by_size, read);
+    if (by_size.size() == 1)
+    {
+      candidates.forEach([&](DataType value) { answer.add(value); });
+    }
+    else if (candidates.size() > 0)
+    {
+      for (auto value : *by_size.back())
+      {
+        ++read;
+        if (candidates.contains(value) && !answer.add(value))
+        {
+          break;
+        }
+      }
+    }
+    total_processed_ += read;
+    return answer.result();
+  }
+
+  if (parallel)
+  {
+    Arena *        arena      = Arena::current();
+    const unsigned shard_bits = shard_bits_for(*thread_pool_);
+    std::vector<QueryAccumulator> parts(size_t(1) << shard_bits, answer);
+    const size_t                  counted_values = count_partitioned(
+        *thread_pool_, arena, sets, distinct_values, shard_bits,
+        [&](size_t shard, MatchMap const &matches) {
+          matches.forEach([&](DataType value, size_t count) {
+            if (condition.accepts(count))
+            {
+              parts[shard].add(value);
+            }
+          });
+        });
+    for (auto const &part : parts)
+    {
+      answer.absorb(part);
+    }
+    total_processed_ += total + counted_values;
+    return answer.result();
+  }
+
+  if (query.kind == Query::Kind::EXISTS && condition.kind == MatchCondition::Kind::GREATER)
   {
-    throw std::runtime_error("can not open '" + filename + "', nothing to process.");
+    MatchMap matches(Arena::current());
+    matches.reserve(with_margin(distinct_values));
+    size_t read = 0;
+    for (size_t i{0}; i < sets.size() && !answer.done(); ++i)
+    {
+      for (auto value : *sets[i])
+      {
+        ++read;
+        if (condition.accepts(matches.increment(value)))
+        {
+          answer.add(value);
+          break;
+        }
+      }
+    }
+    total_processed_ += read;
+    return answer.result();
   }
-  auto result = std::make_shared<Set>();
 
-  DataType value = std::numeric_limits<DataType>::min();
-  while (ifs >> value)
+  MatchMap matches = count_matches(sets, distinct_values);
+  matches.forEach([&](DataType value, size_t count) {
+    if (condition.accepts(count))
+    {
+      answer.add(value);
+    }
+  });
+  total_processed_ += matches.size();
+  return answer.result();
+}
+
+SetPtr Engine::read_file(const std::string filename)
+{
+  if (SetFile::isSetFile(filename))
+  {
+    auto result = std::make_shared<Set>(SetFile::read(filename));
+    total_processed_ += result->size();
+    statistics_.remember(result, SetStatistics::collect(*result));
+    return result;
+  }
+  auto   chunks = FileReader::readIntegerChunks(filename, Arena::current(), read_options_);
+  SetPtr result;
+  if (chunks.size() == 1)
   {
-    result->insert(value);
+    result = std::make_shared<Set>(std::move(chunks.front()));
+    // The duplicates are dropped in place, the first occurrences keep the order of the file.
+    FlatHashSet unique_values(Arena::current());
+    unique_values.reserve(result->size());
+    auto kept = result->begin();
+    for (auto value : *result)
+    {
+      if (unique_values.insert(value))
+      {
+        *kept++ = value;
+      }
+    }
+    result->erase(kept, result->end());
+    total_processed_ += result->size();
   }
-  total_processed_ += result->size();
+  else
+  {
+    // The chunks of a large file are deduplicated together like the sets of a union, every
+    // hash shard on a task of its own.
+    SetPtrEnsemble chunk_sets;
+    for (auto &chunk : chunks)
+    {
+      chunk_sets.push_back(std::make_shared<Set>(std::move(chunk)));
+    }
+    const size_t values = total_size(chunk_sets);
+    result              = count_and_keep_if_partitioned(
+        chunk_sets, MatchCondition{MatchCondition::Kind::GREATER, 0}, values, values);
+  }
+
+  SetStatistics statistics = SetStatistics::collect(*result);
+  Logger::instance() << "Statistics of '" << filename << "': " << statistics.size
+                     << " values in [" << statistics.min << ", " << statistics.max
+                     << "], density " << statistics.density() << ", about "
+                     << statistics.sketch.estimate() << " distinct\n";
+  statistics_.remember(result, std::move(statistics));
   return result;
 }
@@ -0,0 +1,176 @@
+#include "executor.hpp"
+
+#include <exception>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+
+/// Evaluation state of a single node of the graph.
+struct NodeTask
+{
+  Node *              node{nullptr};
+  std::vector<size_t> inputs;   // indices of input tasks, an input may repeat
+  std::vector<size_t> parents;  // indices of consumer tasks, one per consumed input
+  std::atomic<size_t> waiting_inputs{0};
+  std::atomic<size_t> pending_reads{0};
+  SetPtr              result{nullptr};
+};
+
+struct Evaluation
+{
+  explicit Evaluation(size_t nodes_count)
+    : tasks(nodes_count)
+    , latch(nodes_count)
+  {}
+
+  std::vector<NodeTask> tasks;
+  TaskLatch             latch;
+  std::atomic<bool>     failed{false};
+  std::mutex            error_mutex;
+  std::exception_ptr    error;
+};
+
+/**
+ * @brief Numbers all the nodes reachable from the root, inputs before their consumers.
+ */
+void collectNodes(Node *node, std::unordered_map<Node *, size_t> &indices,
+                  std::vector<Node *> &order)
+{
+  if (indices.find(node) != indices.end())
+  {
+    return;
+  }
+  for (auto const &input : node->inputs())
+  {
+    auto input_ptr = input.lock();
+    if (!input_ptr)
+    {
+      throw std::runtime_error("Unable to lock weak pointer.");
+    }
+    collectNodes(input_ptr.get(), indices, order);
+  }
+  indices[node] = order.size();
+  order.push_back(node);
+}
+
+void schedule(ThreadPool &pool, Evaluation &evaluation, size_t index);
+
+void run(ThreadPool &pool, Evaluation &evaluation, size_t index)
+{
+  auto &task = evaluation.tasks[index];
+  if (!evaluation.failed)
+  {
+    try
+    {
+      SetPtrEnsemble inputs;
+      inputs.reserve(task.inputs.size());
+      for (auto input : task.inputs)
+      {
+        inputs.push_back(evaluation.tasks[input].result);
+      }
+      // An input result is released as soon as the last of its consumers has taken it.
+      for (auto input : task.inputs)
+      {
+        if (--evaluation.tasks[input].pending_reads == 0)
+        {
+          evaluation.tasks[input].result.reset();
+        }
+      }
+      task.result = task.node->execute(inputs);
+    }
+    catch (...)
+    {
+      std::lock_guard<std::mutex> lock(evaluation.error_mutex);
+      if (!evaluation.error)
+      {
+        evaluation.error = std::current_exception();
+      }
+      evaluation.failed = true;
+    }
+  }
+  // After a failure the remaining nodes are only walked through, so the latch is released.
+  for (auto parent : task.parents)
+  {
+    if (--evaluation.tasks[parent].waiting_inputs == 0)
+    {
+      schedule(pool, evaluation, parent);
+    }
+  }
+  evaluation.latch.countDown();
+}
+
+void schedule(ThreadPool &pool, Evaluation &evaluation, size_t index)
+{
+  Evaluation *state = &evaluation;
+  Arena *     arena = Arena::current();
+  pool.submit([&pool, state, index, arena] {
+    // The node allocates from the arena of its own evaluation on whatever thread it runs.
+    ArenaScope scope(arena);
+    run(pool, *state, index);
+  });
+}
+
+}  // namespace
+
+ParallelExecutor::ParallelExecutor(ThreadPool &pool)
+  : pool_(pool)
+{}
+
+SetPtr ParallelExecutor::evaluate(std::shared_ptr<Node> const &root)
+{
+  return evaluate(std::vector<std::shared_ptr<Node>>{root}).front();
+}
+
+std::vector<SetPtr> ParallelExecutor::evaluate(std::vector<std::shared_ptr<Node>> const &roots)
+{
+  std::unordered_map<Node *, size_t> indices;
+  std::vector<Node *>                order;
+  for (auto const &root : roots)
+  {
+    collectNodes(root.get(), indices, order);
+  }
+
+  Evaluation evaluation(order.size());
+  for (size_t i{0}; i < order.size(); ++i)
+  {
+    auto &task = evaluation.tasks[i];
+    task.node  = order[i];
+    for (auto const &input : order[i]->inputs())
+    {
+      const size_t input_index = indices.at(input.lock().get());
+      task.inputs.push_back(input_index);
+      evaluation.tasks[input_index].parents.push_back(i);
+    }
+    task.waiting_inputs = task.inputs.size();
+  }
+  for (auto &task : evaluation.tasks)
+  {
+    task.pending_reads = task.parents.size();
+  }
+  // The result of a root is kept for the caller even when other nodes read it as well.
+  for (auto const &root : roots)
+  {
+    ++evaluation.tasks[indices.at(root.get())].pending_reads;
+  }
+
+  for (size_t i{0}; i < order.size(); ++i)
+  {
+    if (evaluation.tasks[i].inputs.empty())
+    {
+      schedule(pool_, evaluation, i);
+    }
+  }
+  evaluation.latch.wait(pool_);
+
+  if (evaluation.error)
+  {
+    std::rethrow_exception(evaluation.error);
+  }
+  std::vector<SetPtr> results;
+  for (auto const &root : roots)
+  {
+    results.push_back(evaluation.tasks[indices.at(root.get())].result);
+  }
+  return results;
+}
@@ -1,14 +1,32 @@
 #include "expression.hpp"
 
+#include "executor.hpp"
+#include "incremental_evaluator.hpp"
 #include "lexer.hpp"
+#include "optimizer.hpp"
 
+#include <algorithm>
+#include <functional>
 #include <iostream>
 #include <limits>
 #include <set>
+#include <unordered_map>
 #include <vector>
 
 static constexpr auto PARAM_SEPARATOR{"|"};
 
+namespace {
+
+/// A result of an evaluation along with the arena it was allocated from, which is shared by all
+/// the results of the evaluation.
+struct EvaluationResult
+{
+  std::shared_ptr<Arena> arena;
+  SetPtr                 set;  // released before the arena
+};
+
+}  // namespace
+
 Expression::Expression(IEngine &engine)
   : engine_(engine)
 {}
@@ -29,6 +47,30 @@ void Expression::buildFromTokens(std::vector<Token> const &tokens)
   {
     throw std::runtime_error("Attempt to build an Expression which is already built.");
   }
+  this->setOutputNodeName(parseTokens(tokens));
+  this->compile();
+}
+
+void Expression::buildFromUserInputs(const std::vector<std::string> &inputs)
+{
+  if (is_compiled_)
+  {
+    throw std::runtime_error("Attempt to build an Expression which is already built.");
+  }
+  if (inputs.empty())
+  {
+    throw std::runtime_error("No expressions to build.");
+  }
+  output_node_names_.clear();
+  for (auto const &input : inputs)
+  {
+    output_node_names_.push_back(parseTokens(Lexer::parseUserInput(input)));
+  }
+  this->compile();
+}
+
+std::string Expression::parseTokens(std::vector<Token> const &tokens)
+{
   Logger &log{Logger::instance()};
   using NodePtr                = Expression::NodePtrType;
   using NodeBuffer             = std::vector<NodePtr>;
@@ -38,8 +80,6 @@ void Expression::buildFromTokens(std::vector<Token> const &tokens)
   std::vector<Token> stack;
   stack.reserve(tokens.size());
 
-  size_t node_counter = 0;
-
   NodeMatrix unlinked_nodes;
   size_t     depth = 0;
   log << "Parsing expression : "
@@ -107,7 +147,7 @@ void Expression::buildFromTokens(std::vector<Token> const &tokens)
       // per one filename is allowed to prevent duplicating of huge file caches.
       std::string node_name =
           op->description() + "_" + stack.back().value +
-          (op->type() == OperationType::FILEREADER ? "" : ("_" + std::to_string(node_counter)));
+          (op->type() == OperationType::FILEREADER ? "" : ("_" + std::to_string(node_counter_)));
 
       if (this->contains(node_name))
       {
@@ -119,7 +159,7 @@ void Expression::buildFromTokens(std::vector<Token> const &tokens)
         new_nodes.emplace_back(std::make_shared<Node>(op, node_name));
         this->insertNode(node_name, new_nodes.back());
         log << "  Created node " << node_name << "\n";
-        ++node_counter;
+        ++node_counter_;
       }
       stack.pop_back();
     }
@@ -186,19 +226,18 @@ void Expression::buildFromTokens(std::vector<Token> const &tokens)
     log << "Expression depth changed : " << depth << "\n";
   }
 
-  if (stack.empty())
-  {
-    log << "Parsing finished successfuly, created a Graph with " << node_counter << " nodes."
-        << "\n";
-
-    this->setOutputNodeName(unlinked_nodes.front().back()->name());
-    this->compile();
-  }
-  else
+  if (!stack.empty())
   {
     throw std::runtime_error("Input parsing failed! Unparsed/invalid input lexem : " +
                              stack.back().value);
   }
+  if (unlinked_nodes.empty() || unlinked_nodes.front().empty())
+  {
+    throw std::runtime_error("Input parsing failed! The expression is empty.");
+  }
+  log << "Parsing finished successfuly, created a Graph with " << node_counter_ << " nodes."
+      << "\n";
+  return unlinked_nodes.front().back()->name();
 }
 
 /**
@@ -211,7 +250,7 @@ OpPtr Expression::buildOperationFromToken(Token const &token)
   switch (token.lexem)
   {
   case Lexem::FILENAME:
-    return buildOperation(engine_, OperationType::FILEREADER, token.value);
+    return buildOperation(engine_, OperationType::FILEREADER, token.value, set_cache_);
   case Lexem::INT:
     return buildOperation(engine_, OperationType::INTERSECTION);
   case Lexem::DIFF:
@@ -227,6 +266,22 @@ OpPtr Expression::buildOperationFromToken(Token const &token)
   case Lexem::GR:
     return buildOperation(engine_, OperationType::KEEP_IF_MORE_THAN_N_MATCHES,
                           std::stoi(token.value.substr(token.value.find(PARAM_SEPARATOR) + 1)));
+  case Lexem::COUNT:
+    return buildOperation(engine_, OperationType::QUERY, Query{Query::Kind::COUNT, 1});
+  case Lexem::MIN:
+    return buildOperation(engine_, OperationType::QUERY, Query{Query::Kind::MIN, 1});
+  case Lexem::MAX:
+    return buildOperation(engine_, OperationType::QUERY, Query{Query::Kind::MAX, 1});
+  case Lexem::EXISTS:
+    return buildOperation(engine_, OperationType::QUERY, Query{Query::Kind::EXISTS, 1});
+  case Lexem::TOP:
+  case Lexem::BOTTOM: {
+    const int k = std::stoi(token.value.substr(token.value.find(PARAM_SEPARATOR) + 1));
+    return buildOperation(
+        engine_, OperationType::QUERY,
+        Query{token.lexem == Lexem::TOP ? Query::Kind::TOP : Query::Kind::BOTTOM,
+              size_t(std::max(k, 0))});
+  }
   default: {
     Logger &log_{Logger::instance()};
     log_ << "Error: unknown token ( " << token.value
@@ -250,22 +305,433 @@ void Expression::compile()
     auto node_inputs = connection.second;
     linkNodesInGraph(node_name, node_inputs);
   }
+  if (plan_output_ != nullptr)
+  {
+    *plan_output_ << "Plan as written:\n";
+    for (auto const &name : output_node_names_)
+    {
+      Optimizer::printPlan(*nodes_.at(name), *plan_output_);
+    }
+  }
+  if (optimization_enabled_)
+  {
+    output_node_names_ = Optimizer(engine_, nodes_).optimize(output_node_names_);
+  }
+  eliminateCommonSubexpressions();
+  pushDownQuery();
+  if (fusion_enabled_)
+  {
+    fuseCountingOperations();
+  }
+  countConsumers();
+  if (plan_output_ != nullptr)
+  {
+    *plan_output_ << "Plan to evaluate:\n";
+    for (auto const &name : output_node_names_)
+    {
+      Optimizer::printPlan(*nodes_.at(name), *plan_output_);
+    }
+  }
   is_compiled_ = true;
 }
 
+/**
+ * Collapses structurally identical subtrees into a single node, so every distinct subexpression
+ * is computed only once. Two nodes are identical if they have equal operation signatures and
+ * identical inputs; the order of inputs does not matter, as every operation is symmetric.
+ */
+void Expression::eliminateCommonSubexpressions()
+{
+  std::map<std::string, NodePtrType>            canonical_by_structure;
+  std::unordered_map<Node const *, NodePtrType> canonical_nodes;
+  std::unordered_map<Node const *, size_t>      canonical_ids;
+
+  std::function<NodePtrType(NodePtrType const &)> canonicalize =
+      [&](NodePtrType const &node) -> NodePtrType {
+    auto const known = canonical_nodes.find(node.get());
+    if (known != canonical_nodes.end())
+    {
+      return known->second;
+    }
+    std::vector<Node::NodeWeakPtr> inputs;
+    std::vector<size_t>            input_ids;
+    for (auto const &input : node->inputs())
+    {
+      auto input_ptr = input.lock();
+      if (!input_ptr)
+      {
+        throw std::runtime_error("Unable to lock weak pointer.");
+      }
+      auto canonical_input = canonicalize(input_ptr);
+      inputs.emplace_back(canonical_input);
+      input_ids.push_back(canonical_ids.at(canonical_input.get()));
+    }
+    std::sort(input_ids.begin(), input_ids.end());
+
+    std::string structure = node->signature() + PARAM_SEPARATOR;
+    for (auto id : input_ids)
+    {
+      structure += std::to_string(id) + " ";
+    }
+
+    auto inserted = canonical_by_structure.emplace(structure, node);
+    if (inserted.second)
+    {
+      node->setInputs(inputs);
+      const size_t id           = canonical_ids.size();
+      canonical_ids[node.get()] = id;
+    }
+    canonical_nodes[node.get()] = inserted.first->second;
+    return inserted.first->second;
+  };
+
+  // All the nodes must be canonicalized before any of duplicates is dropped, as the inputs of a
+  // node are only redirected to the canonical ones when the node itself is canonicalized.
+  for (auto const &node : nodes_)
+  {
+    canonicalize(node.second);
+  }
+
+  size_t eliminated = 0;
+  for (auto it = nodes_.begin(); it != nodes_.end();)
+  {
+    auto const &canonical = canonical_nodes.at(it->second.get());
+    if (canonical != it->second)
+    {
+      log_ << "Node " << it->first << " is the same as " << canonical->name() << ", removed.\n";
+      std::replace(output_node_names_.begin(), output_node_names_.end(), it->first,
+                   canonical->name());
+      it = nodes_.erase(it);
+      ++eliminated;
+    }
+    else
+    {
+      ++it;
+    }
+  }
+  log_ << "Eliminated " << eliminated << " common subexpressions.\n";
+}
+
+/**
+ * A query may only be asked about a whole expression. When its input is a counting operation read
+ * by nothing else, the query node takes the operation over, so the engine answers the query
+ * without building the result of the operation.
+ */
+void Expression::pushDownQuery()
+{
+  const std::set<std::string> outputs(output_node_names_.begin(), output_node_names_.end());
+  std::map<std::string, size_t> reads;
+  for (auto const &node : nodes_)
+  {
+    if (node.second->operationType() == OperationType::QUERY && outputs.count(node.first) == 0)
+    {
+      throw std::runtime_error("A query can only be the outermost operation of an expression.");
+    }
+    for (auto const &input : node.second->inputs())
+    {
+      if (auto input_ptr = input.lock())
+      {
+        ++reads[input_ptr->name()];
+      }
+    }
+  }
+  for (auto const &output : outputs)
+  {
+    ++reads[output];
+  }
+
+  for (auto const &output : outputs)
+  {
+    auto const root = nodes_.at(output);
+    if (root->operationType() != OperationType::QUERY)
+    {
+      continue;
+    }
+    auto const &query = static_cast<OpQuery const &>(root->operation()).query();
+    if (root->inputs().size() != 1)
+    {
+      throw std::runtime_error("Query " + query.description() + " takes a single input, got " +
+                               std::to_string(root->inputs().size()) + ".");
+    }
+    auto const     input = root->inputs().front().lock();
+    MatchCondition condition{MatchCondition::Kind::GREATER, 0};
+    if (!input || reads[input->name()] > 1 ||
+        !input->operation().matchCondition(input->inputs().size(), condition))
+    {
+      continue;
+    }
+
+    auto operation = std::make_shared<OpQuery>(engine_, query);
+    operation->pushDown(input->operation(), input->inputs().size());
+    auto pushed_down = std::make_shared<Node>(operation, output);
+    pushed_down->setInputs(input->inputs());
+    nodes_[output] = pushed_down;
+    nodes_.erase(input->name());
+    log_ << "Query " << query.description() << " is pushed down into " << input->name() << ".\n";
+  }
+}
+
+/**
+ * Replaces every tree of nested counting operations by a single FUSED node over the leaves of
+ * the tree. A counting operation becomes a part of the tree of its reader if it is a counting
+ * operation as well and nothing else reads the result, which is never built then; any other
+ * input is a leaf. Trees of a single operation, or too large for a leaf mask, are kept as they
+ * are.
+ */
+void Expression::fuseCountingOperations()
+{
+  const auto is_counting = [](Node const &node) {
+    MatchCondition condition{MatchCondition::Kind::GREATER, 0};
+    return node.operation().matchCondition(node.inputs().size(), condition);
+  };
+  std::unordered_map<Node const *, size_t> reads;
+  for (auto const &node : nodes_)
+  {
+    for (auto const &input : node.second->inputs())
+    {
+      ++reads[input.lock().get()];
+    }
+  }
+  for (auto const &output : output_node_names_)
+  {
+    ++reads[nodes_.at(output).get()];
+  }
+  std::set<Node const *> inner;
+  for (auto const &node : nodes_)
+  {
+    if (!is_counting(*node.second))
+    {
+      continue;
+    }
+    for (auto const &input : node.second->inputs())
+    {
+      auto const input_ptr = input.lock();
+      if (is_counting(*input_ptr) && reads[input_ptr.get()] == 1)
+      {
+        inner.insert(input_ptr.get());
+      }
+    }
+  }
+
+  std::unordered_map<Node const *, NodePtrType> fused;
+  std::vector<NodePtrType>                      replaced;  // alive until nobody reads them
+  std::vector<std::string>                      removed;
+  for (auto const &node : nodes_)
+  {
+    if (!is_counting(*node.second) || inner.count(node.second.get()) > 0)
+    {
+      continue;
+    }
+    std::vector<FusedPredicate::Term>          terms;
+    std::vector<NodePtrType>                   leaves;
+    std::unordered_map<Node const *, size_t>   leaf_indices;
+    std::vector<std::string>                   tree;  // the inner operations
+    std::function<size_t(NodePtrType const &)> add_term = [&](NodePtrType const &term_node) {
+      FusedPredicate::Term term{MatchCondition{MatchCondition::Kind::GREATER, 0}, {}, {}};
+      term_node->operation().matchCondition(term_node->inputs().size(), term.condition);
+      for (auto const &input : term_node->inputs())
+      {
+        auto const input_ptr = input.lock();
+        if (inner.count(input_ptr.get()) > 0)
+        {
+          term.terms.push_back(add_term(input_ptr));
+          tree.push_back(input_ptr->name());
+          continue;
+        }
+        auto const leaf = leaf_indices.emplace(input_ptr.get(), leaves.size());
+        if (leaf.second)
+        {
+          leaves.push_back(input_ptr);
+        }
+        term.leaves.push_back(leaf.first->second);
+      }
+      terms.push_back(term);
+      return terms.size() - 1;
+    };
+    add_term(node.second);
+    if (terms.size() < 2 || terms.size() > FusedPredicate::MAX_TERMS ||
+        leaves.size() > FusedPredicate::MAX_LEAVES)
+    {
+      continue;
+    }
+
+    auto fused_node = std::make_shared<Node>(
+        buildOperation(engine_, OperationType::FUSED, FusedPredicate(leaves.size(), terms)),
+        node.first);
+    fused_node->setInputs(std::vector<Node::NodeWeakPtr>(leaves.begin(), leaves.end()));
+    fused[node.second.get()] = fused_node;
+    replaced.push_back(node.second);
+    removed.insert(removed.end(), tree.begin(), tree.end());
+    log_ << "Fused " << terms.size() << " counting operations under " << node.first << " over "
+         << leaves.size() << " leaves.\n";
+  }
+  if (fused.empty())
+  {
+    return;
+  }
+
+  // The nodes reading a replaced one, including the other fused nodes, read its replacement.
+  for (auto &node : nodes_)
+  {
+    auto const replacement = fused.find(node.second.get());
+    if (replacement != fused.end())
+    {
+      node.second = replacement->second;
+    }
+  }
+  for (auto const &name : removed)
+  {
+    nodes_.erase(name);
+  }
+  for (auto &node : nodes_)
+  {
+    std::vector<Node::NodeWeakPtr> inputs;
+    for (auto const &input : node.second->inputs())
+    {
+      auto const replacement = fused.find(input.lock().get());
+      inputs.push_back(replacement != fused.end() ? Node::NodeWeakPtr(replacement->second)
+                                                  : input);
+    }
+    node.second->setInputs(inputs);
+  }
+}
+
+/**
+ * Counts how many times every node's result is read per evaluation: by the other nodes, and once
+ * more by the caller of every output.
+ */
+void Expression::countConsumers()
+{
+  for (auto &node : nodes_)
+  {
+    node.second->resetConsumers();
+  }
+  for (auto const &output : output_node_names_)
+  {
+    nodes_.at(output)->addConsumer();
+  }
+  for (auto &node : nodes_)
+  {
+    for (auto const &input : node.second->inputs())
+    {
+      if (auto input_ptr = input.lock())
+      {
+        input_ptr->addConsumer();
+      }
+    }
+  }
+}
+
+void Expression::resetCaches()
+{
+  for (auto &node : nodes_)
+  {
+    node.second->resetCache();
+  }
+}
+
 /**
  * Evaluates the output of a node (calling all necessary evaluations)
  * @param node_name name of node to evaluate for output
- * @return a copy of the output tensor
+ * @return the output set itself, no copy is made
  */
-Set Expression::evaluate(std::string const &node_name)
+SetPtr Expression::evaluateShared(std::string const &node_name)
 {
   if (nodes_.find(node_name) == nodes_.end())
   {
     throw std::runtime_error("Cannot evaluate: node [" + node_name + "] not in graph");
   }
-  auto ret = (*(nodes_[node_name]->evaluate()));
-  return ret;
+  return evaluateShared(std::vector<NodePtrType>{nodes_[node_name]}).front();
+}
+
+std::vector<SetPtr> Expression::evaluateAllShared()
+{
+  std::vector<NodePtrType> roots;
+  for (auto const &name : output_node_names_)
+  {
+    if (nodes_.find(name) == nodes_.end())
+    {
+      throw std::runtime_error("Cannot evaluate: node [" + name + "] not in graph");
+    }
+    roots.push_back(nodes_[name]);
+  }
+  return evaluateShared(roots);
+}
+
+std::vector<SetPtr> Expression::evaluateShared(std::vector<NodePtrType> const &roots)
+{
+  // Everything the engine allocates during the evaluation is released at once with the arena,
+  // which lives on only as long as the results.
+  auto                arena = std::make_shared<Arena>(true);
+  std::vector<SetPtr> sets;
+  {
+    ArenaScope scope(arena.get());
+    if (thread_pool_ != nullptr)
+    {
+      ParallelExecutor executor(*thread_pool_);
+      sets = executor.evaluate(roots);
+    }
+    else
+    {
+      resetCaches();
+      try
+      {
+        for (auto const &root : roots)
+        {
+          sets.push_back(root->evaluate());
+        }
+      }
+      catch (...)
+      {
+        resetCaches();
+        throw;
+      }
+      resetCaches();
+    }
+    // The outputs are read by anyone from here on, so their values go into the sets.
+    for (auto const &set : sets)
+    {
+      engine_.materialize(*set);
+    }
+  }
+  const auto statistics = arena->statistics();
+  log_ << "Arena: " << statistics.allocations << " allocations (" << statistics.reused
+       << " reused) served by " << statistics.system_allocations << " system allocations, "
+       << statistics.reserved_bytes << " bytes reserved.\n";
+
+  // A set on the heap, e.g. one of a file cache, needs no arena. The outputs computed by the
+  // same node get the same handle, so the set is seen shared by them.
+  std::vector<SetPtr>                   results;
+  std::unordered_map<Set const *, SetPtr> handles;
+  for (auto &set : sets)
+  {
+    if (set->get_allocator().arena() == nullptr)
+    {
+      results.push_back(std::move(set));
+      continue;
+    }
+    auto &handle = handles[set.get()];
+    if (!handle)
+    {
+      auto evaluation = std::make_shared<EvaluationResult>();
+      evaluation->arena = arena;
+      evaluation->set   = set;
+      handle            = SetPtr(evaluation, set.get());
+    }
+    results.push_back(handle);
+    set.reset();
+  }
+  return results;
+}
+
+SetPtr Expression::evaluateShared()
+{
+  return evaluateShared(outputNodeName());
+}
+
+Set Expression::evaluate(std::string const &node_name)
+{
+  return *evaluateShared(node_name);
 }
 
 /**
@@ -277,6 +743,28 @@ Set Expression::evaluate()
   return evaluate(outputNodeName());
 }
 
+ValueStreamPtr Expression::stream(const StreamOptions &options)
+{
+  if (nodes_.find(outputNodeName()) == nodes_.end())
+  {
+    throw std::runtime_error("Cannot stream: node [" + outputNodeName() + "] not in graph");
+  }
+  return nodes_[outputNodeName()]->stream(options);
+}
+
+SetPtr Expression::evaluateIncremental(const std::string &state_dir)
+{
+  if (nodes_.find(outputNodeName()) == nodes_.end())
+  {
+    throw std::runtime_error("Cannot evaluate: node [" + outputNodeName() + "] not in graph");
+  }
+  IncrementalEvaluator evaluator(state_dir, *nodes_[outputNodeName()]);
+  auto                 result = evaluator.evaluate();
+  log_ << evaluator.changedFiles() << " files changed by " << evaluator.changedValues()
+       << " values since the last evaluation.\n";
+  return result;
+}
+
 /**
  * Method for directly inserting nodes to graph
  * @param node_name
@@ -329,10 +817,40 @@ void Expression::linkNodesInGraph(std::string const &             node_name,
 
 std::string Expression::outputNodeName() const
 {
-  return output_node_name_;
+  return output_node_names_.empty() ? std::string{} : output_node_names_.front();
 }
 
 void Expression::setOutputNodeName(const std::string &outputNodeName)
 {
-  output_node_name_ = outputNodeName;
+  output_node_names_ = {outputNodeName};
+}
+
+const std::vector<std::string> &Expression::outputNodeNames() const
+{
+  return output_node_names_;
+}
+
+void Expression::setThreadPool(ThreadPool *pool)
+{
+  thread_pool_ = pool;
+}
+
+void Expression::setSetCache(SetCache *set_cache)
+{
+  set_cache_ = set_cache;
+}
+
+void Expression::setOptimization(bool enabled)
+{
+  optimization_enabled_ = enabled;
+}
+
+void Expression::setFusion(bool enabled)
+{
+  fusion_enabled_ = enabled;
+}
+
+void Expression::setPlanOutput(std::ostream *output)
+{
+  plan_output_ = output;
 }
@@ -0,0 +1,318 @@
+#include "file_reader.hpp"
+
+#include "logger.hpp"
+#include "mapped_file.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+static constexpr size_t MAX_SIGNIFICANT_DIGITS = 19;  // Any 19-digit number fits into uint64_t
+static constexpr size_t MAX_QUOTED_LINE_LENGTH = 32;
+
+inline bool isDigit(char c)
+{
+  return static_cast<unsigned char>(c - '0') < 10;
+}
+
+inline bool isBlank(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define SCALC_SWAR_DIGITS 1
+
+inline uint64_t loadEightBytes(const char *chars)
+{
+  uint64_t value;
+  std::memcpy(&value, chars, sizeof(value));
+  return value;
+}
+
+/// Checks all 8 bytes of a word are ASCII digits at once.
+inline bool areEightDigits(uint64_t chars)
+{
+  return ((chars & 0xF0F0F0F0F0F0F0F0) |
+          (((chars + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) == 0x3333333333333333;
+}
+
+/// Converts 8 ASCII digits to a number with 3 multiplications instead of 8 (SWAR technique).
+inline uint64_t parseEightDigits(uint64_t chars)
+{
+  static constexpr uint64_t MASK = 0x000000FF000000FF;
+  static constexpr uint64_t MUL1 = 100 + (1000000ULL << 32);
+  static constexpr uint64_t MUL2 = 1 + (10000ULL << 32);
+  chars -= 0x3030303030303030;
+  chars = (chars * 10) + (chars >> 8);
+  return (((chars & MASK) * MUL1) + (((chars >> 16) & MASK) * MUL2)) >> 32;
+}
+#endif
+
+[[noreturn]] void throwMalformedLine(std::string const &source_name, size_t line_number,
+                                     const char *line_begin, const char *end,
+                                     std::string const &reason)
+{
+  const char *line_end = std::find(line_begin, end, '\n');
+  if (size_t(line_end - line_begin) > MAX_QUOTED_LINE_LENGTH)
+  {
+    line_end = line_begin + MAX_QUOTED_LINE_LENGTH;
+  }
+  throw std::runtime_error("malformed line " + std::to_string(line_number) + " in '" +
+                           source_name + "': " + reason + ", got '" +
+                           std::string(line_begin, line_end) + "'.");
+}
+
+/// Splits the buffer into chunks of about chunk_bytes, every one but the last ending right after
+/// a newline, so no line is split.
+std::vector<const char *> chunkBoundaries(const char *begin, const char *end, size_t chunk_bytes)
+{
+  std::vector<const char *> boundaries{begin};
+  while (size_t(end - boundaries.back()) > chunk_bytes)
+  {
+    const char *target  = boundaries.back() + chunk_bytes;
+    const void *newline = std::memchr(target, '\n', size_t(end - target));
+    if (newline == nullptr || static_cast<const char *>(newline) + 1 == end)
+    {
+      break;
+    }
+    boundaries.push_back(static_cast<const char *>(newline) + 1);
+  }
+  boundaries.push_back(end);
+  return boundaries;
+}
+
+/// Runs task(chunk) for every chunk on the pool, or on the calling thread without one.
+template <typename Task>
+void forEachChunk(ThreadPool *pool, size_t chunks, Task task)
+{
+  if (pool == nullptr || chunks == 1)
+  {
+    for (size_t chunk{0}; chunk < chunks; ++chunk)
+    {
+      task(chunk);
+    }
+    return;
+  }
+  TaskLatch done(chunks);
+  for (size_t chunk{0}; chunk < chunks; ++chunk)
+  {
+    pool->submit([&, chunk] {
+      task(chunk);
+      done.countDown();
+    });
+  }
+  done.wait(*pool);
+}
+
+/**
+ * @brief Parses the chunks of the file concurrently, each into a set of its own. The newlines of
+ * every chunk are counted first: the counts size the sets and number the lines of the chunks,
+ * so a malformed line is reported as if the file was parsed at once.
+ */
+std::vector<Set> parseChunks(MappedFile const &file, std::string const &filename, Arena *arena,
+                             FileReader::ReadOptions const &options)
+{
+  const auto   boundaries = chunkBoundaries(file.begin(), file.end(), options.chunk_bytes);
+  const size_t chunks     = boundaries.size() - 1;
+
+  std::vector<size_t> newlines(chunks, 0);
+  forEachChunk(options.pool, chunks, [&](size_t chunk) {
+    newlines[chunk] = size_t(std::count(boundaries[chunk], boundaries[chunk + 1], '\n'));
+  });
+
+  std::vector<size_t> first_lines(chunks, 1);
+  for (size_t chunk{1}; chunk < chunks; ++chunk)
+  {
+    first_lines[chunk] = first_lines[chunk - 1] + newlines[chunk - 1];
+  }
+  // Copies of a prototype set would get the heap allocator, so every set is made on its own.
+  std::vector<Set> values;
+  values.reserve(chunks);
+  for (size_t chunk{0}; chunk < chunks; ++chunk)
+  {
+    values.emplace_back(ArenaAllocator<DataType>(arena));
+  }
+  std::vector<std::exception_ptr> errors(chunks);
+  forEachChunk(options.pool, chunks, [&](size_t chunk) {
+    try
+    {
+      // Every non-empty line holds one value, so the line count is an exact upper bound.
+      values[chunk].reserve(newlines[chunk] + 1);
+      FileReader::parseIntegers(boundaries[chunk], boundaries[chunk + 1], values[chunk],
+                                filename, first_lines[chunk]);
+    }
+    catch (...)
+    {
+      errors[chunk] = std::current_exception();
+    }
+  });
+  for (auto const &error : errors)
+  {
+    if (error)
+    {
+      std::rethrow_exception(error);
+    }
+  }
+  return values;
+}
+
+void logThroughput(std::string const &filename, size_t values, size_t bytes, size_t chunks,
+                   std::chrono::steady_clock::time_point start)
+{
+  auto       end          = std::chrono::steady_clock::now();
+  const auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+  Logger::instance() << "Read " << values << " values from '" << filename << "' (" << bytes
+                     << " bytes, " << chunks << " chunks) in " << microseconds.count() / 1000.0
+                     << " ms, "
+                     << (microseconds.count() > 0 ? double(bytes) / microseconds.count() : 0.0)
+                     << " MB/s\n";
+}
+
+}  // namespace
+
+namespace FileReader {
+
+void parseIntegers(const char *begin, const char *end, Set &output,
+                   std::string const &source_name, size_t first_line_number)
+{
+  size_t      line_number = first_line_number;
+  const char *cursor      = begin;
+  while (cursor < end)
+  {
+    const char *line_begin = cursor;
+    while (cursor < end && isBlank(*cursor))
+    {
+      ++cursor;
+    }
+    if (cursor == end)
+    {
+      break;
+    }
+    if (*cursor == '\n')
+    {
+      ++cursor;
+      ++line_number;
+      continue;
+    }
+
+    const bool negative = *cursor == '-';
+    if (negative || *cursor == '+')
+    {
+      ++cursor;
+    }
+    const char *digits_begin = cursor;
+    while (cursor < end && *cursor == '0')
+    {
+      ++cursor;
+    }
+    const char *significant_begin = cursor;
+
+    uint64_t value = 0;
+#ifdef SCALC_SWAR_DIGITS
+    while (end - cursor >= 8)
+    {
+      const uint64_t chars = loadEightBytes(cursor);
+      if (!areEightDigits(chars))
+      {
+        break;
+      }
+      value = value * 100000000 + parseEightDigits(chars);
+      cursor += 8;
+      if (size_t(cursor - significant_begin) > MAX_SIGNIFICANT_DIGITS - 8)
+      {
+        break;
+      }
+    }
+#endif
+    while (cursor < end && isDigit(*cursor) &&
+           size_t(cursor - significant_begin) < MAX_SIGNIFICANT_DIGITS)
+    {
+      value = value * 10 + uint64_t(*cursor - '0');
+      ++cursor;
+    }
+
+    if (cursor == digits_begin)
+    {
+      throwMalformedLine(source_name, line_number, line_begin, end, "expected an integer");
+    }
+    const uint64_t limit =
+        uint64_t(std::numeric_limits<DataType>::max()) + (negative ? 1 : 0);
+    if ((cursor < end && isDigit(*cursor)) || value > limit)
+    {
+      throwMalformedLine(source_name, line_number, line_begin, end,
+                         "the integer does not fit into 64 bits");
+    }
+
+    while (cursor < end && isBlank(*cursor))
+    {
+      ++cursor;
+    }
+    if (cursor < end && *cursor != '\n')
+    {
+      throwMalformedLine(source_name, line_number, line_begin, end,
+                         "expected a single integer per line");
+    }
+    output.push_back(negative ? DataType(0 - value) : DataType(value));
+  }
+}
+
+Set readIntegers(std::string const &filename, Arena *arena, ReadOptions const &options)
+{
+  auto start = std::chrono::steady_clock::now();
+
+  const MappedFile file(filename);
+  Set              values{ArenaAllocator<DataType>(arena)};
+  if (options.pool == nullptr || file.size() < 2 * options.chunk_bytes)
+  {
+    // Every non-empty line holds one value, so the line count is an exact upper bound.
+    values.reserve(size_t(std::count(file.begin(), file.end(), '\n')) + 1);
+    parseIntegers(file.begin(), file.end(), values, filename);
+    logThroughput(filename, values.size(), file.size(), 1, start);
+    return values;
+  }
+
+  // The chunks are temporary, so they are kept on the heap.
+  const auto          chunks = parseChunks(file, filename, nullptr, options);
+  std::vector<size_t> offsets(chunks.size() + 1, 0);
+  for (size_t chunk{0}; chunk < chunks.size(); ++chunk)
+  {
+    offsets[chunk + 1] = offsets[chunk] + chunks[chunk].size();
+  }
+  values.resize(offsets.back());
+  // The chunks are copied into their places of the result concurrently as well.
+  forEachChunk(options.pool, chunks.size(), [&](size_t chunk) {
+    std::copy(chunks[chunk].begin(), chunks[chunk].end(), values.begin() + offsets[chunk]);
+  });
+  logThroughput(filename, values.size(), file.size(), chunks.size(), start);
+  return values;
+}
+
+std::vector<Set> readIntegerChunks(std::string const &filename, Arena *arena,
+                                   ReadOptions const &options)
+{
+  auto start = std::chrono::steady_clock::now();
+
+  const MappedFile file(filename);
+  ReadOptions      chunking = options;
+  if (options.pool == nullptr || file.size() < 2 * options.chunk_bytes)
+  {
+    chunking.chunk_bytes = std::max(file.size(), size_t(1));
+  }
+  auto   chunks = parseChunks(file, filename, arena, chunking);
+  size_t count  = 0;
+  for (auto const &chunk : chunks)
+  {
+    count += chunk.size();
+  }
+  logThroughput(filename, count, file.size(), chunks.size(), start);
+  return chunks;
+}
+
+}  // namespace FileReader
@@ -0,0 +1,122 @@
+#include "fused_predicate.hpp"
+
+#include <stdexcept>
+
+namespace {
+
+/// Adds the item to the first layer which does not have it yet.
+void addToLayers(std::vector<uint64_t> &layers, size_t item)
+{
+  const uint64_t bit = uint64_t(1) << item;
+  for (auto &layer : layers)
+  {
+    if ((layer & bit) == 0)
+    {
+      layer |= bit;
+      return;
+    }
+  }
+  layers.push_back(bit);
+}
+
+size_t countInLayers(std::vector<uint64_t> const &layers, uint64_t items)
+{
+  size_t count = 0;
+  for (auto layer : layers)
+  {
+    count += size_t(__builtin_popcountll(layer & items));
+  }
+  return count;
+}
+
+}  // namespace
+
+FusedPredicate::FusedPredicate(size_t leaves_count, std::vector<Term> const &terms)
+  : leaves_count_(leaves_count)
+  , terms_(terms)
+{
+  if (leaves_count_ > MAX_LEAVES || terms_.size() > MAX_TERMS || terms_.empty())
+  {
+    throw std::runtime_error("A fused predicate takes 1 to " + std::to_string(MAX_TERMS) +
+                             " terms over at most " + std::to_string(MAX_LEAVES) + " leaves.");
+  }
+  for (size_t t{0}; t < terms_.size(); ++t)
+  {
+    CompiledTerm compiled{terms_[t].condition, {}, {}};
+    for (auto leaf : terms_[t].leaves)
+    {
+      if (leaf >= leaves_count_)
+      {
+        throw std::runtime_error("A fused term reads a leaf out of range.");
+      }
+      addToLayers(compiled.leaf_layers, leaf);
+    }
+    for (auto term : terms_[t].terms)
+    {
+      if (term >= t)
+      {
+        throw std::runtime_error("A fused term may only read the terms before it.");
+      }
+      addToLayers(compiled.term_layers, term);
+    }
+    compiled_.push_back(compiled);
+  }
+
+  if (leaves_count_ <= TABULATED_LEAVES)
+  {
+    const uint64_t masks = uint64_t(1) << leaves_count_;
+    table_.assign(size_t((masks + 63) / 64), 0);
+    for (uint64_t mask{0}; mask < masks; ++mask)
+    {
+      table_[size_t(mask >> 6)] |= uint64_t(evaluate(mask) ? 1 : 0) << (mask & 63);
+    }
+  }
+}
+
+bool FusedPredicate::evaluate(uint64_t leaves) const
+{
+  uint64_t kept = 0;  // a bit per term keeping the value
+  for (size_t t{0}; t < compiled_.size(); ++t)
+  {
+    auto const & term    = compiled_[t];
+    const size_t matches = countInLayers(term.leaf_layers, leaves) +
+                           countInLayers(term.term_layers, kept);
+    if (matches > 0 && term.condition.accepts(matches))
+    {
+      kept |= uint64_t(1) << t;
+    }
+  }
+  return (kept >> (compiled_.size() - 1)) & 1;
+}
+
+size_t FusedPredicate::leavesCount() const
+{
+  return leaves_count_;
+}
+
+std::vector<FusedPredicate::Term> const &FusedPredicate::terms() const
+{
+  return terms_;
+}
+
+std::string FusedPredicate::description() const
+{
+  return describe(terms_.size() - 1);
+}
+
+std::string FusedPredicate::describe(size_t term) const
+{
+  static const char *KINDS[] = {"LE", "EQ", "GR"};
+  auto const &       condition = terms_[term].condition;
+  std::string        text =
+      std::string("[ ") + KINDS[int(condition.kind)] + " " + std::to_string(condition.n);
+  for (auto leaf : terms_[term].leaves)
+  {
+    text += " #" + std::to_string(leaf);
+  }
+  for (auto input : terms_[term].terms)
+  {
+    text += " " + describe(input);
+  }
+  return text + " ]";
+}
@@ -0,0 +1,507 @@
+#include "incremental_evaluator.hpp"
+
+#include "file_reader.hpp"
+#include "logger.hpp"
+#include "mapped_file.hpp"
+#include "set_file.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+namespace {
+
+static constexpr char COUNTS_MAGIC[8] = {'S', 'C', 'A', 'L', 'C', 'C', 'N', 'T'};
+static constexpr auto COMPLETE_MARKER = "/complete";
+static constexpr auto STAGED_SUFFIX   = ".new";
+
+/// A stable 64-bit FNV-1a hash, which names the state files after the subtrees.
+std::string hashOf(std::string const &text)
+{
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  for (auto character : text)
+  {
+    hash = (hash ^ static_cast<unsigned char>(character)) * 0x100000001B3ULL;
+  }
+  char hex[17];
+  std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+  return hex;
+}
+
+bool exists(std::string const &path)
+{
+  struct stat file_stat;
+  return ::stat(path.c_str(), &file_stat) == 0;
+}
+
+void makeDirectory(std::string const &path)
+{
+  if (::mkdir(path.c_str(), 0755) != 0 && errno != EEXIST)
+  {
+    throw std::runtime_error("can not create the state directory '" + path +
+                             "': " + std::strerror(errno) + ".");
+  }
+}
+
+/// The modification time and size of a file, which tell whether it has to be read again.
+struct Stamp
+{
+  int64_t mtime_ns{0};
+  int64_t file_size{0};
+
+  bool operator==(Stamp const &other) const
+  {
+    return mtime_ns == other.mtime_ns && file_size == other.file_size;
+  }
+};
+
+Stamp stampOf(std::string const &filename)
+{
+  struct stat file_stat;
+  if (::stat(filename.c_str(), &file_stat) != 0)
+  {
+    throw std::runtime_error("can not open '" + filename + "', nothing to process.");
+  }
+  Stamp stamp;
+  stamp.mtime_ns =
+      int64_t(file_stat.st_mtim.tv_sec) * 1000000000 + int64_t(file_stat.st_mtim.tv_nsec);
+  stamp.file_size = int64_t(file_stat.st_size);
+  return stamp;
+}
+
+bool readStamp(std::string const &path, Stamp &stamp)
+{
+  std::ifstream file(path);
+  return bool(file >> stamp.mtime_ns >> stamp.file_size);
+}
+
+void writeStamp(std::string const &path, Stamp const &stamp)
+{
+  std::ofstream file(path, std::ios::trunc);
+  file << stamp.mtime_ns << " " << stamp.file_size << "\n";
+  if (!file.flush())
+  {
+    throw std::runtime_error("can not write to '" + path + "'.");
+  }
+}
+
+/**
+ * The counts of a counting operation as stored: the magic, the number of values, the sorted
+ * values and then the count of each of them, in the byte order of the machine. Only the values
+ * held by at least one input are stored.
+ */
+class CountsFile
+{
+public:
+  static constexpr size_t HEADER_SIZE = sizeof(COUNTS_MAGIC) + sizeof(uint64_t);
+
+  // No counts at all.
+  CountsFile() = default;
+
+  explicit CountsFile(std::string const &path)
+    : file_(new MappedFile(path))
+  {
+    if (file_->size() < HEADER_SIZE ||
+        std::memcmp(file_->begin(), COUNTS_MAGIC, sizeof(COUNTS_MAGIC)) != 0)
+    {
+      throw std::runtime_error("the counts file '" + path + "' is corrupted.");
+    }
+    uint64_t size;
+    std::memcpy(&size, file_->begin() + sizeof(COUNTS_MAGIC), sizeof(size));
+    if (file_->size() != HEADER_SIZE + size * (sizeof(DataType) + sizeof(uint32_t)))
+    {
+      throw std::runtime_error("the counts file '" + path + "' is truncated.");
+    }
+    size_ = size_t(size);
+  }
+
+  size_t size() const
+  {
+    return size_;
+  }
+
+  const DataType *values() const
+  {
+    return size_ == 0 ? nullptr
+                      : reinterpret_cast<const DataType *>(file_->begin() + HEADER_SIZE);
+  }
+
+  const uint32_t *counts() const
+  {
+    return size_ == 0 ? nullptr : reinterpret_cast<const uint32_t *>(values() + size_);
+  }
+
+private:
+  std::unique_ptr<MappedFile> file_;
+  size_t                      size_{0};
+};
+
+/// A changed count of a value at its position in the old counts.
+struct CountEdit
+{
+  size_t   position;
+  bool     existed;
+  DataType value;
+  uint32_t count;
+};
+
+template <typename Element>
+void writeArray(std::ofstream &file, const Element *begin, size_t size)
+{
+  file.write(reinterpret_cast<const char *>(begin), std::streamsize(size * sizeof(Element)));
+}
+
+/// Writes a column of the old counts with the edited elements replaced, inserted or dropped.
+template <typename Element, typename Edited>
+void writeEditedColumn(std::ofstream &file, const Element *old_column, size_t old_size,
+                       std::vector<CountEdit> const &edits, Edited edited)
+{
+  size_t cursor = 0;
+  for (auto const &edit : edits)
+  {
+    writeArray(file, old_column + cursor, edit.position - cursor);
+    if (edit.count > 0)
+    {
+      const Element element = edited(edit);
+      writeArray(file, &element, 1);
+    }
+    cursor = edit.position + (edit.existed ? 1 : 0);
+  }
+  writeArray(file, old_column + cursor, old_size - cursor);
+}
+
+/**
+ * @brief Writes the old counts with the edits applied. The unchanged runs between the edits are
+ * copied as they are, so the cost is a sequential copy of the counts.
+ */
+void writeCounts(std::string const &path, CountsFile const &old_counts,
+                 std::vector<CountEdit> const &edits)
+{
+  uint64_t size = old_counts.size();
+  for (auto const &edit : edits)
+  {
+    size = size + (edit.count > 0 ? 1 : 0) - (edit.existed ? 1 : 0);
+  }
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file.is_open())
+  {
+    throw std::runtime_error("can not open '" + path + "' for writing.");
+  }
+  file.write(COUNTS_MAGIC, sizeof(COUNTS_MAGIC));
+  writeArray(file, &size, 1);
+  writeEditedColumn(file, old_counts.values(), old_counts.size(), edits,
+                    [](CountEdit const &edit) { return edit.value; });
+  writeEditedColumn(file, old_counts.counts(), old_counts.size(), edits,
+                    [](CountEdit const &edit) { return edit.count; });
+  if (!file.flush())
+  {
+    throw std::runtime_error("can not write to '" + path + "'.");
+  }
+}
+
+/// The condition of a counting operation, or of the one a query took over.
+bool countingCondition(Node const &node, MatchCondition &condition)
+{
+  if (node.operationType() == OperationType::QUERY)
+  {
+    return static_cast<OpQuery const &>(node.operation()).pushedDownCondition(condition);
+  }
+  return node.operation().matchCondition(node.inputs().size(), condition);
+}
+
+Node const &inputOf(Node::NodeWeakPtr const &input)
+{
+  auto const node = input.lock();
+  if (!node)
+  {
+    throw std::runtime_error("Invalid input node.");
+  }
+  return *node;
+}
+
+}  // namespace
+
+IncrementalEvaluator::IncrementalEvaluator(const std::string &state_dir, const Node &root)
+  : root_(root)
+{
+  makeDirectory(state_dir);
+  directory_ = state_dir + "/" + hashOf(key_of(root_));
+  makeDirectory(directory_);
+  fresh_ = !exists(directory_ + COMPLETE_MARKER);
+  Logger::instance() << "Incremental state in '" << directory_ << "'"
+                     << (fresh_ ? ", evaluated from scratch" : "") << "\n";
+}
+
+/**
+ * @brief Brings the state up to date and reads the result of the root from it. A query is
+ * answered over the result of its input, or of the counting operation it took over.
+ */
+SetPtr IncrementalEvaluator::evaluate()
+{
+  Node const * evaluated = &root_;
+  Query const *query     = nullptr;
+  if (root_.operationType() == OperationType::QUERY)
+  {
+    query = &static_cast<OpQuery const &>(root_.operation()).query();
+    MatchCondition condition{MatchCondition::Kind::GREATER, 0};
+    if (!countingCondition(root_, condition))
+    {
+      evaluated = &inputOf(root_.inputs().front());
+    }
+  }
+  delta_of(*evaluated);
+  commit();
+  auto result = result_of(*evaluated);
+  return query == nullptr ? result : answerQuery(*result, *query, true);
+}
+
+size_t IncrementalEvaluator::changedFiles() const
+{
+  return changed_files_;
+}
+
+size_t IncrementalEvaluator::changedValues() const
+{
+  return changed_values_;
+}
+
+IncrementalEvaluator::Delta const &IncrementalEvaluator::delta_of(const Node &node)
+{
+  auto const &key   = key_of(node);
+  auto const  known = deltas_.find(key);
+  if (known != deltas_.end())
+  {
+    return known->second;
+  }
+  MatchCondition condition{MatchCondition::Kind::GREATER, 0};
+  Delta          delta;
+  if (node.operationType() == OperationType::FILEREADER)
+  {
+    delta = file_delta(static_cast<OpFileReader const &>(node.operation()), key);
+  }
+  else if (countingCondition(node, condition))
+  {
+    delta = counting_delta(node, condition, key);
+  }
+  else
+  {
+    throw std::runtime_error("Operation " + node.operation().description() +
+                             " can not be evaluated incrementally.");
+  }
+  return deltas_.emplace(key, std::move(delta)).first->second;
+}
+
+/**
+ * @brief Compares the values of a changed file with the ones it held at the last evaluation.
+ */
+IncrementalEvaluator::Delta IncrementalEvaluator::file_delta(const OpFileReader &reader,
+                                                             const std::string & key)
+{
+  auto const &filename      = reader.filename();
+  const Stamp stamp         = stampOf(filename);
+  const auto  snapshot_path = path_of(key, SetFile::EXTENSION);
+  const auto  stamp_path    = path_of(key, ".stamp");
+  Stamp       old_stamp;
+  if (!fresh_ && readStamp(stamp_path, old_stamp) && old_stamp == stamp)
+  {
+    return Delta{};
+  }
+
+  Set values = SetFile::isSetFile(filename) ? SetFile::read(filename)
+                                            : FileReader::readIntegers(filename);
+  if (!std::is_sorted(values.begin(), values.end()))
+  {
+    std::sort(values.begin(), values.end());
+  }
+  values.erase(std::unique(values.begin(), values.end()), values.end());
+  const Set old_values = fresh_ ? Set{} : SetFile::read(snapshot_path);
+
+  Delta delta;
+  std::set_difference(values.begin(), values.end(), old_values.begin(), old_values.end(),
+                      std::back_inserter(delta.added));
+  std::set_difference(old_values.begin(), old_values.end(), values.begin(), values.end(),
+                      std::back_inserter(delta.removed));
+  if (fresh_ || !delta.added.empty() || !delta.removed.empty())
+  {
+    SetFile::write(stage(snapshot_path), values, true);
+  }
+  writeStamp(stage(stamp_path), stamp);
+
+  ++changed_files_;
+  changed_values_ += delta.added.size() + delta.removed.size();
+  Logger::instance() << "'" << filename << "' changed: " << delta.added.size() << " values added, "
+                     << delta.removed.size() << " removed\n";
+  return delta;
+}
+
+/**
+ * @brief Sums up the changes of the inputs per value, looks the old counts of the changed values
+ * up by binary search and writes the updated counts; a value enters or leaves the result when
+ * the condition accepts its new count and not the old one, or the other way round.
+ */
+IncrementalEvaluator::Delta IncrementalEvaluator::counting_delta(const Node &       node,
+                                                                 MatchCondition     condition,
+                                                                 const std::string &key)
+{
+  // The changes of every input are sorted, so they are merged into the ones of the others.
+  using Change = std::pair<DataType, int64_t>;
+  std::vector<Change> changes;
+  for (auto const &input : node.inputs())
+  {
+    auto const &input_delta = delta_of(inputOf(input));
+    const auto  merged      = changes.size();
+    auto        added       = input_delta.added.begin();
+    auto        removed     = input_delta.removed.begin();
+    while (added != input_delta.added.end() || removed != input_delta.removed.end())
+    {
+      if (removed == input_delta.removed.end() ||
+          (added != input_delta.added.end() && *added < *removed))
+      {
+        changes.emplace_back(*added++, 1);
+      }
+      else
+      {
+        changes.emplace_back(*removed++, -1);
+      }
+    }
+    std::inplace_merge(changes.begin(), changes.begin() + merged, changes.end());
+  }
+  if (changes.empty() && !fresh_)
+  {
+    return Delta{};
+  }
+
+  const auto       counts_path = path_of(key, ".counts");
+  const CountsFile old_counts  = fresh_ ? CountsFile() : CountsFile(counts_path);
+  const DataType * values      = old_counts.values();
+  const DataType * values_end  = values + old_counts.size();
+
+  Delta                  delta;
+  std::vector<CountEdit> edits;
+  size_t                 cursor = 0;
+  for (size_t begin{0}; begin < changes.size();)
+  {
+    const DataType value = changes[begin].first;
+    int64_t        diff  = 0;
+    size_t         end   = begin;
+    for (; end < changes.size() && changes[end].first == value; ++end)
+    {
+      diff += changes[end].second;
+    }
+    begin = end;
+    if (diff == 0)
+    {
+      continue;
+    }
+    cursor               = size_t(std::lower_bound(values + cursor, values_end, value) - values);
+    const bool    exists = cursor < old_counts.size() && values[cursor] == value;
+    const int64_t count  = exists ? int64_t(old_counts.counts()[cursor]) : 0;
+    if (count + diff < 0)
+    {
+      throw std::runtime_error("The incremental state in '" + directory_ +
+                               "' is inconsistent, remove it to evaluate from scratch.");
+    }
+    edits.push_back(CountEdit{cursor, exists, value, uint32_t(count + diff)});
+
+    const bool was_kept = count > 0 && condition.accepts(size_t(count));
+    const bool is_kept  = count + diff > 0 && condition.accepts(size_t(count + diff));
+    if (is_kept != was_kept)
+    {
+      (is_kept ? delta.added : delta.removed).push_back(value);
+    }
+  }
+  if (!edits.empty() || fresh_)
+  {
+    writeCounts(stage(counts_path), old_counts, edits);
+  }
+  return delta;
+}
+
+SetPtr IncrementalEvaluator::result_of(const Node &node)
+{
+  const auto &key = key_of(node);
+  if (node.operationType() == OperationType::FILEREADER)
+  {
+    return std::make_shared<Set>(SetFile::read(path_of(key, SetFile::EXTENSION)));
+  }
+  MatchCondition condition{MatchCondition::Kind::GREATER, 0};
+  countingCondition(node, condition);
+  const CountsFile counts(path_of(key, ".counts"));
+  auto             result = std::make_shared<Set>();
+  for (size_t i{0}; i < counts.size(); ++i)
+  {
+    if (condition.accepts(counts.counts()[i]))
+    {
+      result->push_back(counts.values()[i]);
+    }
+  }
+  return result;
+}
+
+/**
+ * @brief The structure of the subtree: the signature of the operation and the keys of its
+ * inputs, sorted as every operation is symmetric.
+ */
+const std::string &IncrementalEvaluator::key_of(const Node &node)
+{
+  auto const known = keys_.find(&node);
+  if (known != keys_.end())
+  {
+    return known->second;
+  }
+  std::vector<std::string> input_keys;
+  for (auto const &input : node.inputs())
+  {
+    input_keys.push_back(key_of(inputOf(input)));
+  }
+  std::sort(input_keys.begin(), input_keys.end());
+  std::string key = node.signature() + "(";
+  for (auto const &input_key : input_keys)
+  {
+    key += input_key + ",";
+  }
+  return keys_.emplace(&node, key + ")").first->second;
+}
+
+std::string IncrementalEvaluator::path_of(const std::string &key,
+                                          const std::string &extension) const
+{
+  return directory_ + "/" + hashOf(key) + extension;
+}
+
+std::string IncrementalEvaluator::stage(const std::string &path)
+{
+  staged_.push_back(path);
+  return path + STAGED_SUFFIX;
+}
+
+/**
+ * @brief Renames the staged files over the old ones. The state is marked incomplete meanwhile,
+ * so an interrupted commit makes the next evaluation start from scratch.
+ */
+void IncrementalEvaluator::commit()
+{
+  const std::string marker = directory_ + COMPLETE_MARKER;
+  std::remove(marker.c_str());
+  for (auto const &path : staged_)
+  {
+    if (std::rename((path + STAGED_SUFFIX).c_str(), path.c_str()) != 0)
+    {
+      throw std::runtime_error("can not update the incremental state '" + path + "'.");
+    }
+  }
+  staged_.clear();
+  std::ofstream complete(marker, std::ios::trunc);
+  if (!complete.is_open())
+  {
+    throw std::runtime_error("can not write to '" + marker + "'.");
+  }
+  fresh_ = false;
+}
@@ -0,0 +1,326 @@
+#include "index_engine.hpp"
+
+#include "file_reader.hpp"
+#include "logger.hpp"
+#include "set_file.hpp"
+#include "thread_pool.hpp"
+#include "word_counter.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+using Column    = MembershipIndex::Column;
+using ColumnPtr = MembershipIndex::ColumnPtr;
+using Condition = MatchCondition;
+
+// Below this many words (64 values each) splitting a column into ranges costs more than it saves.
+static constexpr size_t PARALLEL_WORDS_THRESHOLD = 1 << 12;
+static constexpr size_t WORDS_PER_RANGE          = 1 << 11;
+
+uint64_t wordOf(Column const &column, size_t word)
+{
+  return word < column.size() ? column[word] : 0;
+}
+
+size_t countRows(Column const &column)
+{
+  size_t rows = 0;
+  for (auto word : column)
+  {
+    rows += size_t(__builtin_popcountll(word));
+  }
+  return rows;
+}
+
+}  // namespace
+
+template <typename ComputeRange>
+void IndexEngine::compute_words(Column &column, ComputeRange compute_range)
+{
+  if (thread_pool_ == nullptr || column.size() < PARALLEL_WORDS_THRESHOLD)
+  {
+    compute_range(size_t(0), column.size());
+    return;
+  }
+  const size_t ranges = (column.size() + WORDS_PER_RANGE - 1) / WORDS_PER_RANGE;
+  TaskLatch    computed(ranges);
+  for (size_t range{0}; range < ranges; ++range)
+  {
+    thread_pool_->submit([&, range] {
+      const size_t begin = range * WORDS_PER_RANGE;
+      compute_range(begin, std::min(begin + WORDS_PER_RANGE, column.size()));
+      computed.countDown();
+    });
+  }
+  computed.wait(*thread_pool_);
+}
+
+ColumnPtr IndexEngine::column_of(const SetPtr &set)
+{
+  {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    auto const                  cached = cache_.find(set.get());
+    if (cached != cache_.end() && cached->second.set.lock() == set)
+    {
+      return cached->second.column;
+    }
+  }
+  auto column = index_.addSource(*set);
+  remember(set, column);
+  return column;
+}
+
+std::vector<ColumnPtr> IndexEngine::columns_of(const SetPtrEnsemble &sets)
+{
+  std::vector<ColumnPtr> columns;
+  columns.reserve(sets.size());
+  for (const auto &set : sets)
+  {
+    total_processed_ += set->size();
+    columns.push_back(column_of(set));
+  }
+  return columns;
+}
+
+void IndexEngine::remember(const SetPtr &set, ColumnPtr const &column)
+{
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  for (auto it = cache_.begin(); it != cache_.end();)
+  {
+    it = it->second.set.expired() ? cache_.erase(it) : std::next(it);
+  }
+  cache_[set.get()] = CachedColumn{set, column};
+}
+
+SetPtr IndexEngine::materialize(const SetPtrEnsemble &sets, ColumnPtr const &column)
+{
+  auto result = Helpers::reuseInputOrMake(sets);
+  result->reserve(countRows(*column));
+  index_.valuesOf(*column, *result);
+  total_processed_ += result->size();
+  remember(result, column);
+  return result;
+}
+
+/**
+ * @brief Combines the columns word by word: INT and SUM are AND and OR loops, the other
+ * conditions count the occurrences with bit-sliced counters. An intersection is as long as the
+ * shortest column, any other result as the longest one.
+ */
+ColumnPtr IndexEngine::count_and_keep_if(std::vector<ColumnPtr> const &columns,
+                                         MatchCondition                condition)
+{
+  auto result = std::make_shared<Column>();
+  if (!condition.satisfiable(columns.size()))
+  {
+    return result;
+  }
+  const bool intersection =
+      condition.kind == Condition::Kind::EQUAL && condition.n == columns.size();
+  size_t words = intersection ? std::numeric_limits<size_t>::max() : 0;
+  for (auto const &column : columns)
+  {
+    words = intersection ? std::min(words, column->size()) : std::max(words, column->size());
+  }
+  result->resize(words, 0);
+  Column &output = *result;
+
+  if (intersection)
+  {
+    compute_words(output, [&](size_t begin, size_t end) {
+      std::copy(columns.front()->begin() + begin, columns.front()->begin() + end,
+                output.begin() + begin);
+      for (size_t i{1}; i < columns.size(); ++i)
+      {
+        for (size_t w = begin; w < end; ++w)
+        {
+          output[w] &= (*columns[i])[w];
+        }
+      }
+    });
+    return result;
+  }
+  if (condition.kind == Condition::Kind::GREATER && condition.n == 0)
+  {
+    compute_words(output, [&](size_t begin, size_t end) {
+      for (auto const &column : columns)
+      {
+        for (size_t w = begin; w < std::min(end, column->size()); ++w)
+        {
+          output[w] |= (*column)[w];
+        }
+      }
+    });
+    return result;
+  }
+  const WordCounter counter(columns.size(), condition);
+  compute_words(output, [&](size_t begin, size_t end) {
+    std::vector<uint64_t> inputs(columns.size());
+    for (size_t w = begin; w < end; ++w)
+    {
+      for (size_t i{0}; i < columns.size(); ++i)
+      {
+        inputs[i] = wordOf(*columns[i], w);
+      }
+      output[w] = counter.keep(inputs.data(), inputs.size());
+    }
+  });
+  return result;
+}
+
+SetPtr IndexEngine::keep_if_less_than_n_matches(const SetPtrEnsemble &sets, int n)
+{
+  const auto columns = columns_of(sets);
+  return materialize(sets,
+                     count_and_keep_if(columns, Condition{Condition::Kind::LESS, size_t(n)}));
+}
+
+SetPtr IndexEngine::keep_if_precisely_n_matches(const SetPtrEnsemble &sets, int n)
+{
+  const auto columns = columns_of(sets);
+  return materialize(sets,
+                     count_and_keep_if(columns, Condition{Condition::Kind::EQUAL, size_t(n)}));
+}
+
+SetPtr IndexEngine::keep_if_greater_than_n_matches(const SetPtrEnsemble &sets, int n)
+{
+  const auto columns = columns_of(sets);
+  return materialize(sets,
+                     count_and_keep_if(columns, Condition{Condition::Kind::GREATER, size_t(n)}));
+}
+
+SetPtr IndexEngine::sets_intersection(const SetPtrEnsemble &sets)
+{
+  return keep_if_precisely_n_matches(sets, int(sets.size()));
+}
+
+SetPtr IndexEngine::sets_difference(const SetPtrEnsemble &sets)
+{
+  return keep_if_precisely_n_matches(sets, 1);
+}
+
+SetPtr IndexEngine::sets_union(const SetPtrEnsemble &sets)
+{
+  return keep_if_greater_than_n_matches(sets, 0);
+}
+
+/**
+ * @brief Combines the columns like count_and_keep_if() but never builds the result set: a count
+ * is the number of the bits set, the other queries visit the values of the rows.
+ */
+SetPtr IndexEngine::query_matches_if(const SetPtrEnsemble &sets, MatchCondition condition,
+                                     Query const &query)
+{
+  const auto       column = count_and_keep_if(columns_of(sets), condition);
+  QueryAccumulator answer(query, false);
+  if (answer.countsOnly())
+  {
+    answer.addCount(countRows(*column));
+    return answer.result();
+  }
+  Set values;
+  index_.valuesOf(*column, values);
+  for (auto value : values)
+  {
+    if (!answer.add(value))
+    {
+      break;
+    }
+  }
+  return answer.result();
+}
+
+/**
+ * @brief Evaluates the terms of the predicate word by word, the words of the inner terms being
+ * counted by the outer ones like the columns of the leaves.
+ */
+SetPtr IndexEngine::keep_if_fused(const SetPtrEnsemble &sets, FusedPredicate const &predicate)
+{
+  if (sets.size() != predicate.leavesCount())
+  {
+    throw std::runtime_error("The fused predicate expects " +
+                             std::to_string(predicate.leavesCount()) + " inputs.");
+  }
+  const auto  columns = columns_of(sets);
+  auto const &terms   = predicate.terms();
+
+  std::vector<WordCounter> counters;
+  counters.reserve(terms.size());
+  for (auto const &term : terms)
+  {
+    counters.emplace_back(term.leaves.size() + term.terms.size(), term.condition);
+  }
+  size_t words = 0;
+  for (auto const &column : columns)
+  {
+    words = std::max(words, column->size());
+  }
+  auto result = std::make_shared<Column>(words, 0);
+  compute_words(*result, [&](size_t begin, size_t end) {
+    std::vector<uint64_t> term_words(terms.size());
+    std::vector<uint64_t> inputs;
+    for (size_t w = begin; w < end; ++w)
+    {
+      for (size_t t{0}; t < terms.size(); ++t)
+      {
+        inputs.clear();
+        for (auto leaf : terms[t].leaves)
+        {
+          inputs.push_back(wordOf(*columns[leaf], w));
+        }
+        for (auto inner : terms[t].terms)
+        {
+          inputs.push_back(term_words[inner]);
+        }
+        term_words[t] = counters[t].keep(inputs.data(), inputs.size());
+      }
+      (*result)[w] = term_words.back();
+    }
+  });
+  return materialize(sets, result);
+}
+
+/**
+ * @brief Reads the file like the other engines and indexes it as a new source; the set is built
+ * back from its column, which drops the duplicates.
+ */
+SetPtr IndexEngine::read_file(const std::string filename)
+{
+  const Set values = SetFile::isSetFile(filename) ? SetFile::read(filename)
+                                                  : FileReader::readIntegers(filename, nullptr, read_options_);
+  auto      column = index_.addSource(values);
+  auto      result = Helpers::makeEvaluationSet(Arena::current());
+  result->reserve(values.size());
+  index_.valuesOf(*column, *result);
+  total_processed_ += values.size();
+  remember(result, column);
+  Logger::instance() << "'" << filename << "': " << result->size() << " values indexed, "
+                     << index_.rows() << " distinct values in " << index_.sources()
+                     << " sources\n";
+  return result;
+}
+
+bool IndexEngine::sorted_output() const
+{
+  return false;
+}
+
+size_t IndexEngine::total_processed()
+{
+  return total_processed_;
+}
+
+void IndexEngine::set_thread_pool(ThreadPool *pool)
+{
+  thread_pool_       = pool;
+  read_options_.pool = pool;
+}
+
+void IndexEngine::set_read_chunk_size(size_t bytes)
+{
+  read_options_.chunk_bytes = bytes;
+}
@@ -18,10 +18,18 @@ const std::map<std::string, Lexem> Lexer::FIXED_LEXEM_NAMES{
     {"LE", Lexem::LE},
     {"GR", Lexem::GR},
     //
+    {"COUNT", Lexem::COUNT},
+    {"MIN", Lexem::MIN},
+    {"MAX", Lexem::MAX},
+    {"TOP", Lexem::TOP},
+    {"BOTTOM", Lexem::BOTTOM},
+    {"EXISTS", Lexem::EXISTS},
+    //
     {" ", Lexem::SPACE},
 };
 
-const std::set<Lexem> Lexer::PARAMETRIZED_LEXEMS = {Lexem::GR, Lexem::EQ, Lexem::LE};
+const std::set<Lexem> Lexer::PARAMETRIZED_LEXEMS = {Lexem::GR, Lexem::EQ, Lexem::LE, Lexem::TOP,
+                                                    Lexem::BOTTOM};
 
 
 // A filename must contain a dot
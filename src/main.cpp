@@ -1,60 +1,422 @@
 #include "engine.hpp"
 #include "expression.hpp"
+#include "output_writer.hpp"
+#include "profiler.hpp"
+#include "server.hpp"
+#include "set_cache.hpp"
+#include "set_file.hpp"
+#include "thread_pool.hpp"
 
 #include <algorithm>
 #include <chrono>
+#include <fstream>
 #include <iostream>
 #include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+/// An expression of a batch along with the file its result goes to.
+struct BatchEntry
+{
+  std::string output_filename;
+  std::string expression;
+};
+
+/**
+ * @brief Reads a batch file, where every line holds an output file and an expression after it,
+ * e.g. "out.txt [ INT a.txt b.txt ]". Blank lines are skipped.
+ */
+std::vector<BatchEntry> readBatch(std::string const &filename)
+{
+  std::ifstream input(filename);
+  if (!input)
+  {
+    throw std::runtime_error("can not open the batch file " + filename);
+  }
+  std::vector<BatchEntry> entries;
+  std::string             line;
+  for (size_t line_number{1}; std::getline(input, line); ++line_number)
+  {
+    const auto begin = line.find_first_not_of(" \t\r");
+    if (begin == std::string::npos)
+    {
+      continue;
+    }
+    const auto end        = line.find_first_of(" \t", begin);
+    const auto expression = end == std::string::npos ? end : line.find('[', end);
+    if (expression == std::string::npos)
+    {
+      throw std::runtime_error("line " + std::to_string(line_number) + " of " + filename +
+                               " is not an output file followed by an expression.");
+    }
+    entries.push_back(BatchEntry{line.substr(begin, end - begin), line.substr(expression)});
+  }
+  if (entries.empty())
+  {
+    throw std::runtime_error("the batch file " + filename + " has no expressions.");
+  }
+  return entries;
+}
+
+/**
+ * @brief Reads the number given to a command-line option: a non-negative integer of at most 9
+ * digits, so the sizes in megabytes can not overflow once converted to bytes. Prints the error
+ * and returns false for anything else.
+ */
+bool parseNumber(std::string const &option, std::string const &text, size_t &number)
+{
+  if (text.empty() || text.size() > 9 ||
+      !std::all_of(text.begin(), text.end(), [](char c) { return c >= '0' && c <= '9'; }))
+  {
+    std::cout << "Error : '" << option << "' expects a number, got '" << text << "'."
+              << std::endl;
+    return false;
+  }
+  number = size_t(std::stoul(text));
+  return true;
+}
+
+/**
+ * @brief Writes the result into the file, or to stdout without one. An unsorted result is sorted
+ * in place for the output, unless it is shared with a cache or another output.
+ */
+void writeResult(SetPtr result, std::string const &output_filename, IEngine const &engine)
+{
+  if (!engine.sorted_output())
+  {
+    Helpers::makeExclusive(result);
+  }
+  if (!output_filename.empty() && SetFile::hasExtension(output_filename))
+  {
+    SetFile::write(output_filename, *result, engine.sorted_output());
+    return;
+  }
+  std::cout.flush();
+  std::unique_ptr<OutputWriter> writer(output_filename.empty()
+                                           ? new OutputWriter(STDOUT_FILENO)
+                                           : new OutputWriter(output_filename));
+  writer->writeSorted(*result, engine.sorted_output());
+  writer->flush();
+}
+
+/**
+ * @brief Evaluates all the expressions of a batch file as one graph, so the files and the
+ * subexpressions they have in common are read and computed once, writes every result into its
+ * file and prints the throughput of the whole batch. With profiling, the trace of the whole batch
+ * goes to the profile file.
+ */
+void runBatch(std::string const &batch_filename, std::string const &profile_filename,
+              Expression &expression, IEngine &engine)
+{
+  const auto start   = std::chrono::steady_clock::now();
+  const auto entries = readBatch(batch_filename);
+
+  std::vector<std::string> inputs;
+  for (auto const &entry : entries)
+  {
+    inputs.push_back(entry.expression);
+  }
+  expression.buildFromUserInputs(inputs);
+  auto       results   = expression.evaluateAllShared();
+  const auto evaluated = std::chrono::steady_clock::now();
+
+  if (Profiler::instance().enabled())
+  {
+    for (auto const &name : expression.outputNodeNames())
+    {
+      Profiler::instance().printTree(*expression.getNode(name), std::cerr);
+    }
+    Profiler::instance().writeChromeTrace(profile_filename);
+  }
+  size_t values = 0;
+  for (size_t i{0}; i < entries.size(); ++i)
+  {
+    values += results[i]->size();
+    writeResult(std::move(results[i]), entries[i].output_filename, engine);
+  }
+  const auto end = std::chrono::steady_clock::now();
+
+  using Milliseconds   = std::chrono::duration<double, std::milli>;
+  const double total   = Milliseconds(end - start).count();
+  const double seconds = std::max(total, 1e-3) / 1000;
+  std::cout << "Batch of " << entries.size() << " expressions evaluated in "
+            << size_t(Milliseconds(evaluated - start).count()) << " ms (" << size_t(total)
+            << " ms with the output): " << values << " values in the results, "
+            << engine.total_processed() << " elements processed, "
+            << size_t(double(entries.size()) / seconds) << " expressions/s, "
+            << size_t(double(engine.total_processed()) / seconds) << " elements/s."
+            << std::endl;
+}
+
+}  // namespace
 
 int main(int argc, char **argv)
 {
-  std::string user_input;
+  std::string   user_input;
+  std::string   engine_name = "hash";
+  size_t        workers     = 1;
+  std::string   output_filename;
+  std::string   profile_filename;
+  std::string   batch_filename;
+  std::string   state_dir;
+  bool          serve = false;
+  std::string   socket_path;
+  size_t        cache_megabytes = 1024;
+  size_t        chunk_megabytes = FileReader::DEFAULT_CHUNK_BYTES >> 20;
+  bool          streaming       = false;
+  bool          optimize        = true;
+  bool          fuse            = false;
+  bool          explain         = false;
+  StreamOptions stream_options;
+  size_t        sort_megabytes = stream_options.sort_memory_bytes >> 20;
 
   if (argc > 1)
   {
     int first_expression_arg_index = 1;
-    if (argv[1][0] == 'l')
+    // Options go before the expression, which always starts with a "[".
+    while (first_expression_arg_index < argc && argv[first_expression_arg_index][0] != '[')
     {
-      Logger::instance().setEnabled(true);
+      const std::string option(argv[first_expression_arg_index]);
+      if (option[0] == 'l')
+      {
+        Logger::instance().setEnabled(true);
+      }
+      else if (option == "-e" && first_expression_arg_index + 1 < argc)
+      {
+        engine_name = argv[++first_expression_arg_index];
+      }
+      else if (option == "-j" && first_expression_arg_index + 1 < argc)
+      {
+        if (!parseNumber(option, argv[++first_expression_arg_index], workers))
+        {
+          return -1;
+        }
+      }
+      else if (option == "-o" && first_expression_arg_index + 1 < argc)
+      {
+        output_filename = argv[++first_expression_arg_index];
+      }
+      else if (option == "-p" && first_expression_arg_index + 1 < argc)
+      {
+        profile_filename = argv[++first_expression_arg_index];
+        Profiler::instance().setEnabled(true);
+      }
+      else if (option == "--batch" && first_expression_arg_index + 1 < argc)
+      {
+        batch_filename = argv[++first_expression_arg_index];
+      }
+      else if (option == "--serve")
+      {
+        serve = true;
+      }
+      else if (option == "--socket" && first_expression_arg_index + 1 < argc)
+      {
+        serve       = true;
+        socket_path = argv[++first_expression_arg_index];
+      }
+      else if (option == "--no-optimize")
+      {
+        optimize = false;
+      }
+      else if (option == "--fuse")
+      {
+        fuse = true;
+      }
+      else if (option == "--explain")
+      {
+        explain = true;
+      }
+      else if (option == "--incremental" && first_expression_arg_index + 1 < argc)
+      {
+        state_dir = argv[++first_expression_arg_index];
+      }
+      else if (option == "--stream")
+      {
+        streaming = true;
+      }
+      else if (option == "--temp-dir" && first_expression_arg_index + 1 < argc)
+      {
+        stream_options.temp_dir = argv[++first_expression_arg_index];
+      }
+      else if (option == "--sort-memory-mb" && first_expression_arg_index + 1 < argc)
+      {
+        if (!parseNumber(option, argv[++first_expression_arg_index], sort_megabytes))
+        {
+          return -1;
+        }
+      }
+      else if (option == "--cache-mb" && first_expression_arg_index + 1 < argc)
+      {
+        if (!parseNumber(option, argv[++first_expression_arg_index], cache_megabytes))
+        {
+          return -1;
+        }
+      }
+      else if (option == "--chunk-mb" && first_expression_arg_index + 1 < argc)
+      {
+        if (!parseNumber(option, argv[++first_expression_arg_index], chunk_megabytes))
+        {
+          return -1;
+        }
+      }
+      else
+      {
+        std::cout << "Error : unknown option '" << option << "'" << std::endl;
+        return -1;
+      }
       ++first_expression_arg_index;
     }
     for (int argnum{first_expression_arg_index}; argnum < argc; ++argnum)
     {
       user_input.append(std::string(argv[argnum]) + " ");
     }
+    if (!batch_filename.empty() && (!user_input.empty() || serve || streaming))
+    {
+      std::cout << "Error : '--batch' takes the expressions from the file only, without "
+                   "'--serve' or '--stream'."
+                << std::endl;
+      return -1;
+    }
+    if (!state_dir.empty() && (serve || streaming || !batch_filename.empty()))
+    {
+      std::cout << "Error : '--incremental' evaluates a single expression, without '--serve', "
+                   "'--stream' or '--batch'."
+                << std::endl;
+      return -1;
+    }
+    if (engine_name == "index" && serve)
+    {
+      // The index never drops a value, so a long-running server would grow without bound.
+      std::cout << "Error : '-e index' keeps every value read for the lifetime of the process, "
+                   "it can not be used with '--serve' or '--socket'."
+                << std::endl;
+      return -1;
+    }
   }
   else
   {
     // user_input = "[ SUM [ DIF a.txt b.txt c.txt ] [ INT b.txt c.txt ] ]";
     user_input = "[ GR 1 [ EQ 3 a.txt a.txt b.txt ] [ LE 2 b.txt c.txt ] ]";
     std::cout << "Please provide 'l' for explicit logging as first argument." << std::endl;
+    std::cout << "Use '-e sorted', '-e bitmap' or '-e index' to evaluate with the sorted-vector, "
+                 "the compressed bitmap or the membership index engine."
+              << std::endl;
+    std::cout << "Use '-j N' to evaluate independent nodes on N threads, '--chunk-mb size' to "
+                 "parse large files on them in chunks of the size."
+              << std::endl;
+    std::cout << "Use '-o file' to write the result into a file, a '.sset' file gets the binary "
+                 "set format."
+              << std::endl;
+    std::cout << "Use '--serve' to answer expressions from stdin, one per line, or "
+                 "'--socket path' to answer them on a Unix domain socket."
+              << std::endl;
+    std::cout << "Use '--batch file' to evaluate the expressions of a file together, one per line "
+                 "after the file for its result, e.g. 'out.txt [ INT a.txt b.txt ]'."
+              << std::endl;
+    std::cout << "Use '--stream' to evaluate inputs larger than the memory as streams."
+              << std::endl;
+    std::cout << "Use '--explain' to print the evaluation plan before and after the optimization, "
+                 "'--no-optimize' to evaluate the expression as written."
+              << std::endl;
+    std::cout << "Use '--fuse' to evaluate every tree of nested counting operations in one pass "
+                 "over its files."
+              << std::endl;
+    std::cout << "Use '--incremental dir' to keep the state of the evaluation in the directory and "
+                 "compute only the changes of the files on the next runs."
+              << std::endl;
+    std::cout << "Use '-p trace.json' to profile every node, the annotated tree goes to stderr."
+              << std::endl;
     std::cout << "Example expression: " << user_input << std::endl;
   }
 
-  Engine     engine;
-  Expression expression(engine);
-
   try
   {
+    auto       engine = buildEngine(engine_name);
+    Expression expression(*engine);
+
+    std::unique_ptr<ThreadPool> thread_pool;
+    if (workers > 1)
+    {
+      thread_pool.reset(new ThreadPool(workers));
+      expression.setThreadPool(thread_pool.get());
+      engine->set_thread_pool(thread_pool.get());
+    }
+    engine->set_read_chunk_size(std::max<size_t>(chunk_megabytes, 1) << 20);
+    stream_options.sort_memory_bytes = sort_megabytes << 20;
+
+    if (serve)
+    {
+      // The responses go to stdout, so the log is kept apart from them.
+      Logger::instance().rdbuf(std::cerr.rdbuf());
+      SetCache set_cache(cache_megabytes << 20,
+                         [&engine](Set const &set) { return engine->memory_of(set); });
+      Server   server(*engine, set_cache, thread_pool.get());
+      if (socket_path.empty())
+      {
+        server.serveStream(STDIN_FILENO, STDOUT_FILENO);
+      }
+      else
+      {
+        server.serveSocket(socket_path);
+      }
+      return 0;
+    }
+
+    // The state of an incremental evaluation is kept by the structure of the plan, so the plan
+    // must not depend on the files.
+    expression.setOptimization(optimize && state_dir.empty());
+    // A fused operation can not be streamed nor evaluated incrementally.
+    expression.setFusion(fuse && !streaming && state_dir.empty());
+    expression.setPlanOutput(explain ? &std::cerr : nullptr);
+    if (!batch_filename.empty())
+    {
+      runBatch(batch_filename, profile_filename, expression, *engine);
+      return 0;
+    }
     expression.buildFromUserInput(user_input);
 
-    auto start = std::chrono::system_clock::now();
+    if (streaming)
+    {
+      if (SetFile::hasExtension(output_filename))
+      {
+        throw std::runtime_error("streamed results can not be written as a set file.");
+      }
+      std::cout.flush();
+      std::unique_ptr<OutputWriter> writer(output_filename.empty()
+                                               ? new OutputWriter(STDOUT_FILENO)
+                                               : new OutputWriter(output_filename));
+      auto     stream = expression.stream(stream_options);
+      DataType value;
+      while (stream->next(value))
+      {
+        writer->writeValue(value);
+      }
+      writer->flush();
+      return 0;
+    }
 
-    const auto result = expression.evaluate();
+    auto start = std::chrono::system_clock::now();
 
-    std::vector<DataType> output;
-    output.reserve(result.size());
-    std::copy(result.begin(), result.end(), std::back_inserter(output));
-    std::sort(output.begin(), output.end());
+    auto result = state_dir.empty() ? expression.evaluateShared()
+                                    : expression.evaluateIncremental(state_dir);
 
     auto end = std::chrono::system_clock::now();
 
-    Logger::instance() << "Result of size " << result.size() << ", processed total "
-                       << engine.total_processed() << " elements in "
+    Logger::instance() << "Result of size " << result->size() << ", processed total "
+                       << engine->total_processed() << " elements in "
                        << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()
                        << " milliseconds:\n\n";
 
-    Helpers::printVectorToCout(output);
+    if (Profiler::instance().enabled())
+    {
+      Profiler::instance().printTree(*expression.getNode(expression.outputNodeName()), std::cerr);
+      Profiler::instance().writeChromeTrace(profile_filename);
+    }
+
+    writeResult(std::move(result), output_filename, *engine);
   }
   catch (std::exception &e)
   {
@@ -0,0 +1,44 @@
+#include "mapped_file.hpp"
+
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::string &filename)
+{
+  const int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    throw std::runtime_error("can not open '" + filename + "', nothing to process.");
+  }
+  struct stat file_stat;
+  if (::fstat(fd, &file_stat) != 0)
+  {
+    ::close(fd);
+    throw std::runtime_error("can not stat '" + filename + "'.");
+  }
+  size_ = size_t(file_stat.st_size);
+  if (size_ > 0)
+  {
+    void *address = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (address == MAP_FAILED)
+    {
+      ::close(fd);
+      throw std::runtime_error("can not map '" + filename + "' into memory.");
+    }
+    data_ = static_cast<const char *>(address);
+    ::madvise(address, size_, MADV_SEQUENTIAL);
+  }
+  ::close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+  if (data_ != nullptr)
+  {
+    ::munmap(const_cast<char *>(data_), size_);
+  }
+}
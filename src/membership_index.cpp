@@ -0,0 +1,75 @@
+#include "membership_index.hpp"
+
+#include <stdexcept>
+
+MembershipIndex::MembershipIndex()
+  : rows_(nullptr)
+{}
+
+/**
+ * @brief Numbers the values of the set, appending the new ones as rows, and sets the bits of
+ * their rows in the column of the source.
+ */
+MembershipIndex::ColumnPtr MembershipIndex::addSource(const Set &set)
+{
+  auto                        column = std::make_shared<Column>();
+  std::lock_guard<std::mutex> lock(mutex_);
+  rows_.reserve(rows_.size() + set.size());
+  for (auto value : set)
+  {
+    const size_t before = rows_.size();
+    const size_t row    = rows_.positionOf(value);
+    if (row == before && rows_.size() > before)
+    {
+      if (row >= UINT32_MAX)
+      {
+        throw std::runtime_error("The membership index is limited to 2^32 distinct values.");
+      }
+      if (row % BLOCK_ROWS == 0)
+      {
+        blocks_.emplace_back(new DataType[BLOCK_ROWS]);
+      }
+      blocks_[row >> BLOCK_BITS][row % BLOCK_ROWS] = value;
+    }
+    if (row / ROWS_PER_WORD >= column->size())
+    {
+      column->resize(row / ROWS_PER_WORD + 1, 0);
+    }
+    (*column)[row / ROWS_PER_WORD] |= uint64_t(1) << (row % ROWS_PER_WORD);
+  }
+  ++sources_;
+  return column;
+}
+
+void MembershipIndex::valuesOf(const Column &column, Set &output) const
+{
+  std::vector<const DataType *> blocks;
+  {
+    // Every row of the column was written before the column was made.
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto const &block : blocks_)
+    {
+      blocks.push_back(block.get());
+    }
+  }
+  for (size_t word{0}; word < column.size(); ++word)
+  {
+    for (uint64_t bits = column[word]; bits != 0; bits &= bits - 1)
+    {
+      const size_t row = word * ROWS_PER_WORD + size_t(__builtin_ctzll(bits));
+      output.push_back(blocks[row >> BLOCK_BITS][row % BLOCK_ROWS]);
+    }
+  }
+}
+
+size_t MembershipIndex::rows() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return rows_.size();
+}
+
+size_t MembershipIndex::sources() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return sources_;
+}
@@ -1,6 +1,10 @@
 #include "node.hpp"
 
+#include "engine.hpp"
 #include "ops.hpp"
+#include "profiler.hpp"
+
+#include <stdexcept>
 
 Node::Node(OpPtr operation, std::string name)
   : op_ptr_(operation)
@@ -29,12 +33,75 @@ SetPtrEnsemble Node::gatherInputs() const
 }
 
 /**
- * Returns the result of evaluation of this node.
+ * Returns the result of evaluation of this node. The result of a node with several consumers is
+ * computed once and handed out from the cache until every consumer has got it.
  * @return the set with the forward result
  */
 SetPtr Node::evaluate()
 {
-  return op_ptr_->execute(gatherInputs());
+  if (cached_result_)
+  {
+    SetPtr result = cached_result_;
+    if (Profiler::instance().enabled())
+    {
+      auto &profiler = Profiler::instance();
+      profiler.end(profiler.begin(*this, {}, true), op_ptr_->engine().size_of(*result));
+    }
+    if (--pending_reads_ == 0)
+    {
+      cached_result_.reset();
+    }
+    return result;
+  }
+  SetPtr result = execute(gatherInputs());
+  if (consumers_ > 1)
+  {
+    cached_result_ = result;
+    pending_reads_ = consumers_ - 1;
+  }
+  return result;
+}
+
+/**
+ * Runs the operation of this node over the already evaluated inputs, without any caching.
+ * The execution is recorded by the profiler when it is enabled.
+ * @return the set with the forward result
+ */
+SetPtr Node::execute(const SetPtrEnsemble &inputs) const
+{
+  auto &profiler = Profiler::instance();
+  if (!profiler.enabled())
+  {
+    return op_ptr_->execute(inputs);
+  }
+  // The sizes are told by the engine, which may not keep the values in the sets.
+  auto const &        engine = op_ptr_->engine();
+  std::vector<size_t> input_sizes;
+  for (auto const &input : inputs)
+  {
+    input_sizes.push_back(engine.size_of(*input));
+  }
+  auto   record = profiler.begin(*this, std::move(input_sizes), op_ptr_->hasCachedResult());
+  SetPtr result = op_ptr_->execute(inputs);
+  profiler.end(std::move(record), engine.size_of(*result));
+  return result;
+}
+
+ValueStreamPtr Node::stream(const StreamOptions &options) const
+{
+  ValueStreams inputs;
+  for (auto const &i : input_nodes_)
+  {
+    if (auto ptr = i.lock())
+    {
+      inputs.push_back(ptr->stream(options));
+    }
+    else
+    {
+      throw std::runtime_error("Unable to lock weak pointer.");
+    }
+  }
+  return op_ptr_->stream(std::move(inputs), options);
 }
 
 const std::string &Node::name() const
@@ -42,11 +109,26 @@ const std::string &Node::name() const
   return name_;
 }
 
+const Operation &Node::operation() const
+{
+  return *op_ptr_;
+}
+
 OperationType Node::operationType() const
 {
   return op_ptr_->type();
 }
 
+std::string Node::signature() const
+{
+  return op_ptr_->signature();
+}
+
+const std::vector<Node::NodeWeakPtr> &Node::inputs() const
+{
+  return input_nodes_;
+}
+
 /**
  * registers a node as an input to this node
  * @param i pointer to the input node
@@ -55,3 +137,30 @@ void Node::addInput(NodeWeakPtr const &i)
 {
   input_nodes_.push_back(i);
 }
+
+void Node::setInputs(const std::vector<NodeWeakPtr> &inputs)
+{
+  input_nodes_ = inputs;
+}
+
+/**
+ * registers one more read of this node's result per evaluation
+ */
+void Node::addConsumer()
+{
+  ++consumers_;
+}
+
+void Node::resetConsumers()
+{
+  consumers_ = 0;
+}
+
+/**
+ * drops a result kept for consumers which have not read it yet
+ */
+void Node::resetCache()
+{
+  cached_result_.reset();
+  pending_reads_ = 0;
+}
@@ -2,11 +2,16 @@
 
 #include "engine.hpp"
 #include "logger.hpp"
+#include "set_cache.hpp"
+#include "set_file.hpp"
 
 #include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <set>
+#include <stdexcept>
+
+#include <sys/stat.h>
 
 const std::map<OperationType, std::string> OP_NAMES{
     {OperationType::DIFFERENCE, "DIFFERENCE"},
@@ -15,9 +20,11 @@ const std::map<OperationType, std::string> OP_NAMES{
     {OperationType::KEEP_IF_PRECISELY_N_MATCHES, "KEEP_IF_PRECISELY_N_MATCHES"},
     {OperationType::KEEP_IF_MORE_THAN_N_MATCHES, "KEEP_IF_MORE_THAN_N_MATCHES"},
     {OperationType::KEEP_IF_LESS_THAN_N_MATCHES, "KEEP_IF_LESS_THAN_N_MATCHES"},
+    {OperationType::FUSED, "FUSED"},
     {OperationType::FILEREADER, "FILEREADER"},
     {OperationType::INTEGER, "INTEGER"},
     {OperationType::CONST_VECTOR, "CONST_VECTOR"},
+    {OperationType::QUERY, "QUERY"},
     {OperationType::INVALID, "INVALID"}};
 
 void validateTypeIsIn(OperationType type, const std::set<OperationType> allowed_types = {})
@@ -44,10 +51,12 @@ OpPtr buildOperation(IEngine &engine, OperationType type)
   }
 }
 
-OpPtr buildOperation(IEngine &engine, OperationType type, std::string const &filename)
+OpPtr buildOperation(IEngine &engine, OperationType type, std::string const &filename,
+                     SetCache *set_cache)
 {
   validateTypeIsIn(type, {OperationType::FILEREADER});
-  return std::static_pointer_cast<Operation>(std::make_shared<OpFileReader>(engine, filename));
+  return std::static_pointer_cast<Operation>(
+      std::make_shared<OpFileReader>(engine, filename, set_cache));
 }
 
 OpPtr buildOperation(IEngine &engine, OperationType type, Set const &data)
@@ -76,6 +85,18 @@ OpPtr buildOperation(IEngine &engine, OperationType type, int parameter)
                            " with an integer parameter.");
 }
 
+OpPtr buildOperation(IEngine &engine, OperationType type, Query const &query)
+{
+  validateTypeIsIn(type, {OperationType::QUERY});
+  return std::static_pointer_cast<Operation>(std::make_shared<OpQuery>(engine, query));
+}
+
+OpPtr buildOperation(IEngine &engine, OperationType type, FusedPredicate const &predicate)
+{
+  validateTypeIsIn(type, {OperationType::FUSED});
+  return std::static_pointer_cast<Operation>(std::make_shared<OpFused>(engine, predicate));
+}
+
 OpDifference::OpDifference(IEngine &engine)
   : Operation(engine, OperationType::DIFFERENCE)
 {}
@@ -103,20 +124,34 @@ SetPtr OpUnion::execute(const SetPtrEnsemble &inputs)
   return engine_.sets_union(inputs);
 }
 
-OpFileReader::OpFileReader(IEngine &engine, const std::string &filename)
+OpFileReader::OpFileReader(IEngine &engine, const std::string &filename, SetCache *set_cache)
   : Operation(engine, OperationType::FILEREADER)
   , filename_(filename)
+  , set_cache_(set_cache)
 {}
 
 SetPtr OpFileReader::execute(const SetPtrEnsemble &)
 {
+  if (!set_cache_)
+  {
+    return engine_.read_file(filename_);
+  }
   if (!cache_)
   {
-    cache_ = engine_.read_file(filename_);
+    cache_ = set_cache_->get(filename_, [this] {
+      // A cached set outlives the evaluation, so it is not allocated from its arena.
+      ArenaScope outside_evaluation(nullptr);
+      return engine_.read_file(filename_);
+    });
   }
   return cache_;
 }
 
+bool OpFileReader::hasCachedResult() const
+{
+  return cache_ != nullptr;
+}
+
 OpHardcoded::OpHardcoded(IEngine &engine, const Set &data)
   : Operation(engine, OperationType::CONST_VECTOR)
   , data_(data)
@@ -157,7 +192,261 @@ SetPtr OpKeepIfPreciselyNMatches::execute(const SetPtrEnsemble &inputs)
   return engine_.keep_if_precisely_n_matches(inputs, parameter_);
 }
 
+OpFused::OpFused(IEngine &engine, const FusedPredicate &predicate)
+  : Operation(engine, OperationType::FUSED)
+  , predicate_(predicate)
+{}
+
+SetPtr OpFused::execute(const SetPtrEnsemble &inputs)
+{
+  if (inputs.size() != predicate_.leavesCount())
+  {
+    throw std::runtime_error("A fused operation over " + std::to_string(predicate_.leavesCount()) +
+                             " leaves got " + std::to_string(inputs.size()) + " inputs.");
+  }
+  return engine_.keep_if_fused(inputs, predicate_);
+}
+
 std::string Operation::description() const
 {
   return OP_NAMES.at(type());
 }
+
+std::string Operation::signature() const
+{
+  return description();
+}
+
+std::string OpFileReader::signature() const
+{
+  return description() + ":" + filename_;
+}
+
+const std::string &OpFileReader::filename() const
+{
+  return filename_;
+}
+
+std::string OpHardcoded::signature() const
+{
+  // Hardcoded sets are never compared by value, every instance is unique.
+  return description() + ":" + std::to_string(reinterpret_cast<uintptr_t>(this));
+}
+
+std::string OpFused::signature() const
+{
+  return description() + ":" + predicate_.description();
+}
+
+std::string OpKeepIfMoreThanNMatches::signature() const
+{
+  return description() + ":" + std::to_string(parameter_);
+}
+
+std::string OpKeepIfLessThanNMatches::signature() const
+{
+  return description() + ":" + std::to_string(parameter_);
+}
+
+std::string OpKeepIfPreciselyNMatches::signature() const
+{
+  return description() + ":" + std::to_string(parameter_);
+}
+
+int OpKeepIfMoreThanNMatches::parameter() const
+{
+  return parameter_;
+}
+
+int OpKeepIfLessThanNMatches::parameter() const
+{
+  return parameter_;
+}
+
+int OpKeepIfPreciselyNMatches::parameter() const
+{
+  return parameter_;
+}
+
+/**
+ * @brief A binary set file tells its value count in the header. Every value of a text file
+ * takes at least two bytes, a digit and a newline.
+ */
+size_t OpFileReader::estimatedSize() const
+{
+  if (SetFile::isSetFile(filename_))
+  {
+    try
+    {
+      return SetFile::count(filename_);
+    }
+    catch (std::runtime_error const &)
+    {
+      // The file is reported when it is read.
+      return Operation::estimatedSize();
+    }
+  }
+  struct stat file_stat;
+  if (::stat(filename_.c_str(), &file_stat) != 0)
+  {
+    return Operation::estimatedSize();
+  }
+  return size_t(file_stat.st_size + 1) / 2;
+}
+
+size_t OpHardcoded::estimatedSize() const
+{
+  return data_.size();
+}
+
+bool Operation::matchCondition(size_t, MatchCondition &) const
+{
+  return false;
+}
+
+bool OpDifference::matchCondition(size_t, MatchCondition &condition) const
+{
+  condition = MatchCondition{MatchCondition::Kind::EQUAL, 1};
+  return true;
+}
+
+bool OpIntersection::matchCondition(size_t inputs_count, MatchCondition &condition) const
+{
+  condition = MatchCondition{MatchCondition::Kind::EQUAL, inputs_count};
+  return true;
+}
+
+bool OpUnion::matchCondition(size_t, MatchCondition &condition) const
+{
+  condition = MatchCondition{MatchCondition::Kind::GREATER, 0};
+  return true;
+}
+
+bool OpKeepIfMoreThanNMatches::matchCondition(size_t, MatchCondition &condition) const
+{
+  condition = MatchCondition{MatchCondition::Kind::GREATER, size_t(parameter_)};
+  return true;
+}
+
+bool OpKeepIfLessThanNMatches::matchCondition(size_t, MatchCondition &condition) const
+{
+  condition = MatchCondition{MatchCondition::Kind::LESS, size_t(parameter_)};
+  return true;
+}
+
+bool OpKeepIfPreciselyNMatches::matchCondition(size_t, MatchCondition &condition) const
+{
+  condition = MatchCondition{MatchCondition::Kind::EQUAL, size_t(parameter_)};
+  return true;
+}
+
+OpQuery::OpQuery(IEngine &engine, const Query &query)
+  : Operation(engine, OperationType::QUERY)
+  , query_(query)
+{
+  if ((query_.kind == Query::Kind::TOP || query_.kind == Query::Kind::BOTTOM) && query_.k == 0)
+  {
+    throw std::runtime_error("Query " + query_.description() + " selects no values.");
+  }
+}
+
+SetPtr OpQuery::execute(const SetPtrEnsemble &inputs)
+{
+  if (pushed_down_)
+  {
+    return engine_.query_matches_if(inputs, condition_, query_);
+  }
+  if (inputs.size() != 1)
+  {
+    throw std::runtime_error("Query " + query_.description() + " takes a single input, got " +
+                             std::to_string(inputs.size()) + ".");
+  }
+  engine_.materialize(*inputs.front());
+  return answerQuery(*inputs.front(), query_, engine_.sorted_output());
+}
+
+const Query &OpQuery::query() const
+{
+  return query_;
+}
+
+bool OpQuery::pushedDownCondition(MatchCondition &condition) const
+{
+  if (pushed_down_)
+  {
+    condition = condition_;
+  }
+  return pushed_down_;
+}
+
+void OpQuery::pushDown(const Operation &operation, size_t inputs_count)
+{
+  if (!operation.matchCondition(inputs_count, condition_))
+  {
+    throw std::runtime_error("Can not push query " + query_.description() + " down into " +
+                             operation.description() + ".");
+  }
+  pushed_down_           = true;
+  pushed_down_signature_ = operation.signature();
+}
+
+std::string OpQuery::signature() const
+{
+  return description() + ":" + query_.description() +
+         (pushed_down_ ? " OF " + pushed_down_signature_ : "");
+}
+
+ValueStreamPtr Operation::stream(ValueStreams &&, const StreamOptions &) const
+{
+  throw std::runtime_error("Operation " + description() + " can not be streamed.");
+}
+
+ValueStreamPtr OpDifference::stream(ValueStreams &&inputs, const StreamOptions &) const
+{
+  return mergeStreams(std::move(inputs), 1, [](size_t matches) { return matches == 1; });
+}
+
+ValueStreamPtr OpIntersection::stream(ValueStreams &&inputs, const StreamOptions &) const
+{
+  const size_t n = inputs.size();
+  return mergeStreams(std::move(inputs), std::max(n, size_t(1)),
+                      [n](size_t matches) { return matches == n; });
+}
+
+ValueStreamPtr OpUnion::stream(ValueStreams &&inputs, const StreamOptions &) const
+{
+  return mergeStreams(std::move(inputs), 1, [](size_t) { return true; });
+}
+
+ValueStreamPtr OpFileReader::stream(ValueStreams &&, const StreamOptions &options) const
+{
+  return openFileStream(filename_, options);
+}
+
+ValueStreamPtr OpHardcoded::stream(ValueStreams &&, const StreamOptions &) const
+{
+  return openSetStream(data_);
+}
+
+ValueStreamPtr OpKeepIfMoreThanNMatches::stream(ValueStreams &&inputs,
+                                                const StreamOptions &) const
+{
+  const size_t n = size_t(parameter_);
+  return mergeStreams(std::move(inputs), std::max(n + 1, size_t(1)),
+                      [n](size_t matches) { return matches > n; });
+}
+
+ValueStreamPtr OpKeepIfLessThanNMatches::stream(ValueStreams &&inputs,
+                                                const StreamOptions &) const
+{
+  const size_t n = size_t(parameter_);
+  return mergeStreams(std::move(inputs), 1, [n](size_t matches) { return matches < n; });
+}
+
+ValueStreamPtr OpKeepIfPreciselyNMatches::stream(ValueStreams &&inputs,
+                                                 const StreamOptions &) const
+{
+  const size_t n = size_t(parameter_);
+  return mergeStreams(std::move(inputs), std::max(n, size_t(1)),
+                      [n](size_t matches) { return matches == n; });
+}
@@ -0,0 +1,368 @@
+#include "optimizer.hpp"
+
+#include "logger.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace {
+
+static constexpr size_t UNKNOWN_SIZE = std::numeric_limits<size_t>::max();
+
+inline size_t saturatingAdd(size_t lhs, size_t rhs)
+{
+  return lhs > UNKNOWN_SIZE - rhs ? UNKNOWN_SIZE : lhs + rhs;
+}
+
+/**
+ * @brief Estimates an upper bound of the result size of an operation from the bounds of its
+ * inputs: a value kept by a counting operation occurs in at least so many inputs.
+ */
+size_t estimateSize(OperationType type, size_t parameter, std::vector<size_t> const &inputs)
+{
+  size_t total    = 0;
+  size_t smallest = UNKNOWN_SIZE;
+  for (auto size : inputs)
+  {
+    total    = saturatingAdd(total, size);
+    smallest = std::min(smallest, size);
+  }
+  switch (type)
+  {
+  case OperationType::INTERSECTION:
+    return inputs.empty() ? 0 : smallest;
+  case OperationType::KEEP_IF_PRECISELY_N_MATCHES:
+    return total == UNKNOWN_SIZE || parameter == 0 ? total : total / parameter;
+  case OperationType::KEEP_IF_MORE_THAN_N_MATCHES:
+    return total == UNKNOWN_SIZE || parameter == UNKNOWN_SIZE ? total : total / (parameter + 1);
+  default:
+    return total;
+  }
+}
+
+std::vector<Optimizer::NodePtr> lockInputs(Node const &node)
+{
+  std::vector<Optimizer::NodePtr> inputs;
+  for (auto const &input : node.inputs())
+  {
+    auto input_ptr = input.lock();
+    if (!input_ptr)
+    {
+      throw std::runtime_error("Unable to lock weak pointer.");
+    }
+    inputs.push_back(input_ptr);
+  }
+  return inputs;
+}
+
+size_t estimatePlan(Node const &node, std::unordered_map<Node const *, size_t> &estimates)
+{
+  auto known = estimates.find(&node);
+  if (known != estimates.end())
+  {
+    return known->second;
+  }
+  const auto inputs = lockInputs(node);
+  size_t     size   = node.operation().estimatedSize();
+  if (!inputs.empty())
+  {
+    std::vector<size_t> input_sizes;
+    for (auto const &input : inputs)
+    {
+      input_sizes.push_back(estimatePlan(*input, estimates));
+    }
+    size = estimateSize(node.operationType(), size_t(node.operation().parameter()), input_sizes);
+  }
+  estimates[&node] = size;
+  return size;
+}
+
+void printSubplan(Node const &node, size_t depth,
+                  std::unordered_map<Node const *, size_t> &estimates,
+                  std::unordered_set<Node const *> &printed, std::ostream &output)
+{
+  output << std::string(depth * 2, ' ') << node.name() << " [" << node.signature() << "]";
+  if (!printed.insert(&node).second)
+  {
+    output << " (shared, see above)\n";
+    return;
+  }
+  const size_t estimate = estimatePlan(node, estimates);
+  if (estimate == UNKNOWN_SIZE)
+  {
+    output << " size unknown\n";
+  }
+  else
+  {
+    output << " at most " << estimate << " values\n";
+  }
+  for (auto const &input : lockInputs(node))
+  {
+    printSubplan(*input, depth + 1, estimates, printed, output);
+  }
+}
+
+}  // namespace
+
+Optimizer::Optimizer(IEngine &engine, std::map<std::string, NodePtr> &nodes)
+  : engine_(engine)
+  , nodes_(nodes)
+{}
+
+std::string Optimizer::optimize(const std::string &output_node_name)
+{
+  return optimize(std::vector<std::string>{output_node_name}).front();
+}
+
+std::vector<std::string> Optimizer::optimize(const std::vector<std::string> &output_node_names)
+{
+  std::vector<NodePtr> roots;
+  for (auto const &name : output_node_names)
+  {
+    roots.push_back(nodes_.at(name));
+    countParents(roots.back(), parents_);
+  }
+  std::vector<std::string> optimized_names;
+  for (auto &root : roots)
+  {
+    root = rewrite(root);
+    optimized_names.push_back(root->name());
+  }
+  removeUnreachable(roots);
+  Logger::instance() << "Optimizer applied " << rewrites_ << " rewrites.\n";
+  return optimized_names;
+}
+
+void Optimizer::printPlan(const Node &root, std::ostream &output)
+{
+  std::unordered_map<Node const *, size_t> estimates;
+  std::unordered_set<Node const *>         printed;
+  printSubplan(root, 0, estimates, printed, output);
+}
+
+void Optimizer::countParents(const NodePtr &node, std::unordered_map<Node const *, size_t> &visits)
+{
+  for (auto const &input : lockInputs(*node))
+  {
+    if (visits[input.get()]++ == 0)
+    {
+      countParents(input, visits);
+    }
+  }
+}
+
+/**
+ * @brief Returns the node computing the same result as the given one with less work. The
+ * inputs are rewritten first, so the rules see the already simplified subgraphs.
+ */
+Optimizer::NodePtr Optimizer::rewrite(const NodePtr &node)
+{
+  auto known = rewritten_.find(node.get());
+  if (known != rewritten_.end())
+  {
+    return known->second;
+  }
+  const auto original_inputs = lockInputs(*node);
+  if (original_inputs.empty())
+  {
+    estimates_[node.get()] = node->operation().estimatedSize();
+    rewritten_[node.get()] = node;
+    return node;
+  }
+
+  std::vector<NodePtr> inputs;
+  for (auto const &input : original_inputs)
+  {
+    inputs.push_back(rewrite(input));
+  }
+  auto is_empty = [this](NodePtr const &input) { return estimates_.at(input.get()) == 0; };
+
+  OperationType type      = node->operationType();
+  const size_t  parameter = size_t(node->operation().parameter());
+  NodePtr       result;
+  if (type == OperationType::INTERSECTION && std::any_of(inputs.begin(), inputs.end(), is_empty))
+  {
+    result = emptyNode();
+  }
+  else if (type != OperationType::QUERY)
+  {
+    // Empty inputs add no occurrences to any value, so no counting operation depends on them.
+    inputs.erase(std::remove_if(inputs.begin(), inputs.end(), is_empty), inputs.end());
+  }
+
+  const size_t count = inputs.size();
+  if (result)
+  {
+    // Already known to be empty.
+  }
+  else if (type == OperationType::KEEP_IF_PRECISELY_N_MATCHES)
+  {
+    if (parameter == 0 || parameter > count)
+    {
+      result = emptyNode();
+    }
+    else if (parameter == count)
+    {
+      type = OperationType::INTERSECTION;
+    }
+    else if (parameter == 1)
+    {
+      type = OperationType::DIFFERENCE;
+    }
+  }
+  else if (type == OperationType::KEEP_IF_MORE_THAN_N_MATCHES)
+  {
+    if (parameter >= count)
+    {
+      result = emptyNode();
+    }
+    else if (parameter == 0)
+    {
+      type = OperationType::UNION;
+    }
+    else if (parameter + 1 == count)
+    {
+      type = OperationType::INTERSECTION;
+    }
+  }
+  else if (type == OperationType::KEEP_IF_LESS_THAN_N_MATCHES)
+  {
+    // Every value of the inputs occurs at least once and at most count times.
+    if (parameter <= 1)
+    {
+      result = emptyNode();
+    }
+    else if (parameter > count)
+    {
+      type = OperationType::UNION;
+    }
+  }
+
+  if (!result && (type == OperationType::UNION || type == OperationType::INTERSECTION))
+  {
+    std::vector<NodePtr> flattened;
+    for (auto const &input : inputs)
+    {
+      // A nested operation read by others as well is kept, so it is still computed once.
+      if (input->operationType() == type && parents_[input.get()] == 1)
+      {
+        const auto nested = lockInputs(*input);
+        flattened.insert(flattened.end(), nested.begin(), nested.end());
+      }
+      else
+      {
+        flattened.push_back(input);
+      }
+    }
+    // Both operations are idempotent, a repeated input changes nothing.
+    inputs.clear();
+    for (auto const &input : flattened)
+    {
+      if (std::find(inputs.begin(), inputs.end(), input) == inputs.end())
+      {
+        inputs.push_back(input);
+      }
+    }
+    if (type == OperationType::INTERSECTION)
+    {
+      std::stable_sort(inputs.begin(), inputs.end(),
+                       [this](NodePtr const &lhs, NodePtr const &rhs) {
+                         return estimates_.at(lhs.get()) < estimates_.at(rhs.get());
+                       });
+    }
+  }
+
+  if (!result && (type == OperationType::UNION || type == OperationType::INTERSECTION ||
+                  type == OperationType::DIFFERENCE))
+  {
+    if (inputs.empty())
+    {
+      result = emptyNode();
+    }
+    else if (inputs.size() == 1)
+    {
+      // A single set has every value exactly once.
+      result = inputs.front();
+    }
+  }
+
+  if (!result && type == node->operationType())
+  {
+    if (inputs != original_inputs)
+    {
+      node->setInputs(std::vector<Node::NodeWeakPtr>(inputs.begin(), inputs.end()));
+      ++rewrites_;
+    }
+    result = node;
+  }
+  else if (!result)
+  {
+    result = makeNode(buildOperation(engine_, type), inputs);
+  }
+  if (result != node)
+  {
+    ++rewrites_;
+    Logger::instance() << "Node " << node->name() << " is rewritten as " << result->name()
+                       << ".\n";
+  }
+
+  if (estimates_.find(result.get()) == estimates_.end())
+  {
+    std::vector<size_t> input_sizes;
+    for (auto const &input : inputs)
+    {
+      input_sizes.push_back(estimates_.at(input.get()));
+    }
+    estimates_[result.get()] = estimateSize(type, parameter, input_sizes);
+  }
+  parents_[result.get()] = std::max(parents_[result.get()], parents_[node.get()]);
+  rewritten_[node.get()] = result;
+  return result;
+}
+
+Optimizer::NodePtr Optimizer::emptyNode()
+{
+  if (!empty_node_)
+  {
+    empty_node_ = makeNode(buildOperation(engine_, OperationType::CONST_VECTOR, Set{}), {});
+    estimates_[empty_node_.get()] = 0;
+  }
+  return empty_node_;
+}
+
+Optimizer::NodePtr Optimizer::makeNode(const OpPtr &operation, const std::vector<NodePtr> &inputs)
+{
+  std::string name;
+  for (size_t number = nodes_.size(); name.empty() || nodes_.count(name) > 0; ++number)
+  {
+    name = operation->description() + "_OPT_" + std::to_string(number);
+  }
+  auto node = std::make_shared<Node>(operation, name);
+  node->setInputs(std::vector<Node::NodeWeakPtr>(inputs.begin(), inputs.end()));
+  nodes_[name] = node;
+  return node;
+}
+
+void Optimizer::removeUnreachable(const std::vector<NodePtr> &roots)
+{
+  std::unordered_map<Node const *, size_t> reachable;
+  for (auto const &root : roots)
+  {
+    countParents(root, reachable);
+    reachable[root.get()] = 1;
+  }
+  for (auto it = nodes_.begin(); it != nodes_.end();)
+  {
+    if (reachable.count(it->second.get()) == 0)
+    {
+      it = nodes_.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+}
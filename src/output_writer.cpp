@@ -0,0 +1,155 @@
+#include "output_writer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+static constexpr size_t OUTPUT_BUFFER_SIZE = 1 << 20;
+// The longest line is a sign, 19 digits and a newline.
+static constexpr size_t MAX_LINE_LENGTH = 21;
+
+static constexpr char DIGIT_PAIRS[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/**
+ * @brief Formats the value followed by a newline into the output.
+ * @return the number of characters written, at most MAX_LINE_LENGTH.
+ */
+size_t formatLine(DataType value, char *output)
+{
+  char     digits[MAX_LINE_LENGTH];
+  char *   cursor    = digits + MAX_LINE_LENGTH;
+  uint64_t magnitude = value < 0 ? 0 - uint64_t(value) : uint64_t(value);
+
+  *--cursor = '\n';
+  while (magnitude >= 100)
+  {
+    const size_t pair = size_t(magnitude % 100) * 2;
+    magnitude /= 100;
+    *--cursor = DIGIT_PAIRS[pair + 1];
+    *--cursor = DIGIT_PAIRS[pair];
+  }
+  if (magnitude >= 10)
+  {
+    const size_t pair = size_t(magnitude) * 2;
+    *--cursor         = DIGIT_PAIRS[pair + 1];
+    *--cursor         = DIGIT_PAIRS[pair];
+  }
+  else
+  {
+    *--cursor = char('0' + magnitude);
+  }
+  if (value < 0)
+  {
+    *--cursor = '-';
+  }
+  const size_t length = size_t(digits + MAX_LINE_LENGTH - cursor);
+  std::memcpy(output, cursor, length);
+  return length;
+}
+
+}  // namespace
+
+OutputWriter::OutputWriter(int fd)
+  : name_("descriptor " + std::to_string(fd))
+  , fd_(fd)
+  , buffer_(OUTPUT_BUFFER_SIZE, '\0')
+{}
+
+OutputWriter::OutputWriter(const std::string &filename)
+  : name_("'" + filename + "'")
+  , fd_(::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644))
+  , owns_fd_(true)
+  , buffer_(OUTPUT_BUFFER_SIZE, '\0')
+{
+  if (fd_ < 0)
+  {
+    throw std::runtime_error("can not open " + name_ + " for writing: " + std::strerror(errno));
+  }
+}
+
+OutputWriter::~OutputWriter()
+{
+  try
+  {
+    flush();
+  }
+  catch (std::exception &)
+  {
+    // Nowhere to report from a destructor, call flush() explicitly to get the error.
+  }
+  if (owns_fd_)
+  {
+    ::close(fd_);
+  }
+}
+
+void OutputWriter::writeValue(DataType value)
+{
+  if (buffer_.size() - used_ < MAX_LINE_LENGTH)
+  {
+    flush();
+  }
+  used_ += formatLine(value, &buffer_[used_]);
+}
+
+void OutputWriter::writeText(const std::string &text)
+{
+  if (buffer_.size() - used_ < text.size())
+  {
+    flush();
+  }
+  if (text.size() > buffer_.size())
+  {
+    buffer_.resize(text.size());
+  }
+  text.copy(&buffer_[used_], text.size());
+  used_ += text.size();
+}
+
+void OutputWriter::writeSorted(Set &values, bool already_sorted)
+{
+  if (!already_sorted)
+  {
+    std::sort(values.begin(), values.end());
+  }
+  for (auto value : values)
+  {
+    writeValue(value);
+  }
+}
+
+void OutputWriter::flush()
+{
+  size_t written = 0;
+  while (written < used_)
+  {
+    const ssize_t result = ::write(fd_, buffer_.data() + written, used_ - written);
+    if (result < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      used_ = 0;
+      throw std::runtime_error("can not write to " + name_ + ": " + std::strerror(errno));
+    }
+    written += size_t(result);
+  }
+  used_ = 0;
+}
@@ -0,0 +1,185 @@
+#include "profiler.hpp"
+
+#include "arena.hpp"
+#include "node.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <stdexcept>
+
+#include <time.h>
+
+namespace {
+
+std::atomic<uint32_t> next_thread_number{0};
+thread_local uint32_t thread_number = next_thread_number++;
+
+const auto PROFILE_EPOCH = std::chrono::steady_clock::now();
+
+int64_t wallMicroseconds()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() -
+                                                               PROFILE_EPOCH)
+      .count();
+}
+
+int64_t threadCpuMicroseconds()
+{
+  struct timespec time;
+  ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+  return int64_t(time.tv_sec) * 1000000 + time.tv_nsec / 1000;
+}
+
+std::string escapeJson(std::string const &text)
+{
+  std::string escaped;
+  for (auto c : text)
+  {
+    if (c == '"' || c == '\\')
+    {
+      escaped.push_back('\\');
+    }
+    escaped.push_back(c);
+  }
+  return escaped;
+}
+
+}  // namespace
+
+Profiler::Record Profiler::begin(const Node &node, std::vector<size_t> input_sizes,
+                                 bool cache_hit) const
+{
+  Record record;
+  record.node        = &node;
+  record.name        = node.name();
+  record.operation   = node.signature();
+  record.thread      = thread_number;
+  record.cache_hit   = cache_hit;
+  record.input_sizes = std::move(input_sizes);
+  // Until the end, the counters hold the starting values.
+  record.bytes_allocated = Arena::allocatedByThread();
+  record.cpu_us          = threadCpuMicroseconds();
+  record.start_us        = wallMicroseconds();
+  return record;
+}
+
+void Profiler::end(Record &&record, size_t output_size)
+{
+  record.wall_us         = wallMicroseconds() - record.start_us;
+  record.cpu_us          = threadCpuMicroseconds() - record.cpu_us;
+  record.bytes_allocated = Arena::allocatedByThread() - record.bytes_allocated;
+  record.output_size     = output_size;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  records_.push_back(std::move(record));
+}
+
+/**
+ * @brief Prints the expression tree with the totals of every node's records. A subtree shared by
+ * several parents is printed in full only once.
+ */
+void Profiler::printTree(const Node &root, std::ostream &output) const
+{
+  std::vector<Node const *> printed;
+  std::lock_guard<std::mutex> lock(mutex_);
+  printSubtree(root, 0, printed, output);
+}
+
+void Profiler::printSubtree(const Node &node, size_t depth, std::vector<Node const *> &printed,
+                            std::ostream &output) const
+{
+  const std::string indent(depth * 2, ' ');
+  if (std::find(printed.begin(), printed.end(), &node) != printed.end())
+  {
+    output << indent << node.name() << " (shared, see above)\n";
+    return;
+  }
+  printed.push_back(&node);
+
+  size_t  executions = 0;
+  size_t  hits       = 0;
+  int64_t wall_us    = 0;
+  int64_t cpu_us     = 0;
+  size_t  allocated  = 0;
+  size_t  input_size = 0;
+  size_t  out_size   = 0;
+  for (auto const &record : records_)
+  {
+    if (record.node != &node)
+    {
+      continue;
+    }
+    ++executions;
+    hits += record.cache_hit ? 1 : 0;
+    wall_us += record.wall_us;
+    cpu_us += record.cpu_us;
+    allocated += record.bytes_allocated;
+    if (!record.input_sizes.empty() || executions == 1)
+    {
+      // Reads from the consumer cache carry no inputs, the cardinalities come from executions.
+      input_size = 0;
+      for (auto size : record.input_sizes)
+      {
+        input_size += size;
+      }
+      out_size = record.output_size;
+    }
+  }
+
+  output << indent << node.name() << " [" << node.signature() << "]";
+  if (executions == 0)
+  {
+    output << " not executed\n";
+  }
+  else
+  {
+    output << " in " << input_size << " out " << out_size;
+    if (input_size > 0)
+    {
+      output << " (selectivity " << double(out_size) / double(input_size) << ")";
+    }
+    output << ", wall " << wall_us / 1000.0 << " ms, cpu " << cpu_us / 1000.0 << " ms, allocated "
+           << allocated << " B, executions " << executions << ", cache hits " << hits << "\n";
+  }
+  for (auto const &input : node.inputs())
+  {
+    if (auto input_ptr = input.lock())
+    {
+      printSubtree(*input_ptr, depth + 1, printed, output);
+    }
+  }
+}
+
+void Profiler::writeChromeTrace(const std::string &filename) const
+{
+  std::ofstream trace(filename);
+  if (!trace.is_open())
+  {
+    throw std::runtime_error("can not open '" + filename + "' for writing the profile.");
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  trace << "{\"traceEvents\":[\n";
+  for (size_t i{0}; i < records_.size(); ++i)
+  {
+    auto const &record = records_[i];
+    trace << "{\"name\":\"" << escapeJson(record.name) << "\",\"cat\":\""
+          << escapeJson(record.operation) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << record.thread
+          << ",\"ts\":" << record.start_us << ",\"dur\":" << record.wall_us
+          << ",\"args\":{\"cpu_us\":" << record.cpu_us << ",\"inputs\":[";
+    for (size_t input{0}; input < record.input_sizes.size(); ++input)
+    {
+      trace << (input > 0 ? "," : "") << record.input_sizes[input];
+    }
+    trace << "],\"output\":" << record.output_size
+          << ",\"bytes_allocated\":" << record.bytes_allocated
+          << ",\"cache_hit\":" << (record.cache_hit ? "true" : "false") << "}}"
+          << (i + 1 < records_.size() ? ",\n" : "\n");
+  }
+  trace << "]}\n";
+  if (!trace)
+  {
+    throw std::runtime_error("can not write the profile to '" + filename + "'.");
+  }
+}
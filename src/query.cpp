@@ -0,0 +1,219 @@
+#include "query.hpp"
+
+#include "engine.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+
+namespace {
+
+/// TOP and MAX select the largest values, kept in a min-heap.
+bool selectsLargest(Query::Kind kind)
+{
+  return kind == Query::Kind::TOP || kind == Query::Kind::MAX;
+}
+
+/// The number of values a query selects.
+size_t selectionSize(Query const &query)
+{
+  return query.kind == Query::Kind::TOP || query.kind == Query::Kind::BOTTOM ? query.k : 1;
+}
+
+}  // namespace
+
+bool MatchCondition::accepts(size_t matches) const
+{
+  switch (kind)
+  {
+  case Kind::LESS:
+    return matches < n;
+  case Kind::EQUAL:
+    return matches == n;
+  case Kind::GREATER:
+    return matches > n;
+  }
+  return false;
+}
+
+bool MatchCondition::satisfiable(size_t max_matches) const
+{
+  switch (kind)
+  {
+  case Kind::LESS:
+    return n > 1;
+  case Kind::EQUAL:
+    return n >= 1 && n <= max_matches;
+  case Kind::GREATER:
+    return max_matches > n;
+  }
+  return false;
+}
+
+size_t MatchCondition::minMatches() const
+{
+  switch (kind)
+  {
+  case Kind::LESS:
+    return 1;
+  case Kind::EQUAL:
+    return std::max(n, size_t(1));
+  case Kind::GREATER:
+    return n + 1;
+  }
+  return 1;
+}
+
+std::string Query::description() const
+{
+  switch (kind)
+  {
+  case Kind::COUNT:
+    return "COUNT";
+  case Kind::MIN:
+    return "MIN";
+  case Kind::MAX:
+    return "MAX";
+  case Kind::TOP:
+    return "TOP " + std::to_string(k);
+  case Kind::BOTTOM:
+    return "BOTTOM " + std::to_string(k);
+  case Kind::EXISTS:
+    return "EXISTS";
+  }
+  return "INVALID";
+}
+
+QueryAccumulator::QueryAccumulator(const Query &query, bool ascending)
+  : query_(query)
+  , ascending_(ascending)
+{
+  if (!countsOnly())
+  {
+    selected_.reserve(std::min<size_t>(selectionSize(query_), 1 << 16));
+  }
+}
+
+bool QueryAccumulator::add(DataType value)
+{
+  if (countsOnly())
+  {
+    ++count_;
+    return query_.kind == Query::Kind::COUNT;
+  }
+  const size_t limit = selectionSize(query_);
+  if (selectsLargest(query_.kind))
+  {
+    if (selected_.size() < limit)
+    {
+      selected_.push_back(value);
+      std::push_heap(selected_.begin(), selected_.end(), std::greater<DataType>());
+    }
+    else if (value > selected_.front())
+    {
+      std::pop_heap(selected_.begin(), selected_.end(), std::greater<DataType>());
+      selected_.back() = value;
+      std::push_heap(selected_.begin(), selected_.end(), std::greater<DataType>());
+    }
+    return true;
+  }
+  if (selected_.size() < limit)
+  {
+    selected_.push_back(value);
+    std::push_heap(selected_.begin(), selected_.end());
+  }
+  else if (value < selected_.front())
+  {
+    std::pop_heap(selected_.begin(), selected_.end());
+    selected_.back() = value;
+    std::push_heap(selected_.begin(), selected_.end());
+  }
+  return !done();
+}
+
+void QueryAccumulator::addCount(size_t count)
+{
+  if (!countsOnly())
+  {
+    throw std::runtime_error("Query " + query_.description() + " needs the values themselves.");
+  }
+  count_ += count;
+}
+
+void QueryAccumulator::absorb(const QueryAccumulator &part)
+{
+  count_ += part.count_;
+  std::vector<DataType> values(part.selected_);
+  std::sort(values.begin(), values.end());
+  for (auto value : values)
+  {
+    add(value);
+  }
+}
+
+bool QueryAccumulator::countsOnly() const
+{
+  return query_.kind == Query::Kind::COUNT || query_.kind == Query::Kind::EXISTS;
+}
+
+bool QueryAccumulator::done() const
+{
+  if (query_.kind == Query::Kind::EXISTS)
+  {
+    return count_ > 0;
+  }
+  // The values to come are all larger than the selected ones.
+  return ascending_ && !countsOnly() && !selectsLargest(query_.kind) &&
+         selected_.size() == selectionSize(query_);
+}
+
+SetPtr QueryAccumulator::result() const
+{
+  auto result = Helpers::makeEvaluationSet(Arena::current());
+  switch (query_.kind)
+  {
+  case Query::Kind::COUNT:
+    result->push_back(DataType(count_));
+    break;
+  case Query::Kind::EXISTS:
+    result->push_back(count_ > 0 ? 1 : 0);
+    break;
+  default:
+    result->assign(selected_.begin(), selected_.end());
+    std::sort(result->begin(), result->end());
+    break;
+  }
+  return result;
+}
+
+/**
+ * @brief A set knows its size, and a sorted one has its largest values at the end, so neither a
+ * count nor a selection reads more values than it returns when the set is sorted.
+ */
+SetPtr answerQuery(const Set &set, const Query &query, bool ascending)
+{
+  QueryAccumulator answer(query, ascending);
+  if (answer.countsOnly())
+  {
+    answer.addCount(set.size());
+  }
+  else if (ascending && selectsLargest(query.kind))
+  {
+    const size_t selected = std::min(selectionSize(query), set.size());
+    for (auto it = set.end() - std::ptrdiff_t(selected); it != set.end(); ++it)
+    {
+      answer.add(*it);
+    }
+  }
+  else
+  {
+    for (auto value : set)
+    {
+      if (!answer.add(value))
+      {
+        break;
+      }
+    }
+  }
+  return answer.result();
+}
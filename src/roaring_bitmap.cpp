@@ -0,0 +1,340 @@
+#include "roaring_bitmap.hpp"
+
+#include <algorithm>
+
+constexpr size_t RoaringBitmap::CHUNK_BITS;
+constexpr size_t RoaringBitmap::BITSET_WORDS;
+constexpr size_t RoaringBitmap::MAX_ARRAY_SIZE;
+
+namespace {
+
+static constexpr DataType CHUNK_MASK = (DataType(1) << RoaringBitmap::CHUNK_BITS) - 1;
+
+inline DataType keyOf(DataType value)
+{
+  return value >> RoaringBitmap::CHUNK_BITS;  // arithmetic shift keeps negative keys ordered
+}
+
+inline DataType valueOf(DataType key, uint32_t low)
+{
+  return key * (CHUNK_MASK + 1) + DataType(low);
+}
+
+/// Bytes taken by a container of every kind, used to pick the cheapest one.
+inline size_t arrayBytes(size_t cardinality)
+{
+  return cardinality * sizeof(uint16_t);
+}
+
+inline size_t runBytes(size_t runs)
+{
+  return runs * 2 * sizeof(uint16_t);
+}
+
+static constexpr size_t BITSET_BYTES = RoaringBitmap::BITSET_WORDS * sizeof(uint64_t);
+
+}  // namespace
+
+void RoaringBitmap::Container::addTo(uint64_t *output) const
+{
+  switch (kind)
+  {
+  case Kind::ARRAY:
+    for (auto value : values)
+    {
+      output[value >> 6] |= uint64_t(1) << (value & 63);
+    }
+    break;
+  case Kind::BITSET:
+    for (size_t i{0}; i < BITSET_WORDS; ++i)
+    {
+      output[i] |= words[i];
+    }
+    break;
+  case Kind::RUN:
+    for (size_t i{0}; i < values.size(); i += 2)
+    {
+      const uint32_t first = values[i];
+      const uint32_t last  = first + values[i + 1];
+      for (uint32_t word = first >> 6; word <= last >> 6; ++word)
+      {
+        const uint32_t from = std::max(first, word << 6) & 63;
+        const uint32_t to   = std::min(last, (word << 6) + 63) & 63;
+        output[word] |= (~uint64_t(0) >> (63 - to)) & (~uint64_t(0) << from);
+      }
+    }
+    break;
+  }
+}
+
+RoaringBitmap::Container RoaringBitmap::makeContainer(std::vector<uint16_t> &&values)
+{
+  Container container;
+  container.cardinality = uint32_t(values.size());
+
+  size_t runs = values.empty() ? 0 : 1;
+  for (size_t i{1}; i < values.size(); ++i)
+  {
+    runs += values[i] != values[i - 1] + 1 ? 1 : 0;
+  }
+
+  if (runBytes(runs) < std::min(arrayBytes(values.size()), BITSET_BYTES))
+  {
+    container.kind = Container::Kind::RUN;
+    container.values.reserve(runs * 2);
+    size_t run_begin = 0;
+    for (size_t i{1}; i <= values.size(); ++i)
+    {
+      if (i == values.size() || values[i] != values[i - 1] + 1)
+      {
+        container.values.push_back(values[run_begin]);
+        container.values.push_back(uint16_t(i - 1 - run_begin));
+        run_begin = i;
+      }
+    }
+  }
+  else if (values.size() <= MAX_ARRAY_SIZE)
+  {
+    container.kind   = Container::Kind::ARRAY;
+    container.values = std::move(values);
+  }
+  else
+  {
+    container.kind = Container::Kind::BITSET;
+    container.words.assign(BITSET_WORDS, 0);
+    for (auto value : values)
+    {
+      container.words[value >> 6] |= uint64_t(1) << (value & 63);
+    }
+  }
+  return container;
+}
+
+RoaringBitmap::Container RoaringBitmap::makeContainer(const uint64_t *words)
+{
+  Container container;
+  size_t    cardinality = 0;
+  size_t    runs        = 0;
+  uint64_t  carry       = 0;  // the highest bit of the previous word
+  for (size_t i{0}; i < BITSET_WORDS; ++i)
+  {
+    const uint64_t word = words[i];
+    cardinality += size_t(__builtin_popcountll(word));
+    // A run starts at every set bit whose lower neighbour is clear.
+    runs += size_t(__builtin_popcountll(word & ~((word << 1) | carry)));
+    carry = word >> 63;
+  }
+  container.cardinality = uint32_t(cardinality);
+
+  if (runBytes(runs) < std::min(arrayBytes(cardinality), BITSET_BYTES) ||
+      cardinality <= MAX_ARRAY_SIZE)
+  {
+    std::vector<uint16_t> values;
+    values.reserve(cardinality);
+    for (size_t i{0}; i < BITSET_WORDS; ++i)
+    {
+      for (uint64_t word = words[i]; word != 0; word &= word - 1)
+      {
+        values.push_back(uint16_t((i << 6) + size_t(__builtin_ctzll(word))));
+      }
+    }
+    return makeContainer(std::move(values));
+  }
+  container.kind = Container::Kind::BITSET;
+  container.words.assign(words, words + BITSET_WORDS);
+  return container;
+}
+
+RoaringBitmap RoaringBitmap::fromSorted(const Set &values)
+{
+  RoaringBitmap         bitmap;
+  std::vector<uint16_t> chunk;
+  size_t                begin = 0;
+  while (begin < values.size())
+  {
+    const DataType key = keyOf(values[begin]);
+    size_t         end = begin;
+    chunk.clear();
+    while (end < values.size() && keyOf(values[end]) == key)
+    {
+      chunk.push_back(uint16_t(values[end] & CHUNK_MASK));
+      ++end;
+    }
+    bitmap.append(key, makeContainer(std::vector<uint16_t>(chunk)));
+    begin = end;
+  }
+  return bitmap;
+}
+
+void RoaringBitmap::append(DataType key, Container &&container)
+{
+  if (container.cardinality == 0)
+  {
+    return;
+  }
+  keys_.push_back(key);
+  containers_.push_back(std::move(container));
+}
+
+void RoaringBitmap::appendTo(Set &output) const
+{
+  output.reserve(output.size() + cardinality());
+  for (size_t c{0}; c < containers_.size(); ++c)
+  {
+    const DataType   key       = keys_[c];
+    const Container &container = containers_[c];
+    switch (container.kind)
+    {
+    case Container::Kind::ARRAY:
+      for (auto value : container.values)
+      {
+        output.push_back(valueOf(key, value));
+      }
+      break;
+    case Container::Kind::BITSET:
+      for (size_t i{0}; i < BITSET_WORDS; ++i)
+      {
+        for (uint64_t word = container.words[i]; word != 0; word &= word - 1)
+        {
+          output.push_back(valueOf(key, uint32_t((i << 6) + size_t(__builtin_ctzll(word)))));
+        }
+      }
+      break;
+    case Container::Kind::RUN:
+      for (size_t i{0}; i < container.values.size(); i += 2)
+      {
+        const uint32_t first = container.values[i];
+        for (uint32_t value = first; value <= first + container.values[i + 1]; ++value)
+        {
+          output.push_back(valueOf(key, value));
+        }
+      }
+      break;
+    }
+  }
+}
+
+/**
+ * @brief Finds the chunk of the value by a binary search of the keys, then the value in its
+ * container: by a bit of a bitset, or by binary searches of the values or the runs.
+ */
+bool RoaringBitmap::contains(DataType value) const
+{
+  const auto key = std::lower_bound(keys_.begin(), keys_.end(), keyOf(value));
+  if (key == keys_.end() || *key != keyOf(value))
+  {
+    return false;
+  }
+  const Container &container = containers_[size_t(key - keys_.begin())];
+  const uint16_t   low       = uint16_t(value & CHUNK_MASK);
+  switch (container.kind)
+  {
+  case Container::Kind::ARRAY:
+    return std::binary_search(container.values.begin(), container.values.end(), low);
+  case Container::Kind::BITSET:
+    return (container.words[low >> 6] >> (low & 63)) & 1;
+  case Container::Kind::RUN:
+  {
+    // The last run starting at or below the value, runs being pairs of (start, length - 1).
+    size_t first = 0;
+    size_t count = container.values.size() / 2;
+    while (count > 0)
+    {
+      const size_t half = count / 2;
+      if (container.values[2 * (first + half)] <= low)
+      {
+        first += half + 1;
+        count -= half + 1;
+      }
+      else
+      {
+        count = half;
+      }
+    }
+    if (first == 0)
+    {
+      return false;
+    }
+    const uint32_t start = container.values[2 * (first - 1)];
+    return uint32_t(low) <= start + container.values[2 * (first - 1) + 1];
+  }
+  }
+  return false;
+}
+
+void RoaringBitmap::forEach(std::function<bool(DataType)> const &visit) const
+{
+  for (size_t c{0}; c < containers_.size(); ++c)
+  {
+    const DataType   key       = keys_[c];
+    const Container &container = containers_[c];
+    switch (container.kind)
+    {
+    case Container::Kind::ARRAY:
+      for (auto value : container.values)
+      {
+        if (!visit(valueOf(key, value)))
+        {
+          return;
+        }
+      }
+      break;
+    case Container::Kind::BITSET:
+      for (size_t i{0}; i < BITSET_WORDS; ++i)
+      {
+        for (uint64_t word = container.words[i]; word != 0; word &= word - 1)
+        {
+          if (!visit(valueOf(key, uint32_t((i << 6) + size_t(__builtin_ctzll(word))))))
+          {
+            return;
+          }
+        }
+      }
+      break;
+    case Container::Kind::RUN:
+      for (size_t i{0}; i < container.values.size(); i += 2)
+      {
+        const uint32_t first = container.values[i];
+        for (uint32_t value = first; value <= first + container.values[i + 1]; ++value)
+        {
+          if (!visit(valueOf(key, value)))
+          {
+            return;
+          }
+        }
+      }
+      break;
+    }
+  }
+}
+
+size_t RoaringBitmap::cardinality() const
+{
+  size_t total = 0;
+  for (const auto &container : containers_)
+  {
+    total += container.cardinality;
+  }
+  return total;
+}
+
+size_t RoaringBitmap::memoryUsage() const
+{
+  size_t total = keys_.capacity() * sizeof(DataType) + containers_.capacity() * sizeof(Container);
+  for (const auto &container : containers_)
+  {
+    total += container.values.capacity() * sizeof(uint16_t) +
+             container.words.capacity() * sizeof(uint64_t);
+  }
+  return total;
+}
+
+const std::vector<DataType> &RoaringBitmap::keys() const
+{
+  return keys_;
+}
+
+const std::vector<RoaringBitmap::Container> &RoaringBitmap::containers() const
+{
+  return containers_;
+}
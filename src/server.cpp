@@ -0,0 +1,195 @@
+#include "server.hpp"
+
+#include "expression.hpp"
+#include "logger.hpp"
+#include "output_writer.hpp"
+#include "set_cache.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+static constexpr size_t READ_BUFFER_SIZE = 1 << 16;
+static constexpr int    LISTEN_BACKLOG   = 64;
+
+/// Splits the input of a descriptor into lines, reading it in big chunks.
+class LineReader
+{
+public:
+  explicit LineReader(int fd)
+    : fd_(fd)
+    , buffer_(READ_BUFFER_SIZE, '\0')
+  {}
+
+  // Returns false at the end of the input, the last line may lack a newline.
+  bool readLine(std::string &line)
+  {
+    line.clear();
+    while (true)
+    {
+      while (begin_ < end_)
+      {
+        const char c = buffer_[begin_++];
+        if (c == '\n')
+        {
+          return true;
+        }
+        line.push_back(c);
+      }
+      const ssize_t result = ::read(fd_, &buffer_[0], buffer_.size());
+      if (result < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      if (result <= 0)
+      {
+        return !line.empty();
+      }
+      begin_ = 0;
+      end_   = size_t(result);
+    }
+  }
+
+private:
+  int         fd_;
+  std::string buffer_;
+  size_t      begin_{0};
+  size_t      end_{0};
+};
+
+inline bool isBlankLine(std::string const &line)
+{
+  return line.find_first_not_of(" \t\r") == std::string::npos;
+}
+
+}  // namespace
+
+Server::Server(IEngine &engine, SetCache &set_cache, ThreadPool *thread_pool)
+  : engine_(engine)
+  , set_cache_(set_cache)
+  , thread_pool_(thread_pool)
+{}
+
+void Server::serveStream(int input_fd, int output_fd)
+{
+  LineReader   reader(input_fd);
+  OutputWriter writer(output_fd);
+  std::string  line;
+  while (reader.readLine(line))
+  {
+    if (isBlankLine(line))
+    {
+      continue;
+    }
+    answer(line, writer);
+    // Every response is complete before the next expression is read.
+    writer.flush();
+  }
+}
+
+void Server::serveSocket(const std::string &path)
+{
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path))
+  {
+    throw std::runtime_error("the socket path '" + path + "' is too long.");
+  }
+  path.copy(address.sun_path, path.size());
+
+  const int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0)
+  {
+    throw std::runtime_error(std::string("can not create a socket: ") + std::strerror(errno));
+  }
+  ::unlink(path.c_str());
+  if (::bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+      ::listen(listener, LISTEN_BACKLOG) != 0)
+  {
+    const std::string reason = std::strerror(errno);
+    ::close(listener);
+    throw std::runtime_error("can not listen on '" + path + "': " + reason);
+  }
+  // A client which disconnects early must fail its own responses, not the whole server.
+  std::signal(SIGPIPE, SIG_IGN);
+  Logger::instance() << "Listening on '" << path << "'\n";
+
+  while (true)
+  {
+    const int client = ::accept(listener, nullptr, nullptr);
+    if (client < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+      {
+        continue;
+      }
+      const std::string reason = std::strerror(errno);
+      ::close(listener);
+      throw std::runtime_error("can not accept a connection on '" + path + "': " + reason);
+    }
+    std::thread([this, client] {
+      try
+      {
+        serveStream(client, client);
+      }
+      catch (std::exception &e)
+      {
+        Logger::instance() << "Client dropped: " << e.what() << "\n";
+      }
+      ::close(client);
+    }).detach();
+  }
+}
+
+/**
+ * @brief Evaluates the expression with a fresh graph over the shared engine and set cache.
+ * Errors of the expression are reported to the client, errors of the output are thrown.
+ */
+void Server::answer(const std::string &expression_text, OutputWriter &writer)
+{
+  auto start = std::chrono::steady_clock::now();
+
+  SetPtr result;
+  try
+  {
+    Expression expression(engine_);
+    expression.setThreadPool(thread_pool_);
+    expression.setSetCache(&set_cache_);
+    expression.buildFromUserInput(expression_text);
+    result = expression.evaluateShared();
+  }
+  catch (std::exception &e)
+  {
+    std::string reason = e.what();
+    std::replace(reason.begin(), reason.end(), '\n', ' ');
+    writer.writeText("ERROR " + reason + "\n");
+    return;
+  }
+
+  // A set of the shared file cache may be read by other clients meanwhile, so it is sorted as
+  // a copy.
+  if (!engine_.sorted_output())
+  {
+    Helpers::makeExclusive(result);
+  }
+  writer.writeText("OK " + std::to_string(result->size()) + "\n");
+  writer.writeSorted(*result, engine_.sorted_output());
+
+  auto       end          = std::chrono::steady_clock::now();
+  const auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+  Logger::instance() << "Answered '" << expression_text << "' with " << result->size()
+                     << " values in " << microseconds.count() / 1000.0 << " ms, cache "
+                     << set_cache_.hits() << " hits, " << set_cache_.misses() << " misses, "
+                     << set_cache_.usedBytes() << " bytes\n";
+}
@@ -0,0 +1,97 @@
+#include "set_cache.hpp"
+
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+SetCache::SetCache(size_t capacity_bytes, Sizer memory_of)
+  : capacity_bytes_(capacity_bytes)
+  , memory_of_(memory_of ? std::move(memory_of)
+                         : [](Set const &set) { return set.capacity() * sizeof(DataType); })
+{}
+
+SetPtr SetCache::get(const std::string &filename, const Loader &loader)
+{
+  struct stat file_stat;
+  if (::stat(filename.c_str(), &file_stat) != 0)
+  {
+    throw std::runtime_error("can not open '" + filename + "', nothing to process.");
+  }
+  const int64_t mtime_ns =
+      int64_t(file_stat.st_mtim.tv_sec) * 1000000000 + int64_t(file_stat.st_mtim.tv_nsec);
+  const int64_t file_size = int64_t(file_stat.st_size);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto                        found = index_.find(filename);
+    if (found != index_.end())
+    {
+      auto entry = found->second;
+      if (entry->mtime_ns == mtime_ns && entry->file_size == file_size)
+      {
+        ++hits_;
+        entries_.splice(entries_.begin(), entries_, entry);
+        return entry->set;
+      }
+      used_bytes_ -= entry->bytes;
+      entries_.erase(entry);
+      index_.erase(found);
+    }
+    ++misses_;
+  }
+
+  // Loading takes long, so it runs unlocked. Concurrent misses of a file load it several times,
+  // the last of them stays in the cache.
+  SetPtr set = loader();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto                        found = index_.find(filename);
+  if (found != index_.end())
+  {
+    used_bytes_ -= found->second->bytes;
+    entries_.erase(found->second);
+    index_.erase(found);
+  }
+  Entry entry;
+  entry.filename  = filename;
+  entry.mtime_ns  = mtime_ns;
+  entry.file_size = file_size;
+  entry.set       = set;
+  entry.bytes     = memory_of_(*set);
+  used_bytes_ += entry.bytes;
+  entries_.push_front(std::move(entry));
+  index_[filename] = entries_.begin();
+  evictOverCapacity();
+  return set;
+}
+
+size_t SetCache::hits() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hits_;
+}
+
+size_t SetCache::misses() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return misses_;
+}
+
+size_t SetCache::usedBytes() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return used_bytes_;
+}
+
+/**
+ * @brief Drops the least recently used entries until the rest fits, keeping at least the newest.
+ */
+void SetCache::evictOverCapacity()
+{
+  while (used_bytes_ > capacity_bytes_ && entries_.size() > 1)
+  {
+    used_bytes_ -= entries_.back().bytes;
+    index_.erase(entries_.back().filename);
+    entries_.pop_back();
+  }
+}
@@ -0,0 +1,315 @@
+#include "set_file.hpp"
+
+#include "logger.hpp"
+#include "mapped_file.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+const std::string SetFile::EXTENSION = ".sset";
+
+namespace {
+
+static constexpr char     MAGIC[]         = {'S', 'C', 'A', 'L', 'C', 'S', 'E', 'T'};
+static constexpr uint32_t FORMAT_VERSION  = 1;
+static constexpr uint32_t SORTED_UNIQUE   = 1;  // the only payload layout so far
+static constexpr size_t   HEADER_SIZE     = 56;
+static constexpr size_t   MAX_VARINT_SIZE = 10;  // 64 bits by 7 per byte
+
+struct Header
+{
+  uint32_t version{FORMAT_VERSION};
+  uint32_t flags{SORTED_UNIQUE};
+  uint64_t count{0};
+  DataType min{0};
+  DataType max{0};
+  uint64_t payload_size{0};
+  uint64_t checksum{0};
+};
+
+void storeLittleEndian(uint64_t value, size_t bytes, char *output)
+{
+  for (size_t i{0}; i < bytes; ++i)
+  {
+    output[i] = char(value >> (i * 8));
+  }
+}
+
+uint64_t loadLittleEndian(const char *input, size_t bytes)
+{
+  uint64_t value = 0;
+  for (size_t i{0}; i < bytes; ++i)
+  {
+    value |= uint64_t(static_cast<unsigned char>(input[i])) << (i * 8);
+  }
+  return value;
+}
+
+std::string encodeHeader(Header const &header)
+{
+  std::string bytes(HEADER_SIZE, '\0');
+  std::memcpy(&bytes[0], MAGIC, sizeof(MAGIC));
+  storeLittleEndian(header.version, 4, &bytes[8]);
+  storeLittleEndian(header.flags, 4, &bytes[12]);
+  storeLittleEndian(header.count, 8, &bytes[16]);
+  storeLittleEndian(uint64_t(header.min), 8, &bytes[24]);
+  storeLittleEndian(uint64_t(header.max), 8, &bytes[32]);
+  storeLittleEndian(header.payload_size, 8, &bytes[40]);
+  storeLittleEndian(header.checksum, 8, &bytes[48]);
+  return bytes;
+}
+
+Header decodeHeader(const char *bytes)
+{
+  Header header;
+  header.version      = uint32_t(loadLittleEndian(bytes + 8, 4));
+  header.flags        = uint32_t(loadLittleEndian(bytes + 12, 4));
+  header.count        = loadLittleEndian(bytes + 16, 8);
+  header.min          = DataType(loadLittleEndian(bytes + 24, 8));
+  header.max          = DataType(loadLittleEndian(bytes + 32, 8));
+  header.payload_size = loadLittleEndian(bytes + 40, 8);
+  header.checksum     = loadLittleEndian(bytes + 48, 8);
+  return header;
+}
+
+/// Hashes the payload 8 bytes at a time, it is not meant to resist a deliberate forgery.
+uint64_t checksumOf(const char *begin, const char *end)
+{
+  static constexpr uint64_t MULTIPLIER = 0x9E3779B97F4A7C15;
+  uint64_t                  hash       = 0xCBF29CE484222325;
+  while (end - begin >= 8)
+  {
+    hash = (hash ^ loadLittleEndian(begin, 8)) * MULTIPLIER;
+    hash ^= hash >> 29;
+    begin += 8;
+  }
+  hash = (hash ^ loadLittleEndian(begin, size_t(end - begin))) * MULTIPLIER;
+  return hash ^ (hash >> 29);
+}
+
+inline size_t varintSize(uint64_t value)
+{
+  size_t size = 1;
+  for (; value >= 0x80; value >>= 7)
+  {
+    ++size;
+  }
+  return size;
+}
+
+inline char *encodeVarint(uint64_t value, char *output)
+{
+  while (value >= 0x80)
+  {
+    *output++ = char(value | 0x80);
+    value >>= 7;
+  }
+  *output++ = char(value);
+  return output;
+}
+
+[[noreturn]] void throwCorrupted(std::string const &filename, std::string const &reason)
+{
+  throw std::runtime_error("corrupted set file '" + filename + "': " + reason + ".");
+}
+
+}  // namespace
+
+namespace SetFile {
+
+bool hasExtension(const std::string &filename)
+{
+  return filename.size() >= EXTENSION.size() &&
+         filename.compare(filename.size() - EXTENSION.size(), EXTENSION.size(), EXTENSION) == 0;
+}
+
+bool isSetFile(const std::string &filename)
+{
+  if (hasExtension(filename))
+  {
+    return true;
+  }
+  std::ifstream file(filename, std::ios::binary);
+  char          magic[sizeof(MAGIC)];
+  return file.read(magic, sizeof(magic)) && std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+Reader::Reader(const std::string &filename)
+  : filename_(filename)
+  , file_(filename)
+  , cursor_(file_.begin() + HEADER_SIZE)
+{
+  if (file_.size() < HEADER_SIZE || std::memcmp(file_.begin(), MAGIC, sizeof(MAGIC)) != 0)
+  {
+    throwCorrupted("no set file header");
+  }
+  const Header header = decodeHeader(file_.begin());
+  if (header.version != FORMAT_VERSION || header.flags != SORTED_UNIQUE)
+  {
+    throwCorrupted("unsupported format version " + std::to_string(header.version));
+  }
+  if (header.payload_size != uint64_t(file_.end() - cursor_))
+  {
+    throwCorrupted("the payload is truncated");
+  }
+  if (checksumOf(cursor_, file_.end()) != header.checksum)
+  {
+    throwCorrupted("checksum mismatch");
+  }
+  // Every value takes at least a byte, which bounds the count by the payload size.
+  if (header.count > header.payload_size)
+  {
+    throwCorrupted("the value count does not match the payload");
+  }
+  count_ = header.count;
+  max_   = header.max;
+  value_ = uint64_t(header.min);
+}
+
+size_t Reader::count() const
+{
+  return size_t(count_);
+}
+
+size_t Reader::fileSize() const
+{
+  return file_.size();
+}
+
+bool Reader::next(DataType &value)
+{
+  if (read_ == count_)
+  {
+    if (cursor_ != file_.end() || (count_ != 0 && DataType(value_) != max_))
+    {
+      throwCorrupted("the values do not match the header");
+    }
+    return false;
+  }
+  uint64_t delta = 0;
+  for (size_t shift{0};; shift += 7)
+  {
+    if (cursor_ == file_.end() || shift >= MAX_VARINT_SIZE * 7)
+    {
+      throwCorrupted("malformed value " + std::to_string(read_));
+    }
+    const uint64_t byte = static_cast<unsigned char>(*cursor_++);
+    delta |= (byte & 0x7F) << shift;
+    if (byte < 0x80)
+    {
+      break;
+    }
+  }
+  // The values are stored sorted and unique from the minimum on, so the deltas after the first
+  // one are positive. A wrapped delta shows as a value below the previous one.
+  if (read_ == 0 && delta != 0)
+  {
+    throwCorrupted("the values do not match the header");
+  }
+  if (read_ > 0 && DataType(value_ + delta) <= DataType(value_))
+  {
+    throwCorrupted("value " + std::to_string(read_) + " is not above the previous one");
+  }
+  value_ += delta;
+  ++read_;
+  value = DataType(value_);
+  return true;
+}
+
+void Reader::throwCorrupted(const std::string &reason) const
+{
+  ::throwCorrupted(filename_, reason);
+}
+
+Set read(const std::string &filename)
+{
+  auto start = std::chrono::steady_clock::now();
+
+  Reader reader(filename);
+  Set    values;
+  values.reserve(reader.count());
+  DataType value;
+  while (reader.next(value))
+  {
+    values.push_back(value);
+  }
+
+  auto       finish       = std::chrono::steady_clock::now();
+  const auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(finish - start);
+  Logger::instance() << "Loaded " << values.size() << " values from set file '" << filename
+                     << "' (" << reader.fileSize() << " bytes) in "
+                     << microseconds.count() / 1000.0 << " ms\n";
+  return values;
+}
+
+size_t count(const std::string &filename)
+{
+  std::ifstream file(filename, std::ios::binary);
+  if (!file.is_open())
+  {
+    throw std::runtime_error("can not open '" + filename + "'.");
+  }
+  char bytes[HEADER_SIZE];
+  if (!file.read(bytes, sizeof(bytes)) || std::memcmp(bytes, MAGIC, sizeof(MAGIC)) != 0)
+  {
+    throwCorrupted(filename, "no set file header");
+  }
+  const Header header = decodeHeader(bytes);
+  if (header.version != FORMAT_VERSION || header.flags != SORTED_UNIQUE)
+  {
+    throwCorrupted(filename, "unsupported format version " + std::to_string(header.version));
+  }
+  return size_t(header.count);
+}
+
+void write(const std::string &filename, Set &values, bool already_sorted)
+{
+  if (!already_sorted)
+  {
+    std::sort(values.begin(), values.end());
+  }
+
+  Header header;
+  header.count = values.size();
+  if (!values.empty())
+  {
+    header.min = values.front();
+    header.max = values.back();
+  }
+  // The deltas wider than 63 bits wrap around, the reader wraps them back.
+  uint64_t previous = uint64_t(header.min);
+  for (auto value : values)
+  {
+    header.payload_size += varintSize(uint64_t(value) - previous);
+    previous = uint64_t(value);
+  }
+  std::string payload(header.payload_size, '\0');
+  char *      cursor = &payload[0];
+  previous           = uint64_t(header.min);
+  for (auto value : values)
+  {
+    cursor   = encodeVarint(uint64_t(value) - previous, cursor);
+    previous = uint64_t(value);
+  }
+  header.checksum     = checksumOf(payload.data(), payload.data() + payload.size());
+
+  std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+  if (!file.is_open())
+  {
+    throw std::runtime_error("can not open '" + filename + "' for writing.");
+  }
+  const std::string header_bytes = encodeHeader(header);
+  file.write(header_bytes.data(), std::streamsize(header_bytes.size()));
+  file.write(payload.data(), std::streamsize(payload.size()));
+  file.flush();
+  if (!file)
+  {
+    throw std::runtime_error("can not write to '" + filename + "'.");
+  }
+}
+
+}  // namespace SetFile
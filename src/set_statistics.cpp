@@ -0,0 +1,288 @@
+#include "set_statistics.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+struct SampledValue
+{
+  uint64_t hash;
+  DataType value;
+
+  bool operator<(SampledValue const &other) const
+  {
+    return hash < other.hash;
+  }
+};
+
+/// The largest number of values the operation may keep out of the given inputs.
+size_t resultBound(std::vector<StatisticsPtr> const &inputs, MatchCondition condition,
+                   size_t distinct_values)
+{
+  size_t total    = 0;
+  size_t smallest = SIZE_MAX;
+  for (auto const &input : inputs)
+  {
+    total += input->size;
+    smallest = std::min(smallest, input->size);
+  }
+  if (condition.kind == MatchCondition::Kind::EQUAL && condition.n == inputs.size())
+  {
+    return smallest;
+  }
+  return std::min(distinct_values, total / condition.minMatches());
+}
+
+}  // namespace
+
+HyperLogLog::HyperLogLog()
+{
+  registers_.fill(0);
+}
+
+void HyperLogLog::add(uint64_t hash)
+{
+  const size_t   index = size_t(hash >> (64 - PRECISION));
+  const uint64_t rest  = hash << PRECISION;
+  const uint8_t  rank  = rest == 0 ? uint8_t(64 - PRECISION + 1)
+                                   : uint8_t(__builtin_clzll(rest) + 1);
+  registers_[index]    = std::max(registers_[index], rank);
+}
+
+void HyperLogLog::merge(const HyperLogLog &other)
+{
+  for (size_t i{0}; i < REGISTERS; ++i)
+  {
+    registers_[i] = std::max(registers_[i], other.registers_[i]);
+  }
+}
+
+/**
+ * @brief The harmonic mean of the registers, corrected by linear counting of the empty registers
+ * for small sets, where the mean is biased.
+ */
+size_t HyperLogLog::estimate() const
+{
+  double sum   = 0;
+  size_t zeros = 0;
+  for (auto rank : registers_)
+  {
+    sum += std::ldexp(1.0, -int(rank));
+    zeros += rank == 0 ? 1 : 0;
+  }
+  const double registers = double(REGISTERS);
+  const double alpha     = 0.7213 / (1 + 1.079 / registers);
+  double       estimate  = alpha * registers * registers / sum;
+  if (estimate <= 2.5 * registers && zeros > 0)
+  {
+    estimate = registers * std::log(registers / double(zeros));
+  }
+  return size_t(estimate + 0.5);
+}
+
+/// The finalizer of SplitMix64: every bit of the hash depends on every bit of the value.
+uint64_t SetStatistics::hashOf(DataType value)
+{
+  uint64_t hash = uint64_t(value);
+  hash          = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  hash          = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+  return hash ^ (hash >> 31);
+}
+
+SetStatistics SetStatistics::collect(const Set &set)
+{
+  SetStatistics statistics;
+  statistics.size = set.size();
+  if (set.empty())
+  {
+    return statistics;
+  }
+  statistics.min = statistics.max = set.front();
+
+  // A max-heap of the values with the smallest hashes seen so far.
+  std::vector<SampledValue> sampled;
+  sampled.reserve(SAMPLE_SIZE);
+  for (auto value : set)
+  {
+    statistics.min      = std::min(statistics.min, value);
+    statistics.max      = std::max(statistics.max, value);
+    const uint64_t hash = hashOf(value);
+    statistics.sketch.add(hash);
+    if (sampled.size() < SAMPLE_SIZE)
+    {
+      sampled.push_back(SampledValue{hash, value});
+      std::push_heap(sampled.begin(), sampled.end());
+    }
+    else if (hash < sampled.front().hash)
+    {
+      std::pop_heap(sampled.begin(), sampled.end());
+      sampled.back() = SampledValue{hash, value};
+      std::push_heap(sampled.begin(), sampled.end());
+    }
+  }
+  if (set.size() > SAMPLE_SIZE)
+  {
+    statistics.sample_threshold = sampled.front().hash;
+  }
+  std::sort_heap(sampled.begin(), sampled.end());
+  for (auto const &entry : sampled)
+  {
+    statistics.sample.push_back(entry.value);
+  }
+  return statistics;
+}
+
+/**
+ * @brief The sampled values of all the inputs hashed up to the lowest threshold are a uniform
+ * sample of the union, and the number of inputs holding each of them is known exactly. The share
+ * of them the condition keeps, applied to the distinct values of the inputs, estimates the size
+ * of the result; the kept ones are the sample of the result.
+ */
+SetStatistics SetStatistics::estimate(const std::vector<StatisticsPtr> &inputs,
+                                      MatchCondition                    condition)
+{
+  SetStatistics result;
+  result.exact = false;
+  if (inputs.empty() || !condition.satisfiable(inputs.size()))
+  {
+    return result;
+  }
+
+  uint64_t threshold = UINT64_MAX;
+  for (auto const &input : inputs)
+  {
+    threshold = std::min(threshold, input->sample_threshold);
+    result.sketch.merge(input->sketch);
+  }
+  std::vector<SampledValue> sampled;
+  for (auto const &input : inputs)
+  {
+    for (auto value : input->sample)
+    {
+      const uint64_t hash = hashOf(value);
+      if (hash <= threshold)
+      {
+        sampled.push_back(SampledValue{hash, value});
+      }
+    }
+  }
+  std::sort(sampled.begin(), sampled.end(), [](SampledValue const &lhs, SampledValue const &rhs) {
+    return lhs.hash < rhs.hash || (lhs.hash == rhs.hash && lhs.value < rhs.value);
+  });
+  size_t union_sampled = 0;
+  for (size_t i{0}; i < sampled.size();)
+  {
+    size_t end = i + 1;
+    while (end < sampled.size() && sampled[end].value == sampled[i].value)
+    {
+      ++end;
+    }
+    ++union_sampled;
+    if (condition.accepts(end - i))
+    {
+      result.sample.push_back(sampled[i].value);
+    }
+    i = end;
+  }
+  result.sample_threshold = threshold;
+
+  const size_t distinct_values = distinctValues(inputs);
+  const size_t bound           = resultBound(inputs, condition, distinct_values);
+  result.size                  = union_sampled > 0
+                    ? size_t(double(distinct_values) * double(result.sample.size()) /
+                                 double(union_sampled) +
+                             0.5)
+                    : 0;
+  result.size = std::min(result.size, bound);
+
+  // An intersection lies within every input, anything else within all of them together.
+  const bool narrows =
+      condition.kind == MatchCondition::Kind::EQUAL && condition.n == inputs.size();
+  if (narrows && disjoint(inputs))
+  {
+    result.size = 0;
+    result.sample.clear();
+    return result;
+  }
+  bool first = true;
+  for (auto const &input : inputs)
+  {
+    if (input->size == 0)
+    {
+      continue;
+    }
+    result.min = first ? input->min : narrows ? std::max(result.min, input->min)
+                                              : std::min(result.min, input->min);
+    result.max = first ? input->max : narrows ? std::min(result.max, input->max)
+                                              : std::max(result.max, input->max);
+    first      = false;
+  }
+  return result;
+}
+
+bool SetStatistics::disjoint(const std::vector<StatisticsPtr> &inputs)
+{
+  DataType highest_min = std::numeric_limits<DataType>::min();
+  DataType lowest_max  = std::numeric_limits<DataType>::max();
+  for (auto const &input : inputs)
+  {
+    if (input->size == 0)
+    {
+      return true;
+    }
+    highest_min = std::max(highest_min, input->min);
+    lowest_max  = std::min(lowest_max, input->max);
+  }
+  return highest_min > lowest_max;
+}
+
+double SetStatistics::density() const
+{
+  return size == 0 ? 0.0 : double(size) / (double(max) - double(min) + 1);
+}
+
+/**
+ * @brief The estimate of the merged sketches, which can be neither less than the largest input
+ * nor more than all the inputs together.
+ */
+size_t SetStatistics::distinctValues(const std::vector<StatisticsPtr> &inputs)
+{
+  HyperLogLog merged;
+  size_t      largest = 0;
+  size_t      total   = 0;
+  for (auto const &input : inputs)
+  {
+    merged.merge(input->sketch);
+    largest = std::max(largest, input->size);
+    total += input->size;
+  }
+  return std::max(largest, std::min(total, merged.estimate()));
+}
+
+StatisticsPtr StatisticsCache::of(const SetPtr &set)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto const                  known = entries_.find(set.get());
+    if (known != entries_.end() && known->second.set.lock() == set)
+    {
+      return known->second.statistics;
+    }
+  }
+  remember(set, SetStatistics::collect(*set));
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.at(set.get()).statistics;
+}
+
+void StatisticsCache::remember(const SetPtr &set, SetStatistics statistics)
+{
+  auto                        shared = std::make_shared<const SetStatistics>(std::move(statistics));
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto it = entries_.begin(); it != entries_.end();)
+  {
+    it = it->second.set.expired() ? entries_.erase(it) : std::next(it);
+  }
+  entries_[set.get()] = Entry{set, shared};
+}
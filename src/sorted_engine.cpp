@@ -0,0 +1,670 @@
+#include "sorted_engine.hpp"
+
+#include "file_reader.hpp"
+#include "set_file.hpp"
+#include "sorted_kernels.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+// Below this total input size splitting a merge into parts costs more than it saves.
+static constexpr size_t PARALLEL_MERGE_THRESHOLD = 1 << 16;
+static constexpr size_t SAMPLES_PER_PART         = 8;
+// A set this many times larger than the running intersection is probed by galloping, a smaller
+// one is merged linearly.
+static constexpr size_t GALLOPING_RATIO = 32;
+
+void sort_unique(Set &values)
+{
+  if (!std::is_sorted(values.begin(), values.end()))
+  {
+    std::sort(values.begin(), values.end());
+  }
+  values.erase(std::unique(values.begin(), values.end()), values.end());
+}
+
+/// A read position in one of the merged sets.
+struct Cursor
+{
+  Set::const_iterator position;
+  Set::const_iterator end;
+};
+
+bool operator>(Cursor const &lhs, Cursor const &rhs)
+{
+  return *lhs.position > *rhs.position;
+}
+
+/**
+ * @brief Moves the heap top down until the min-heap property is restored. Used instead of
+ * a pop_heap + push_heap pair after the top cursor is advanced, which costs twice as much.
+ */
+void sift_down_top(std::vector<Cursor> &heap)
+{
+  const size_t size  = heap.size();
+  size_t       index = 0;
+  while (true)
+  {
+    const size_t left     = 2 * index + 1;
+    const size_t right    = left + 1;
+    size_t       smallest = index;
+    if (left < size && heap[smallest] > heap[left])
+    {
+      smallest = left;
+    }
+    if (right < size && heap[smallest] > heap[right])
+    {
+      smallest = right;
+    }
+    if (smallest == index)
+    {
+      return;
+    }
+    std::swap(heap[index], heap[smallest]);
+    index = smallest;
+  }
+}
+
+/**
+ * @brief Merges the ranges and passes the values whose number of occurrences satisfies the
+ * condition to emit(value) in ascending order, until it returns false.
+ * @param min_matches the smallest occurrence count the condition may accept; the merge stops as
+ * soon as fewer ranges than that are left unexhausted.
+ */
+template <typename Emit>
+void merge(std::vector<Cursor> heap, size_t min_matches,
+           std::function<bool(size_t)> const &condition, Emit emit)
+{
+  heap.erase(std::remove_if(heap.begin(), heap.end(),
+                            [](Cursor const &cursor) { return cursor.position == cursor.end; }),
+             heap.end());
+  std::make_heap(heap.begin(), heap.end(), std::greater<Cursor>());
+
+  while (!heap.empty() && heap.size() >= min_matches)
+  {
+    const DataType value   = *heap.front().position;
+    size_t         matches = 0;
+    while (!heap.empty() && *heap.front().position == value)
+    {
+      ++matches;
+      Cursor &top = heap.front();
+      if (++top.position == top.end)
+      {
+        std::pop_heap(heap.begin(), heap.end(), std::greater<Cursor>());
+        heap.pop_back();
+      }
+      else
+      {
+        sift_down_top(heap);
+      }
+    }
+    if (condition(matches) && !emit(value))
+    {
+      return;
+    }
+  }
+}
+
+/**
+ * @brief Merges the ranges by the vectorized kernels and keeps the values whose number of
+ * occurrences satisfies the condition. Two sets are united or intersected in one pass, and an
+ * intersection of more sets narrows the first one down in place. Otherwise the ranges are merged
+ * pairwise, keeping the duplicates, in a tree of log(ranges) levels, and the runs of equal
+ * values of the merged array are counted.
+ * @param arena the arena the temporary buffers are allocated from
+ */
+void merge_with_kernels(std::vector<Cursor> ranges, MatchCondition condition, Arena *arena,
+                        Set &output)
+{
+  ranges.erase(std::remove_if(ranges.begin(), ranges.end(),
+                              [](Cursor const &range) { return range.position == range.end; }),
+               ranges.end());
+  output.clear();
+  if (ranges.empty() || !condition.satisfiable(ranges.size()))
+  {
+    return;
+  }
+  const auto size_of = [](Cursor const &range) { return size_t(range.end - range.position); };
+  if (ranges.size() == 1)
+  {
+    if (condition.accepts(1))
+    {
+      output.assign(ranges.front().position, ranges.front().end);
+    }
+    return;
+  }
+
+  if (condition.kind == MatchCondition::Kind::GREATER && condition.n == 0 && ranges.size() == 2)
+  {
+    output.resize(size_of(ranges[0]) + size_of(ranges[1]) + SortedKernels::SLACK);
+    output.resize(SortedKernels::unite(&*ranges[0].position, size_of(ranges[0]),
+                                       &*ranges[1].position, size_of(ranges[1]), output.data()));
+    return;
+  }
+  if (condition.kind == MatchCondition::Kind::EQUAL && condition.n == ranges.size())
+  {
+    std::sort(ranges.begin(), ranges.end(),
+              [&](Cursor const &lhs, Cursor const &rhs) { return size_of(lhs) < size_of(rhs); });
+    output.resize(size_of(ranges[0]) + SortedKernels::SLACK);
+    size_t size = SortedKernels::intersect(&*ranges[0].position, size_of(ranges[0]),
+                                           &*ranges[1].position, size_of(ranges[1]),
+                                           output.data());
+    for (size_t i{2}; i < ranges.size() && size > 0; ++i)
+    {
+      size = SortedKernels::intersect(output.data(), size, &*ranges[i].position,
+                                      size_of(ranges[i]), output.data());
+    }
+    output.resize(size);
+    return;
+  }
+
+  // Every level of the tree is merged into one buffer, the merged pairs follow each other in
+  // the order of ranges; the last level goes to the output.
+  struct Span
+  {
+    const DataType *data;
+    size_t          size;
+  };
+  std::vector<Span> spans;
+  size_t            total = 0;
+  for (const auto &range : ranges)
+  {
+    spans.push_back(Span{&*range.position, size_of(range)});
+    total += size_of(range);
+  }
+  size_t levels = 0;
+  for (size_t width{1}; width < spans.size(); width *= 2)
+  {
+    ++levels;
+  }
+  Set  temporary{ArenaAllocator<DataType>(arena)};
+  Set *buffers[2] = {&output, &temporary};
+  output.resize(total);
+  temporary.resize(levels > 1 ? total : 0);
+  for (size_t level{0}; level < levels; ++level)
+  {
+    DataType *const   merged = buffers[(levels - 1 - level) % 2]->data();
+    std::vector<Span> next;
+    size_t            offset = 0;
+    for (size_t i{0}; i < spans.size(); i += 2)
+    {
+      if (i + 1 == spans.size())
+      {
+        // The odd span waits for the next level where it is.
+        next.push_back(spans[i]);
+        continue;
+      }
+      const size_t size = SortedKernels::merge(spans[i].data, spans[i].size, spans[i + 1].data,
+                                               spans[i + 1].size, merged + offset);
+      next.push_back(Span{merged + offset, size});
+      offset += size;
+    }
+    spans.swap(next);
+  }
+  output.resize(SortedKernels::keepMatches(output.data(), total, condition, output.data()));
+}
+
+/**
+ * @brief Cuts the value domain into consecutive intervals by splitters sampled from all the
+ * ranges, so every interval can be merged on its own.
+ * @return the cursors of every range for every interval, in the ascending order of intervals
+ */
+std::vector<std::vector<Cursor>> partition(ThreadPool &pool, std::vector<Cursor> const &ranges)
+{
+  // More parts than threads smooth out the uneven interval sizes.
+  const size_t parts_count = 2 * (pool.size() + 1);
+
+  std::vector<DataType> samples;
+  for (const auto &range : ranges)
+  {
+    const size_t size = size_t(range.end - range.position);
+    for (size_t i{0}; size > 0 && i < parts_count * SAMPLES_PER_PART; ++i)
+    {
+      samples.push_back(range.position[i * size / (parts_count * SAMPLES_PER_PART)]);
+    }
+  }
+  std::sort(samples.begin(), samples.end());
+  std::vector<DataType> splitters;
+  for (size_t part{1}; part < parts_count && !samples.empty(); ++part)
+  {
+    const DataType splitter = samples[part * samples.size() / parts_count];
+    if (splitters.empty() || splitters.back() < splitter)
+    {
+      splitters.push_back(splitter);
+    }
+  }
+
+  // Part p takes the values in [splitters[p - 1], splitters[p]) of every range.
+  std::vector<std::vector<Cursor>> parts(splitters.size() + 1);
+  for (const auto &range : ranges)
+  {
+    auto begin = range.position;
+    for (size_t part{0}; part < parts.size(); ++part)
+    {
+      auto end = part < splitters.size()
+                     ? std::lower_bound(begin, range.end, splitters[part])
+                     : range.end;
+      parts[part].push_back(Cursor{begin, end});
+      begin = end;
+    }
+  }
+  return parts;
+}
+
+/**
+ * @brief Merges the leaves of a fused predicate by scanning the heads of all of them: the
+ * smallest head is the next value, the leaves whose heads equal it make up its mask and advance.
+ */
+void merge_fused(std::vector<Cursor> ranges, FusedPredicate const &predicate, Set &output)
+{
+  std::vector<size_t> active;  // the leaves not exhausted yet
+  size_t              total = 0;
+  for (size_t leaf{0}; leaf < ranges.size(); ++leaf)
+  {
+    if (ranges[leaf].position != ranges[leaf].end)
+    {
+      active.push_back(leaf);
+      total += size_t(ranges[leaf].end - ranges[leaf].position);
+    }
+  }
+  output.resize(total);
+  size_t size = 0;
+  while (!active.empty())
+  {
+    DataType value = *ranges[active.front()].position;
+    for (auto leaf : active)
+    {
+      value = std::min(value, *ranges[leaf].position);
+    }
+    uint64_t mask = 0;
+    for (size_t i{0}; i < active.size();)
+    {
+      Cursor &range = ranges[active[i]];
+      if (*range.position == value)
+      {
+        mask |= uint64_t(1) << active[i];
+        if (++range.position == range.end)
+        {
+          active[i] = active.back();
+          active.pop_back();
+          continue;
+        }
+      }
+      ++i;
+    }
+    output[size] = value;
+    size += predicate.accepts(mask) ? 1 : 0;
+  }
+  output.resize(size);
+}
+
+/**
+ * @brief A parallel equivalent of merge_part(ranges, output). Every interval of partition() is
+ * merged on its own and the sorted interval results are concatenated in order.
+ */
+template <typename MergePart>
+SetPtr merge_partitioned(ThreadPool &pool, std::vector<Cursor> const &ranges, MergePart merge_part)
+{
+  Arena *const arena = Arena::current();
+  const auto   parts = partition(pool, ranges);
+  // Copies of a prototype set would get the heap allocator, so every set is made on its own.
+  std::vector<Set> part_results;
+  part_results.reserve(parts.size());
+  for (size_t part{0}; part < parts.size(); ++part)
+  {
+    part_results.emplace_back(ArenaAllocator<DataType>(arena));
+  }
+  TaskLatch merged(parts.size());
+  for (size_t part{0}; part < parts.size(); ++part)
+  {
+    pool.submit([&, part] {
+      merge_part(parts[part], part_results[part]);
+      merged.countDown();
+    });
+  }
+  merged.wait(pool);
+
+  size_t result_size = 0;
+  for (const auto &part_result : part_results)
+  {
+    result_size += part_result.size();
+  }
+  auto result = Helpers::makeEvaluationSet(arena);
+  result->reserve(result_size);
+  for (const auto &part_result : part_results)
+  {
+    result->insert(result->end(), part_result.begin(), part_result.end());
+  }
+  return result;
+}
+
+/**
+ * @brief Finds the first element not less than the value by an exponential search from the
+ * beginning of the range followed by a binary search within the last step, which costs
+ * O(log distance) instead of O(log size).
+ */
+Set::const_iterator gallop_lower_bound(Set::const_iterator begin, Set::const_iterator end,
+                                       DataType value)
+{
+  size_t step = 1;
+  while (step < size_t(end - begin) && begin[step] < value)
+  {
+    begin += step;
+    step *= 2;
+  }
+  return std::lower_bound(begin, begin + std::min(step + 1, size_t(end - begin)), value);
+}
+
+/**
+ * @brief Keeps the values of the sorted candidates found in the sorted set, in place.
+ * @return the number of elements of the set touched.
+ */
+size_t keep_found(Set &candidates, Set const &set)
+{
+  auto   kept = candidates.begin();
+  size_t cost = 0;
+  if (set.size() >= GALLOPING_RATIO * candidates.size())
+  {
+    auto position = set.cbegin();
+    for (auto candidate : candidates)
+    {
+      position = gallop_lower_bound(position, set.cend(), candidate);
+      ++cost;
+      if (position == set.cend())
+      {
+        break;
+      }
+      if (*position == candidate)
+      {
+        *kept++ = candidate;
+      }
+    }
+  }
+  else
+  {
+    kept = candidates.begin() + std::ptrdiff_t(SortedKernels::intersect(
+                                    candidates.data(), candidates.size(), set.data(), set.size(),
+                                    candidates.data()));
+    cost = set.size();
+  }
+  candidates.erase(kept, candidates.end());
+  return cost;
+}
+
+}  // namespace
+
+/**
+ * @brief Intersects the sets starting from the smallest one, which is then narrowed down by
+ * every larger set in the order of size. A much larger set is probed by galloping, so the cost
+ * follows the size of the smallest set rather than the total; the intersection stops as soon as
+ * nothing is left.
+ * @return a sorted set
+ */
+SetPtr SortedEngine::intersect_adaptive(const SetPtrEnsemble &sets)
+{
+  if (sets.empty())
+  {
+    return Helpers::makeEvaluationSet(Arena::current());
+  }
+  std::vector<SetPtr const *> by_size;
+  for (const auto &set : sets)
+  {
+    by_size.push_back(&set);
+  }
+  std::sort(by_size.begin(), by_size.end(), [](SetPtr const *lhs, SetPtr const *rhs) {
+    return (*lhs)->size() < (*rhs)->size();
+  });
+
+  // The smallest set is narrowed down in place, unless somebody else holds it.
+  SetPtr result;
+  if (Helpers::isReusable(*by_size.front()))
+  {
+    result = *by_size.front();
+  }
+  else
+  {
+    result = Helpers::makeEvaluationSet(Arena::current());
+    result->assign((*by_size.front())->begin(), (*by_size.front())->end());
+  }
+  size_t total = result->size();
+  for (size_t i{1}; i < by_size.size() && !result->empty(); ++i)
+  {
+    total += keep_found(*result, **by_size[i]);
+  }
+  total_processed_ += total;
+  return result;
+}
+
+/**
+ * @brief Merges all the sets and keeps the values whose number of occurrences satisfies the
+ * condition.
+ * @return a sorted set
+ */
+SetPtr SortedEngine::merge_matches_if(const SetPtrEnsemble &sets, MatchCondition condition)
+{
+  std::vector<Cursor> ranges;
+  ranges.reserve(sets.size());
+  size_t total = 0;
+  for (const auto &set : sets)
+  {
+    total += set->size();
+    ranges.push_back(Cursor{set->cbegin(), set->cend()});
+  }
+  total_processed_ += total;
+
+  if (thread_pool_ != nullptr && total >= PARALLEL_MERGE_THRESHOLD)
+  {
+    Arena *const arena = Arena::current();
+    return merge_partitioned(*thread_pool_, ranges,
+                             [&](std::vector<Cursor> const &part, Set &output) {
+                               merge_with_kernels(part, condition, arena, output);
+                             });
+  }
+  auto result = Helpers::makeEvaluationSet(Arena::current());
+  merge_with_kernels(ranges, condition, Arena::current(), *result);
+  return result;
+}
+
+/**
+ * @brief Merges the sets like merge_matches_if() but passes the kept values to the query, so
+ * MIN, BOTTOM and EXISTS stop the merge as soon as they got enough values. With a thread pool
+ * set, the other queries are answered in every value interval on its own and combined.
+ */
+SetPtr SortedEngine::query_matches_if(const SetPtrEnsemble &sets, MatchCondition condition,
+                                      Query const &query)
+{
+  QueryAccumulator answer(query, true);
+  if (sets.empty() || !condition.satisfiable(sets.size()))
+  {
+    return answer.result();
+  }
+  if (condition.kind == MatchCondition::Kind::EQUAL && condition.n == sets.size() &&
+      is_skewed(sets))
+  {
+    // The result of galloping is no larger than the smallest set.
+    return answerQuery(*intersect_adaptive(sets), query, true);
+  }
+
+  std::vector<Cursor> ranges;
+  ranges.reserve(sets.size());
+  size_t total = 0;
+  for (const auto &set : sets)
+  {
+    total += set->size();
+    ranges.push_back(Cursor{set->cbegin(), set->cend()});
+  }
+  total_processed_ += total;
+
+  const auto accepts = [&condition](size_t matches) { return condition.accepts(matches); };
+  const bool stops_early =
+      query.kind == Query::Kind::MIN || query.kind == Query::Kind::BOTTOM ||
+      query.kind == Query::Kind::EXISTS;
+  if (thread_pool_ != nullptr && total >= PARALLEL_MERGE_THRESHOLD && !stops_early)
+  {
+    const auto                    parts = partition(*thread_pool_, ranges);
+    std::vector<QueryAccumulator> part_answers(parts.size(), answer);
+    TaskLatch                     merged(parts.size());
+    for (size_t part{0}; part < parts.size(); ++part)
+    {
+      thread_pool_->submit([&, part] {
+        merge(parts[part], condition.minMatches(), accepts,
+              [&](DataType value) { return part_answers[part].add(value); });
+        merged.countDown();
+      });
+    }
+    merged.wait(*thread_pool_);
+    for (auto const &part_answer : part_answers)
+    {
+      answer.absorb(part_answer);
+    }
+    return answer.result();
+  }
+  merge(ranges, condition.minMatches(), accepts,
+        [&answer](DataType value) { return answer.add(value); });
+  return answer.result();
+}
+
+/**
+ * @brief Merges all the leaves at once and keeps the values whose masks of the leaves holding
+ * them the predicate accepts, so no result of an inner operation is built.
+ * @return a sorted set
+ */
+SetPtr SortedEngine::keep_if_fused(const SetPtrEnsemble &sets, FusedPredicate const &predicate)
+{
+  std::vector<Cursor> ranges;
+  ranges.reserve(sets.size());
+  size_t total = 0;
+  for (const auto &set : sets)
+  {
+    total += set->size();
+    ranges.push_back(Cursor{set->cbegin(), set->cend()});
+  }
+  total_processed_ += total;
+
+  if (thread_pool_ != nullptr && total >= PARALLEL_MERGE_THRESHOLD)
+  {
+    return merge_partitioned(*thread_pool_, ranges,
+                             [&predicate](std::vector<Cursor> const &part, Set &output) {
+                               merge_fused(part, predicate, output);
+                             });
+  }
+  auto result = Helpers::makeEvaluationSet(Arena::current());
+  merge_fused(ranges, predicate, *result);
+  return result;
+}
+
+bool SortedEngine::sorted_output() const
+{
+  return true;
+}
+
+size_t SortedEngine::total_processed()
+{
+  return total_processed_;
+}
+
+void SortedEngine::set_thread_pool(ThreadPool *pool)
+{
+  thread_pool_       = pool;
+  read_options_.pool = pool;
+}
+
+void SortedEngine::set_read_chunk_size(size_t bytes)
+{
+  read_options_.chunk_bytes = bytes;
+}
+
+SetPtr SortedEngine::keep_if_less_than_n_matches(const SetPtrEnsemble &sets, int n)
+{
+  return merge_matches_if(sets, MatchCondition{MatchCondition::Kind::LESS, size_t(n)});
+}
+
+SetPtr SortedEngine::keep_if_precisely_n_matches(const SetPtrEnsemble &sets, int n)
+{
+  return merge_matches_if(sets, MatchCondition{MatchCondition::Kind::EQUAL, size_t(n)});
+}
+
+SetPtr SortedEngine::keep_if_greater_than_n_matches(const SetPtrEnsemble &sets, int n)
+{
+  return merge_matches_if(sets, MatchCondition{MatchCondition::Kind::GREATER, size_t(n)});
+}
+
+SetPtr SortedEngine::sets_intersection(const SetPtrEnsemble &sets)
+{
+  // Large sets of similar sizes are merged faster in value intervals on all the threads.
+  const bool all_large = std::all_of(sets.begin(), sets.end(), [](SetPtr const &set) {
+    return set->size() >= PARALLEL_MERGE_THRESHOLD;
+  });
+  if (thread_pool_ != nullptr && !sets.empty() && all_large && !is_skewed(sets))
+  {
+    return keep_if_precisely_n_matches(sets, int(sets.size()));
+  }
+  return intersect_adaptive(sets);
+}
+
+/**
+ * @brief Tells the largest set is so much larger than the smallest one that probing it by
+ * galloping beats merging.
+ */
+bool SortedEngine::is_skewed(const SetPtrEnsemble &sets) const
+{
+  size_t smallest = std::numeric_limits<size_t>::max();
+  size_t largest  = 0;
+  for (const auto &set : sets)
+  {
+    smallest = std::min(smallest, size_of(*set));
+    largest  = std::max(largest, size_of(*set));
+  }
+  return !sets.empty() && largest >= GALLOPING_RATIO * smallest;
+}
+
+SetPtr SortedEngine::sets_difference(const SetPtrEnsemble &sets)
+{
+  return keep_if_precisely_n_matches(sets, 1);
+}
+
+SetPtr SortedEngine::sets_union(const SetPtrEnsemble &sets)
+{
+  return keep_if_greater_than_n_matches(sets, 0);
+}
+
+/**
+ * @brief With a thread pool, a large file is parsed in chunks, which are sorted concurrently and
+ * merged in value intervals like the sets of a union, dropping the duplicates on the way.
+ */
+SetPtr SortedEngine::read_file(const std::string filename)
+{
+  if (SetFile::isSetFile(filename))
+  {
+    auto result = std::make_shared<Set>(SetFile::read(filename));
+    total_processed_ += result->size();
+    return result;
+  }
+  auto chunks = FileReader::readIntegerChunks(filename, Arena::current(), read_options_);
+  if (chunks.size() == 1)
+  {
+    auto result = std::make_shared<Set>(std::move(chunks.front()));
+    sort_unique(*result);
+    total_processed_ += result->size();
+    return result;
+  }
+
+  SetPtrEnsemble sorted_chunks(chunks.size());
+  TaskLatch      sorted(chunks.size());
+  for (size_t chunk{0}; chunk < chunks.size(); ++chunk)
+  {
+    thread_pool_->submit([&, chunk] {
+      sorted_chunks[chunk] = std::make_shared<Set>(std::move(chunks[chunk]));
+      sort_unique(*sorted_chunks[chunk]);
+      sorted.countDown();
+    });
+  }
+  sorted.wait(*thread_pool_);
+  auto result = merge_matches_if(sorted_chunks, MatchCondition{MatchCondition::Kind::GREATER, 0});
+  total_processed_ += result->size();
+  return result;
+}
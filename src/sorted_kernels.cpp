@@ -0,0 +1,606 @@
+#include "sorted_kernels.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SCALC_X86_KERNELS 1
+#include <immintrin.h>
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace SortedKernels {
+namespace {
+
+using BinaryKernel = size_t (*)(const DataType *, size_t, const DataType *, size_t, DataType *);
+using FilterKernel = size_t (*)(const DataType *, size_t, DataType *);
+
+struct Kernels
+{
+  Level        level;
+  BinaryKernel intersect;
+  BinaryKernel unite;
+  BinaryKernel merge;
+  FilterKernel keep_unique;   // one copy of every value
+  FilterKernel keep_singles;  // the values which occur once
+};
+
+// The scalar kernels replace branches on the comparisons by arithmetic on their results: the
+// outcome of comparing random values can not be predicted, a mispredicted branch costs more
+// than a few redundant stores.
+
+size_t intersectScalar(const DataType *a, size_t a_size, const DataType *b, size_t b_size,
+                       DataType *out)
+{
+  size_t i = 0, j = 0, k = 0;
+  while (i < a_size && j < b_size)
+  {
+    const DataType x = a[i];
+    const DataType y = b[j];
+    out[k]           = x;
+    k += x == y;
+    i += x <= y;
+    j += y <= x;
+  }
+  return k;
+}
+
+size_t uniteScalar(const DataType *a, size_t a_size, const DataType *b, size_t b_size,
+                   DataType *out)
+{
+  size_t i = 0, j = 0, k = 0;
+  while (i < a_size && j < b_size)
+  {
+    const DataType x = a[i];
+    const DataType y = b[j];
+    out[k++]         = y < x ? y : x;
+    i += x <= y;
+    j += y <= x;
+  }
+  out = std::copy(a + i, a + a_size, out + k);
+  std::copy(b + j, b + b_size, out);
+  return k + (a_size - i) + (b_size - j);
+}
+
+size_t mergeScalar(const DataType *a, size_t a_size, const DataType *b, size_t b_size,
+                   DataType *out)
+{
+  size_t i = 0, j = 0, k = 0;
+  while (i < a_size && j < b_size)
+  {
+    const DataType x           = a[i];
+    const DataType y           = b[j];
+    const bool     take_second = y < x;
+    out[k++]                   = take_second ? y : x;
+    i += !take_second;
+    j += take_second;
+  }
+  out = std::copy(a + i, a + a_size, out + k);
+  std::copy(b + j, b + b_size, out);
+  return k + (a_size - i) + (b_size - j);
+}
+
+/// Keeps one copy of every value, continuing after the given last value read.
+size_t keepUniqueScalarAfter(const DataType *values, size_t size, DataType *out, bool has_last,
+                             DataType last)
+{
+  size_t k = 0;
+  for (size_t i{0}; i < size; ++i)
+  {
+    const DataType value = values[i];
+    out[k]               = value;
+    k += !has_last || value != last;
+    has_last = true;
+    last     = value;
+  }
+  return k;
+}
+
+size_t keepUniqueScalar(const DataType *values, size_t size, DataType *out)
+{
+  return keepUniqueScalarAfter(values, size, out, false, 0);
+}
+
+/// Keeps the values which occur once, continuing after the given last value read.
+size_t keepSinglesScalarAfter(const DataType *values, size_t size, DataType *out, bool has_last,
+                              DataType last)
+{
+  size_t k = 0;
+  for (size_t i{0}; i < size; ++i)
+  {
+    const DataType value    = values[i];
+    const bool     repeated = (has_last && value == last) || (i + 1 < size && values[i + 1] == value);
+    out[k]                  = value;
+    k += !repeated;
+    has_last = true;
+    last     = value;
+  }
+  return k;
+}
+
+size_t keepSinglesScalar(const DataType *values, size_t size, DataType *out)
+{
+  return keepSinglesScalarAfter(values, size, out, false, 0);
+}
+
+/// Keeps the values which occur the accepted number of times, for any condition.
+size_t keepMatchesScalar(const DataType *values, size_t size, MatchCondition condition,
+                         DataType *out)
+{
+  size_t k = 0;
+  for (size_t i{0}; i < size;)
+  {
+    const DataType value = values[i];
+    size_t         end   = i + 1;
+    while (end < size && values[end] == value)
+    {
+      ++end;
+    }
+    if (condition.accepts(end - i))
+    {
+      out[k++] = value;
+    }
+    i = end;
+  }
+  return k;
+}
+
+const Kernels SCALAR_KERNELS{Level::SCALAR,    intersectScalar,  uniteScalar,
+                             mergeScalar,      keepUniqueScalar, keepSinglesScalar};
+
+#ifdef SCALC_X86_KERNELS
+
+// SSE4.2 holds two values in a register: the intersection compares every pair of two values
+// of both arrays at once, the filters compare two values with their neighbours.
+
+/**
+ * @brief The values of a found in b are collected over all the pairs of b compared with the
+ * current pair of a and written once a moves on, so running in place never overwrites a value of
+ * a which is still to be read.
+ */
+TARGET_SSE42 size_t intersectSse42(const DataType *a, size_t a_size, const DataType *b,
+                                   size_t b_size, DataType *out)
+{
+  size_t i = 0, j = 0, k = 0;
+  if (a_size >= 2 && b_size >= 2)
+  {
+    __m128i va    = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a));
+    __m128i vb    = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b));
+    int     found = 0;
+    while (true)
+    {
+      const __m128i equal = _mm_or_si128(_mm_cmpeq_epi64(va, vb),
+                                         _mm_cmpeq_epi64(va, _mm_shuffle_epi32(vb, 0x4E)));
+      found |= _mm_movemask_pd(_mm_castsi128_pd(equal));
+      const DataType first     = _mm_cvtsi128_si64(va);
+      const DataType a_max     = _mm_extract_epi64(va, 1);
+      const DataType b_max     = _mm_extract_epi64(vb, 1);
+      const bool     advance_a = a_max <= b_max;
+      const bool     advance_b = b_max <= a_max;
+      if (advance_a)
+      {
+        out[k] = first;
+        k += found & 1;
+        out[k] = a_max;
+        k += (found >> 1) & 1;
+        found = 0;
+        i += 2;
+      }
+      j += advance_b ? 2 : 0;
+      if (i + 2 > a_size || j + 2 > b_size)
+      {
+        if (!advance_a && first <= b_max)
+        {
+          // The first value is settled, the scalar intersection goes on from the second one.
+          out[k] = first;
+          k += found & 1;
+          ++i;
+        }
+        break;
+      }
+      if (advance_a)
+      {
+        va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+      }
+      if (advance_b)
+      {
+        vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + j));
+      }
+    }
+  }
+  return k + intersectScalar(a + i, a_size - i, b + j, b_size - j, out + k);
+}
+
+TARGET_SSE42 size_t keepUniqueSse42(const DataType *values, size_t size, DataType *out)
+{
+  size_t   k        = 0;
+  size_t   i        = 0;
+  bool     has_last = false;
+  DataType last     = 0;
+  for (; i + 2 <= size; i += 2)
+  {
+    const __m128i v    = _mm_loadu_si128(reinterpret_cast<const __m128i *>(values + i));
+    const __m128i prev = _mm_unpacklo_epi64(_mm_cvtsi64_si128(last), v);
+    int           mask = ~_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(v, prev))) & 0x3;
+    mask |= has_last ? 0 : 1;
+    const DataType second = _mm_extract_epi64(v, 1);
+    out[k]                = _mm_cvtsi128_si64(v);
+    k += mask & 1;
+    out[k] = second;
+    k += (mask >> 1) & 1;
+    has_last = true;
+    last     = second;
+  }
+  return k + keepUniqueScalarAfter(values + i, size - i, out + k, has_last, last);
+}
+
+TARGET_SSE42 size_t keepSinglesSse42(const DataType *values, size_t size, DataType *out)
+{
+  size_t   k        = 0;
+  size_t   i        = 0;
+  bool     has_last = false;
+  DataType last     = 0;
+  for (; i + 3 <= size; i += 2)
+  {
+    const __m128i v    = _mm_loadu_si128(reinterpret_cast<const __m128i *>(values + i));
+    const __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i *>(values + i + 1));
+    const __m128i prev = _mm_unpacklo_epi64(_mm_cvtsi64_si128(last), v);
+    int same_as_prev   = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(v, prev)));
+    same_as_prev &= has_last ? 0x3 : 0x2;
+    const int mask = ~(same_as_prev | _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(v, next)))) &
+                     0x3;
+    const DataType second = _mm_extract_epi64(v, 1);
+    out[k]                = _mm_cvtsi128_si64(v);
+    k += mask & 1;
+    out[k] = second;
+    k += (mask >> 1) & 1;
+    has_last = true;
+    last     = second;
+  }
+  return k + keepSinglesScalarAfter(values + i, size - i, out + k, has_last, last);
+}
+
+const Kernels SSE42_KERNELS{Level::SSE42,   intersectSse42,  uniteScalar,
+                            mergeScalar,    keepUniqueSse42, keepSinglesSse42};
+
+/**
+ * Permutations moving the selected 64-bit lanes of an AVX2 register to its beginning, one for
+ * every mask of 4 lanes, as pairs of 32-bit lane indices for _mm256_permutevar8x32_epi32.
+ */
+struct CompressTable
+{
+  CompressTable()
+  {
+    for (unsigned mask{0}; mask < 16; ++mask)
+    {
+      unsigned target = 0;
+      for (unsigned lane{0}; lane < 4; ++lane)
+      {
+        if ((mask >> lane) & 1)
+        {
+          permutations[mask][2 * target]     = int32_t(2 * lane);
+          permutations[mask][2 * target + 1] = int32_t(2 * lane + 1);
+          ++target;
+        }
+      }
+      for (; target < 4; ++target)
+      {
+        permutations[mask][2 * target]     = 0;
+        permutations[mask][2 * target + 1] = 1;
+      }
+    }
+  }
+
+  alignas(32) int32_t permutations[16][8];
+};
+
+const CompressTable COMPRESS_TABLE;
+
+/// Stores the lanes selected by the mask one after another, the whole register is written.
+TARGET_AVX2 inline size_t compressStore(__m256i values, unsigned mask, DataType *out)
+{
+  const __m256i permutation =
+      _mm256_load_si256(reinterpret_cast<const __m256i *>(COMPRESS_TABLE.permutations[mask]));
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(out),
+                      _mm256_permutevar8x32_epi32(values, permutation));
+  return size_t(__builtin_popcount(mask));
+}
+
+TARGET_AVX2 inline unsigned laneMask(__m256i lanes)
+{
+  return unsigned(_mm256_movemask_pd(_mm256_castsi256_pd(lanes)));
+}
+
+/// The register shifted up by one lane, with the given value in the first lane.
+TARGET_AVX2 inline __m256i shiftIn(__m256i values, DataType first)
+{
+  return _mm256_blend_epi32(_mm256_permute4x64_epi64(values, 0x90), _mm256_set1_epi64x(first),
+                            0x03);
+}
+
+TARGET_AVX2 inline void minMax(__m256i &low, __m256i &high)
+{
+  const __m256i greater = _mm256_cmpgt_epi64(low, high);
+  const __m256i minimum = _mm256_blendv_epi8(low, high, greater);
+  high                  = _mm256_blendv_epi8(high, low, greater);
+  low                   = minimum;
+}
+
+/// Sorts a bitonic sequence of 4 values.
+TARGET_AVX2 inline __m256i sortBitonic(__m256i values)
+{
+  __m256i low  = values;
+  __m256i high = _mm256_permute4x64_epi64(values, 0x4E);
+  minMax(low, high);
+  values = _mm256_blend_epi32(low, high, 0xF0);
+  low    = values;
+  high   = _mm256_permute4x64_epi64(values, 0xB1);
+  minMax(low, high);
+  return _mm256_blend_epi32(low, high, 0xCC);
+}
+
+/// Merges two sorted registers: low gets the 4 smallest values, high the 4 largest ones.
+TARGET_AVX2 inline void mergeNetwork(__m256i a, __m256i b, __m256i &low, __m256i &high)
+{
+  low  = a;
+  high = _mm256_permute4x64_epi64(b, 0x1B);
+  minMax(low, high);
+  low  = sortBitonic(low);
+  high = sortBitonic(high);
+}
+
+/**
+ * @brief Compares a register of 4 values of a with every rotation of a register of b and
+ * advances the register holding the smaller maximum. Like in the SSE4.2 version, the values
+ * found are written once the register of a is done with.
+ */
+TARGET_AVX2 size_t intersectAvx2(const DataType *a, size_t a_size, const DataType *b,
+                                 size_t b_size, DataType *out)
+{
+  size_t i = 0, j = 0, k = 0;
+  if (a_size >= 4 && b_size >= 4)
+  {
+    __m256i  va    = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a));
+    __m256i  vb    = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b));
+    unsigned found = 0;
+    while (true)
+    {
+      const __m256i equal = _mm256_or_si256(
+          _mm256_or_si256(_mm256_cmpeq_epi64(va, vb),
+                          _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x39))),
+          _mm256_or_si256(_mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x4E)),
+                          _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x93))));
+      found |= laneMask(equal);
+      const DataType a_max     = _mm256_extract_epi64(va, 3);
+      const DataType b_max     = _mm256_extract_epi64(vb, 3);
+      const bool     advance_a = a_max <= b_max;
+      const bool     advance_b = b_max <= a_max;
+      if (advance_a)
+      {
+        k += compressStore(va, found, out + k);
+        found = 0;
+        i += 4;
+      }
+      j += advance_b ? 4 : 0;
+      if (i + 4 > a_size || j + 4 > b_size)
+      {
+        if (!advance_a)
+        {
+          // The values up to b_max are settled, the scalar intersection goes on from the rest.
+          const unsigned settled =
+              ~laneMask(_mm256_cmpgt_epi64(va, _mm256_set1_epi64x(b_max))) & 0xF;
+          DataType lanes[4];
+          _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), va);
+          for (unsigned lane{0}; (settled >> lane) & 1; ++lane)
+          {
+            out[k] = lanes[lane];
+            k += (found >> lane) & 1;
+            ++i;
+          }
+        }
+        break;
+      }
+      if (advance_a)
+      {
+        va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+      }
+      if (advance_b)
+      {
+        vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + j));
+      }
+    }
+  }
+  return k + intersectScalar(a + i, a_size - i, b + j, b_size - j, out + k);
+}
+
+/**
+ * @brief The vectorized merge of two sorted arrays: the next register is loaded from the array
+ * whose next value is smaller and merged with the 4 largest values so far by a bitonic network,
+ * its 4 smallest values go to the output. What is left, less than 4 values of one array and any
+ * number of the other one, is merged by the scalar kernel.
+ */
+TARGET_AVX2 size_t mergeAvx2(const DataType *a, size_t a_size, const DataType *b, size_t b_size,
+                             DataType *out)
+{
+  if (a_size < 4 || b_size < 4)
+  {
+    return mergeScalar(a, a_size, b, b_size, out);
+  }
+  size_t  i = 4, j = 4, k = 0;
+  __m256i low, high;
+  mergeNetwork(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a)),
+               _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b)), low, high);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), low);
+  k += 4;
+  while (i + 4 <= a_size && j + 4 <= b_size)
+  {
+    // The choice is not predictable, so it is made without a branch.
+    const bool      take_a = a[i] < b[j];
+    const DataType *next   = take_a ? a + i : b + j;
+    i += take_a ? 4 : 0;
+    j += take_a ? 0 : 4;
+    mergeNetwork(high, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(next)), low, high);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + k), low);
+    k += 4;
+  }
+
+  // The carried values are merged with the shorter rest first, then with the longer one.
+  DataType carried[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(carried), high);
+  const bool      a_is_shorter = a_size - i < b_size - j;
+  const DataType *shorter      = a_is_shorter ? a + i : b + j;
+  const size_t    short_size   = a_is_shorter ? a_size - i : b_size - j;
+  DataType        head[4 + 4];
+  const size_t    head_size = mergeScalar(carried, 4, shorter, short_size, head);
+  return k + mergeScalar(head, head_size, a_is_shorter ? b + j : a + i,
+                         a_is_shorter ? b_size - j : a_size - i, out + k);
+}
+
+TARGET_AVX2 size_t keepUniqueAvx2(const DataType *values, size_t size, DataType *out)
+{
+  size_t   k        = 0;
+  size_t   i        = 0;
+  bool     has_last = false;
+  DataType last     = 0;
+  for (; i + 4 <= size; i += 4)
+  {
+    const __m256i v    = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + i));
+    unsigned      mask = ~laneMask(_mm256_cmpeq_epi64(v, shiftIn(v, last))) & 0xF;
+    mask |= has_last ? 0 : 1;
+    k += compressStore(v, mask, out + k);
+    has_last = true;
+    last     = _mm256_extract_epi64(v, 3);
+  }
+  return k + keepUniqueScalarAfter(values + i, size - i, out + k, has_last, last);
+}
+
+TARGET_AVX2 size_t keepSinglesAvx2(const DataType *values, size_t size, DataType *out)
+{
+  size_t   k        = 0;
+  size_t   i        = 0;
+  bool     has_last = false;
+  DataType last     = 0;
+  for (; i + 5 <= size; i += 4)
+  {
+    const __m256i v    = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + i));
+    const __m256i next = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + i + 1));
+    unsigned same_as_prev = laneMask(_mm256_cmpeq_epi64(v, shiftIn(v, last)));
+    same_as_prev &= has_last ? 0xF : 0xE;
+    const unsigned mask = ~(same_as_prev | laneMask(_mm256_cmpeq_epi64(v, next))) & 0xF;
+    k += compressStore(v, mask, out + k);
+    has_last = true;
+    last     = _mm256_extract_epi64(v, 3);
+  }
+  return k + keepSinglesScalarAfter(values + i, size - i, out + k, has_last, last);
+}
+
+// The union of unique arrays skips a half of the comparisons when they overlap, so the scalar
+// kernel keeps up with a merge network over 4 lanes and is used at every level.
+const Kernels AVX2_KERNELS{Level::AVX2, intersectAvx2,  uniteScalar,
+                           mergeAvx2,   keepUniqueAvx2, keepSinglesAvx2};
+
+#endif
+
+const Kernels &kernelsOf(Level level)
+{
+#ifdef SCALC_X86_KERNELS
+  switch (level)
+  {
+  case Level::AVX2:
+    return AVX2_KERNELS;
+  case Level::SSE42:
+    return SSE42_KERNELS;
+  case Level::SCALAR:
+    break;
+  }
+#endif
+  (void)level;
+  return SCALAR_KERNELS;
+}
+
+std::atomic<const Kernels *> active_kernels{nullptr};
+
+const Kernels &kernels()
+{
+  const Kernels *active = active_kernels.load(std::memory_order_relaxed);
+  if (active == nullptr)
+  {
+    active = &kernelsOf(supported());
+    active_kernels.store(active, std::memory_order_relaxed);
+  }
+  return *active;
+}
+
+}  // namespace
+
+Level supported()
+{
+#ifdef SCALC_X86_KERNELS
+  if (__builtin_cpu_supports("avx2"))
+  {
+    return Level::AVX2;
+  }
+  if (__builtin_cpu_supports("sse4.2"))
+  {
+    return Level::SSE42;
+  }
+#endif
+  return Level::SCALAR;
+}
+
+Level active()
+{
+  return kernels().level;
+}
+
+void select(Level level)
+{
+  active_kernels.store(&kernelsOf(std::min(level, supported())), std::memory_order_relaxed);
+}
+
+const char *name(Level level)
+{
+  switch (level)
+  {
+  case Level::SCALAR:
+    return "scalar";
+  case Level::SSE42:
+    return "sse4.2";
+  case Level::AVX2:
+    return "avx2";
+  }
+  return "unknown";
+}
+
+size_t intersect(const DataType *a, size_t a_size, const DataType *b, size_t b_size,
+                 DataType *out)
+{
+  return kernels().intersect(a, a_size, b, b_size, out);
+}
+
+size_t unite(const DataType *a, size_t a_size, const DataType *b, size_t b_size, DataType *out)
+{
+  return kernels().unite(a, a_size, b, b_size, out);
+}
+
+size_t merge(const DataType *a, size_t a_size, const DataType *b, size_t b_size, DataType *out)
+{
+  return kernels().merge(a, a_size, b, b_size, out);
+}
+
+size_t keepMatches(const DataType *values, size_t size, MatchCondition condition, DataType *out)
+{
+  if (condition.kind == MatchCondition::Kind::GREATER && condition.n == 0)
+  {
+    return kernels().keep_unique(values, size, out);
+  }
+  if ((condition.kind == MatchCondition::Kind::EQUAL && condition.n == 1) ||
+      (condition.kind == MatchCondition::Kind::LESS && condition.n == 2))
+  {
+    return kernels().keep_singles(values, size, out);
+  }
+  return keepMatchesScalar(values, size, condition, out);
+}
+
+}  // namespace SortedKernels
@@ -0,0 +1,160 @@
+#include "thread_pool.hpp"
+
+#include <chrono>
+
+namespace {
+
+// Index of the pool queue owned by the current thread, or none for non-worker threads.
+thread_local ThreadPool const *current_pool  = nullptr;
+thread_local size_t            current_queue = 0;
+
+static constexpr auto IDLE_WAIT = std::chrono::milliseconds(1);
+
+}  // namespace
+
+ThreadPool::ThreadPool(size_t workers_count)
+{
+  if (workers_count == 0)
+  {
+    workers_count = 1;
+  }
+  for (size_t i{0}; i < workers_count; ++i)
+  {
+    queues_.emplace_back(new WorkQueue());
+  }
+  for (size_t i{0}; i < workers_count; ++i)
+  {
+    workers_.emplace_back(&ThreadPool::workerLoop, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    stopping_ = true;
+  }
+  wake_up_.notify_all();
+  for (auto &worker : workers_)
+  {
+    worker.join();
+  }
+}
+
+void ThreadPool::submit(Task task)
+{
+  const size_t queue_index =
+      current_pool == this ? current_queue : next_queue_++ % queues_.size();
+  {
+    auto &queue = *queues_[queue_index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back(std::move(task));
+  }
+  {
+    // Taking the lock makes sure a worker which is going to sleep does not miss the task.
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    ++queued_tasks_;
+  }
+  wake_up_.notify_one();
+}
+
+bool ThreadPool::runPendingTask()
+{
+  Task task;
+  if (!popTask(current_pool == this ? current_queue : 0, task))
+  {
+    return false;
+  }
+  task();
+  return true;
+}
+
+size_t ThreadPool::size() const
+{
+  return workers_.size();
+}
+
+/**
+ * @brief Takes the newest task of the preferred queue or steals the oldest one of another queue.
+ */
+bool ThreadPool::popTask(size_t preferred_queue, Task &task)
+{
+  {
+    auto &queue = *queues_[preferred_queue];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty())
+    {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+      --queued_tasks_;
+      return true;
+    }
+  }
+  for (size_t offset{1}; offset < queues_.size(); ++offset)
+  {
+    auto &queue = *queues_[(preferred_queue + offset) % queues_.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty())
+    {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      --queued_tasks_;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::workerLoop(size_t index)
+{
+  current_pool  = this;
+  current_queue = index;
+  while (true)
+  {
+    Task task;
+    if (popTask(index, task))
+    {
+      task();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    wake_up_.wait(lock, [this] { return stopping_ || queued_tasks_ > 0; });
+    if (stopping_ && queued_tasks_ == 0)
+    {
+      return;
+    }
+  }
+}
+
+TaskLatch::TaskLatch(size_t count)
+  : remaining_(count)
+{}
+
+void TaskLatch::countDown()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (remaining_ > 0 && --remaining_ == 0)
+  {
+    done_.notify_all();
+  }
+}
+
+void TaskLatch::wait(ThreadPool &pool)
+{
+  while (true)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (remaining_ == 0)
+      {
+        return;
+      }
+    }
+    if (pool.runPendingTask())
+    {
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait_for(lock, IDLE_WAIT, [this] { return remaining_ == 0; });
+  }
+}
@@ -0,0 +1,501 @@
+#include "value_stream.hpp"
+
+#include "file_reader.hpp"
+#include "logger.hpp"
+#include "set_file.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+namespace {
+
+static constexpr size_t TEXT_BUFFER_SIZE = 1 << 20;
+static constexpr size_t RUN_BUFFER_SIZE  = 1 << 13;  // values read from a spilled run at once
+static constexpr size_t MIN_RUN_SIZE     = 1 << 10;
+// The most runs merged at once, each of them holding a file descriptor and a read buffer.
+static constexpr size_t MAX_MERGE_FAN_IN = 64;
+
+/// Reads a text file of integers sequentially, parsing it a buffer of complete lines at a time.
+class TextChunkReader
+{
+public:
+  explicit TextChunkReader(std::string const &filename)
+    : filename_(filename)
+    , fd_(::open(filename.c_str(), O_RDONLY))
+    , buffer_(TEXT_BUFFER_SIZE, '\0')
+  {
+    if (fd_ < 0)
+    {
+      throw std::runtime_error("can not open '" + filename + "', nothing to process.");
+    }
+    ::posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+
+  ~TextChunkReader()
+  {
+    ::close(fd_);
+  }
+
+  TextChunkReader(TextChunkReader const &) = delete;
+  TextChunkReader &operator=(TextChunkReader const &) = delete;
+
+  // Replaces the values with the ones of the next lines, returns false at the end of the file.
+  bool readChunk(Set &values)
+  {
+    values.clear();
+    while (values.empty())
+    {
+      if (end_of_file_)
+      {
+        return false;
+      }
+      ssize_t result = ::read(fd_, &buffer_[carried_], buffer_.size() - carried_);
+      if (result < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        throw std::runtime_error("can not read '" + filename_ + "': " + std::strerror(errno));
+      }
+      const char *begin  = buffer_.data();
+      const char *filled = begin + carried_ + size_t(result);
+      const char *end    = filled;
+      if (result == 0)
+      {
+        end_of_file_ = true;
+      }
+      else
+      {
+        // Only complete lines are parsed, the rest is carried over to the next read.
+        while (end > begin && end[-1] != '\n')
+        {
+          --end;
+        }
+        if (end == begin)
+        {
+          carried_ = size_t(filled - begin);
+          if (carried_ == buffer_.size())
+          {
+            buffer_.resize(buffer_.size() * 2);
+          }
+          continue;
+        }
+      }
+      FileReader::parseIntegers(begin, end, values, filename_, line_number_);
+      line_number_ += size_t(std::count(begin, end, '\n'));
+      carried_ = size_t(filled - end);
+      std::memmove(&buffer_[0], end, carried_);
+    }
+    return true;
+  }
+
+private:
+  std::string filename_;
+  int         fd_;
+  std::string buffer_;
+  size_t      carried_{0};
+  size_t      line_number_{1};
+  bool        end_of_file_{false};
+};
+
+/// Streams a sorted text file, skipping the repeated values.
+class TextFileStream : public ValueStream
+{
+public:
+  explicit TextFileStream(std::string const &filename)
+    : filename_(filename)
+    , reader_(filename)
+  {}
+
+  bool next(DataType &value) override
+  {
+    while (true)
+    {
+      if (position_ == chunk_.size())
+      {
+        if (!reader_.readChunk(chunk_))
+        {
+          return false;
+        }
+        position_ = 0;
+      }
+      value = chunk_[position_++];
+      if (!started_ || value > last_)
+      {
+        started_ = true;
+        last_    = value;
+        return true;
+      }
+      if (value < last_)
+      {
+        throw std::runtime_error("'" + filename_ + "' is not sorted any more, it has changed.");
+      }
+    }
+  }
+
+private:
+  std::string     filename_;
+  TextChunkReader reader_;
+  Set             chunk_;
+  size_t          position_{0};
+  bool            started_{false};
+  DataType        last_{0};
+};
+
+/// Streams a sorted run of raw values from an unlinked temporary file, closing it at the end.
+class RunFileStream : public ValueStream
+{
+public:
+  explicit RunFileStream(int fd)
+    : fd_(fd)
+    , buffer_(RUN_BUFFER_SIZE)
+  {}
+
+  ~RunFileStream() override
+  {
+    ::close(fd_);
+  }
+
+  RunFileStream(RunFileStream const &) = delete;
+  RunFileStream &operator=(RunFileStream const &) = delete;
+
+  bool next(DataType &value) override
+  {
+    if (position_ == size_)
+    {
+      ssize_t result;
+      do
+      {
+        result = ::read(fd_, buffer_.data(), buffer_.size() * sizeof(DataType));
+      } while (result < 0 && errno == EINTR);
+      if (result < 0)
+      {
+        throw std::runtime_error(std::string("can not read a spilled run: ") +
+                                 std::strerror(errno));
+      }
+      // Runs are written in whole values, so a read never ends in the middle of one.
+      size_     = size_t(result) / sizeof(DataType);
+      position_ = 0;
+      if (size_ == 0)
+      {
+        return false;
+      }
+    }
+    value = buffer_[position_++];
+    return true;
+  }
+
+private:
+  int    fd_;
+  Set    buffer_;
+  size_t position_{0};
+  size_t size_{0};
+};
+
+/// Streams a binary set file, which is sorted and unique by construction.
+class SetFileStream : public ValueStream
+{
+public:
+  explicit SetFileStream(std::string const &filename)
+    : reader_(filename)
+  {}
+
+  bool next(DataType &value) override
+  {
+    return reader_.next(value);
+  }
+
+private:
+  SetFile::Reader reader_;
+};
+
+class SetStream : public ValueStream
+{
+public:
+  explicit SetStream(Set &&values)
+    : values_(std::move(values))
+  {}
+
+  bool next(DataType &value) override
+  {
+    if (position_ == values_.size())
+    {
+      return false;
+    }
+    value = values_[position_++];
+    return true;
+  }
+
+private:
+  Set    values_;
+  size_t position_{0};
+};
+
+class MergeStream : public ValueStream
+{
+public:
+  MergeStream(ValueStreams &&inputs, size_t min_matches, std::function<bool(size_t)> condition)
+    : inputs_(std::move(inputs))
+    , min_matches_(min_matches)
+    , condition_(std::move(condition))
+  {}
+
+  bool next(DataType &value) override
+  {
+    if (!started_)
+    {
+      started_ = true;
+      for (size_t input{0}; input < inputs_.size(); ++input)
+      {
+        advance(input);
+      }
+    }
+    while (!heap_.empty() && heap_.size() >= min_matches_)
+    {
+      const DataType current = heap_.front().first;
+      size_t         matches = 0;
+      while (!heap_.empty() && heap_.front().first == current)
+      {
+        ++matches;
+        const size_t input = heap_.front().second;
+        std::pop_heap(heap_.begin(), heap_.end(), std::greater<HeapItem>());
+        heap_.pop_back();
+        advance(input);
+      }
+      if (condition_(matches))
+      {
+        value = current;
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  using HeapItem = std::pair<DataType, size_t>;  // the current value and its input
+
+  void advance(size_t input)
+  {
+    DataType value;
+    if (inputs_[input]->next(value))
+    {
+      heap_.emplace_back(value, input);
+      std::push_heap(heap_.begin(), heap_.end(), std::greater<HeapItem>());
+    }
+    else
+    {
+      // An exhausted input releases its buffers and spill files right away.
+      inputs_[input].reset();
+    }
+  }
+
+  ValueStreams                inputs_;
+  size_t                      min_matches_;
+  std::function<bool(size_t)> condition_;
+  std::vector<HeapItem>       heap_;
+  bool                        started_{false};
+};
+
+/**
+ * @brief Creates a temporary file for a run, which is unlinked at once so it disappears as soon
+ * as the returned stream is closed, whatever happens to the process.
+ */
+int createRunFile(StreamOptions const &options)
+{
+  std::string path = options.temp_dir + "/scalc-run-XXXXXX";
+  const int   fd   = ::mkstemp(&path[0]);
+  if (fd < 0)
+  {
+    throw std::runtime_error("can not create a spill file in '" + options.temp_dir +
+                             "': " + std::strerror(errno));
+  }
+  ::unlink(path.c_str());
+  return fd;
+}
+
+void writeRunValues(int fd, const DataType *values, size_t count, StreamOptions const &options)
+{
+  const char *data  = reinterpret_cast<const char *>(values);
+  size_t      total = count * sizeof(DataType);
+  while (total > 0)
+  {
+    const ssize_t result = ::write(fd, data, total);
+    if (result < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (result < 0)
+    {
+      throw std::runtime_error("can not write a spill file in '" + options.temp_dir +
+                               "': " + std::strerror(errno));
+    }
+    data += result;
+    total -= size_t(result);
+  }
+}
+
+/// Sorts the run and writes it into a temporary file.
+ValueStreamPtr spillRun(Set &run, StreamOptions const &options)
+{
+  std::sort(run.begin(), run.end());
+  run.erase(std::unique(run.begin(), run.end()), run.end());
+
+  const int      fd = createRunFile(options);
+  ValueStreamPtr stream(new RunFileStream(fd));
+  writeRunValues(fd, run.data(), run.size(), options);
+  ::lseek(fd, 0, SEEK_SET);
+  return stream;
+}
+
+/// Merges the runs into a single one in a temporary file, closing them.
+ValueStreamPtr spillMergedRuns(ValueStreams &&runs, StreamOptions const &options)
+{
+  const int      fd = createRunFile(options);
+  ValueStreamPtr stream(new RunFileStream(fd));
+  auto           merged = mergeStreams(std::move(runs), 1, [](size_t) { return true; });
+  Set            buffer;
+  buffer.reserve(RUN_BUFFER_SIZE);
+  DataType value;
+  while (merged->next(value))
+  {
+    buffer.push_back(value);
+    if (buffer.size() == RUN_BUFFER_SIZE)
+    {
+      writeRunValues(fd, buffer.data(), buffer.size(), options);
+      buffer.clear();
+    }
+  }
+  writeRunValues(fd, buffer.data(), buffer.size(), options);
+  ::lseek(fd, 0, SEEK_SET);
+  return stream;
+}
+
+bool isSortedFile(std::string const &filename)
+{
+  TextChunkReader reader(filename);
+  Set             chunk;
+  bool            started = false;
+  DataType        last    = 0;
+  while (reader.readChunk(chunk))
+  {
+    if ((started && chunk.front() < last) || !std::is_sorted(chunk.begin(), chunk.end()))
+    {
+      return false;
+    }
+    started = true;
+    last    = chunk.back();
+  }
+  return true;
+}
+
+/**
+ * @brief Sorts the file in runs of at most the memory budget. The last run stays in memory,
+ * the others are spilled, and the stream merges them all. The spilled runs are kept by level,
+ * the number of times they were merged: a level reaching MAX_MERGE_FAN_IN runs is merged into
+ * a single run of the next one, so the open runs grow with the logarithm of the file size.
+ */
+ValueStreamPtr sortExternally(std::string const &filename, StreamOptions const &options)
+{
+  const size_t run_capacity =
+      std::max(options.sort_memory_bytes / sizeof(DataType), MIN_RUN_SIZE);
+
+  std::vector<ValueStreams> levels;
+  size_t                    spilled = 0;
+  size_t                    merges  = 0;
+  Set                       run;
+  Set                       chunk;
+  TextChunkReader           reader(filename);
+  while (reader.readChunk(chunk))
+  {
+    for (auto value : chunk)
+    {
+      run.push_back(value);
+      if (run.size() < run_capacity)
+      {
+        continue;
+      }
+      ValueStreamPtr spilled_run = spillRun(run, options);
+      run.clear();
+      ++spilled;
+      for (size_t level{0}; spilled_run; ++level)
+      {
+        if (level == levels.size())
+        {
+          levels.emplace_back();
+        }
+        levels[level].push_back(std::move(spilled_run));
+        if (levels[level].size() == MAX_MERGE_FAN_IN)
+        {
+          spilled_run = spillMergedRuns(std::move(levels[level]), options);
+          levels[level].clear();
+          ++merges;
+        }
+      }
+    }
+  }
+
+  // The lowest levels hold the shortest runs, they are merged first if too many are left.
+  ValueStreams runs;
+  for (auto &level : levels)
+  {
+    std::move(level.begin(), level.end(), std::back_inserter(runs));
+  }
+  while (runs.size() > MAX_MERGE_FAN_IN)
+  {
+    const size_t merged = std::min(MAX_MERGE_FAN_IN, runs.size() - MAX_MERGE_FAN_IN + 1);
+    ValueStreams group(std::make_move_iterator(runs.begin()),
+                       std::make_move_iterator(runs.begin() + std::ptrdiff_t(merged)));
+    runs.erase(runs.begin(), runs.begin() + std::ptrdiff_t(merged));
+    runs.push_back(spillMergedRuns(std::move(group), options));
+    ++merges;
+  }
+  Logger::instance() << "Sorted '" << filename << "' externally, spilled " << spilled
+                     << " runs of up to " << run_capacity << " values, merged " << merges
+                     << " times into " << runs.size() << " runs\n";
+  if (runs.empty())
+  {
+    return openSetStream(std::move(run));
+  }
+  if (!run.empty())
+  {
+    runs.push_back(openSetStream(std::move(run)));
+  }
+  return mergeStreams(std::move(runs), 1, [](size_t) { return true; });
+}
+
+}  // namespace
+
+ValueStreamPtr openFileStream(const std::string &filename, const StreamOptions &options)
+{
+  if (SetFile::isSetFile(filename))
+  {
+    return ValueStreamPtr(new SetFileStream(filename));
+  }
+  // Checking the order costs a sequential scan, but a sorted file is then streamed as is.
+  if (isSortedFile(filename))
+  {
+    return ValueStreamPtr(new TextFileStream(filename));
+  }
+  return sortExternally(filename, options);
+}
+
+ValueStreamPtr openSetStream(Set values)
+{
+  std::sort(values.begin(), values.end());
+  values.erase(std::unique(values.begin(), values.end()), values.end());
+  return ValueStreamPtr(new SetStream(std::move(values)));
+}
+
+ValueStreamPtr mergeStreams(ValueStreams &&inputs, size_t min_matches,
+                            std::function<bool(size_t)> condition)
+{
+  return ValueStreamPtr(new MergeStream(std::move(inputs), min_matches, std::move(condition)));
+}